@@ -0,0 +1,148 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Blue noise threshold map built with Ulichney's void-and-cluster method. Every texel gets a
+// unique rank in [0, 1), and any threshold of the map gives evenly spread points without low
+// frequency clumps, so per-pixel rotations taken from it look like fine grain instead of blotches.
+class BlueNoise {
+public:
+    BlueNoise(int size, unsigned int seed = 1);
+
+    const std::vector<float>& values() const { return _values; }
+    // R8 texture with GL_REPEAT wrapping
+    GLuint createTexture() const;
+
+private:
+    // adds (sign 1) or removes (sign -1) a point's gaussian from the energy field
+    void splat(int index, float sign);
+    int tightestCluster() const;
+    int largestVoid() const;
+
+    int _size;
+    std::vector<float> _gaussian;   // toroidal distance falloff, indexed by offset
+    std::vector<float> _energy;
+    std::vector<uint8_t> _pattern;
+    std::vector<float> _values;
+};
+
+BlueNoise::BlueNoise(int size, unsigned int seed) : _size(size) {
+    int count = size * size;
+    const float sigma = 1.5f;
+    _gaussian.resize(count);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int dx = std::min(x, size - x);
+            int dy = std::min(y, size - y);
+            _gaussian[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+        }
+    }
+    _energy.assign(count, 0.0f);
+    _pattern.assign(count, 0);
+
+    // random initial pattern of about a tenth of the texels
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> pick(0, count - 1);
+    int initialPoints = count / 10;
+    for (int placed = 0; placed < initialPoints;) {
+        int index = pick(rng);
+        if (!_pattern[index]) {
+            _pattern[index] = 1;
+            splat(index, 1.0f);
+            placed++;
+        }
+    }
+    // move points from the tightest cluster to the largest void until it settles
+    for (int iteration = 0; iteration < count; iteration++) {
+        int cluster = tightestCluster();
+        _pattern[cluster] = 0;
+        splat(cluster, -1.0f);
+        int gap = largestVoid();
+        _pattern[gap] = 1;
+        splat(gap, 1.0f);
+        if (gap == cluster) {
+            break;
+        }
+    }
+    std::vector<uint8_t> initialPattern = _pattern;
+    std::vector<float> initialEnergy = _energy;
+    std::vector<int> rank(count, 0);
+
+    // phase 1: rank the initial points by removing the tightest cluster first
+    for (int ones = initialPoints; ones > 0; ones--) {
+        int cluster = tightestCluster();
+        _pattern[cluster] = 0;
+        splat(cluster, -1.0f);
+        rank[cluster] = ones - 1;
+    }
+    // phases 2 and 3: fill the largest voids until every texel has a rank
+    _pattern = initialPattern;
+    _energy = initialEnergy;
+    for (int ones = initialPoints; ones < count; ones++) {
+        int gap = largestVoid();
+        _pattern[gap] = 1;
+        splat(gap, 1.0f);
+        rank[gap] = ones;
+    }
+
+    _values.resize(count);
+    for (int i = 0; i < count; i++) {
+        _values[i] = (rank[i] + 0.5f) / count;
+    }
+}
+
+void BlueNoise::splat(int index, float sign) {
+    int px = index % _size;
+    int py = index / _size;
+    for (int y = 0; y < _size; y++) {
+        int dy = (y - py + _size) % _size;
+        for (int x = 0; x < _size; x++) {
+            int dx = (x - px + _size) % _size;
+            _energy[y * _size + x] += sign * _gaussian[dy * _size + dx];
+        }
+    }
+}
+
+int BlueNoise::tightestCluster() const {
+    int best = -1;
+    for (int i = 0; i < (int)_energy.size(); i++) {
+        if (_pattern[i] && (best < 0 || _energy[i] > _energy[best])) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+int BlueNoise::largestVoid() const {
+    int best = -1;
+    for (int i = 0; i < (int)_energy.size(); i++) {
+        if (!_pattern[i] && (best < 0 || _energy[i] < _energy[best])) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+GLuint BlueNoise::createTexture() const {
+    std::vector<uint8_t> bytes(_values.size());
+    for (int i = 0; i < (int)_values.size(); i++) {
+        bytes[i] = (uint8_t)(_values[i] * 256.0f);
+    }
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, _size, _size, 0, GL_RED, GL_UNSIGNED_BYTE, bytes.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    return texture;
+}
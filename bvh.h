@@ -0,0 +1,523 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "scene.h"
+
+// Bounding volume hierarchy over the world-space triangles of the shadow casters, for tracing
+// shadow rays on the CPU. It is built top down with the binned surface area heuristic and then
+// collapsed into 4-wide nodes whose child boxes are stored as separate x/y/z arrays, so a node is
+// tested with one pass over contiguous floats. Rays only ask whether anything is in the way, so
+// traversal stops at the first hit. occluded() traces packets of 8 rays together with AVX2.
+// nearest() finds the closest triangle to a point, visiting the nearest boxes first.
+class TriangleBvh {
+public:
+    static const int PACKET_SIZE = 8;
+
+    // rays from origin along direction (not normalized), hits count in (0, maxT)
+    struct RayPacket {
+        float originX[PACKET_SIZE], originY[PACKET_SIZE], originZ[PACKET_SIZE];
+        float directionX[PACKET_SIZE], directionY[PACKET_SIZE], directionZ[PACKET_SIZE];
+        float maxT[PACKET_SIZE];
+    };
+
+    // triangles of every object that casts shadows, or only of the static ones
+    void build(const std::vector<SceneObject>& objects, bool staticOnly = false);
+    // bit i is set when ray i of the first count rays hits a triangle
+    unsigned int occluded(const RayPacket& packet, int count) const;
+    bool occluded(const glm::vec3& origin, const glm::vec3& direction, float maxT) const;
+    // distance from p to the closest triangle, maxDistance when none is closer. behind is set when
+    // p lies on the back side of that triangle, which for closed meshes means inside one
+    float nearest(const glm::vec3& p, float maxDistance, bool& behind) const;
+    static glm::vec3 closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+    int triangleCount() const { return (int)_triangles.size(); }
+    int nodeCount() const { return (int)_nodes.size(); }
+
+private:
+    static const int LEAF_SIZE = 4;
+    static const int BINS = 12;
+    // past this depth the build splits at the centroid median instead of the SAH, which halves the
+    // triangles every level, so no path gets deeper than MAX_DEPTH even for degenerate input
+    static const int SAH_DEPTH = 32;
+    static const int MAX_DEPTH = SAH_DEPTH + 32;
+    // a traversal keeps at most three siblings waiting per level, plus the children just pushed
+    static const int STACK_SIZE = 3 * MAX_DEPTH + 4;
+
+    struct Triangle {
+        glm::vec3 v0;
+        glm::vec3 edge1;
+        glm::vec3 edge2;
+    };
+    // child c is an inner node when count[c] == 0 and a leaf of triangles [child[c], child[c] + count[c]) otherwise,
+    // used slots come first and unused ones have child -1
+    struct Node {
+        float minX[4], minY[4], minZ[4];
+        float maxX[4], maxY[4], maxZ[4];
+        int child[4];
+        int count[4];
+    };
+    // binary tree from the SAH build, collapsed into _nodes afterwards
+    struct BuildNode {
+        Bounds bounds;
+        int left = -1;
+        int right = -1;
+        int first = 0;
+        int count = 0;
+    };
+
+    static float area(const Bounds& bounds);
+    static Bounds emptyBounds();
+    int buildRecursive(std::vector<int>& order, int first, int count, int depth);
+    int collapse(int buildNode);
+
+    std::vector<Triangle> _triangles;
+    std::vector<Node> _nodes;
+    std::vector<BuildNode> _buildNodes;
+    std::vector<Bounds> _triangleBounds;
+    std::vector<glm::vec3> _centroids;
+};
+
+float TriangleBvh::area(const Bounds& bounds) {
+    glm::vec3 extent = glm::max(bounds.max - bounds.min, glm::vec3(0.0f));
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+Bounds TriangleBvh::emptyBounds() {
+    Bounds bounds;
+    bounds.min = glm::vec3(std::numeric_limits<float>::max());
+    bounds.max = glm::vec3(-std::numeric_limits<float>::max());
+    return bounds;
+}
+
+void TriangleBvh::build(const std::vector<SceneObject>& objects, bool staticOnly) {
+    std::vector<Triangle> triangles;
+    _triangleBounds.clear();
+    _centroids.clear();
+    for (const SceneObject& object : objects) {
+        if (!object.castsShadow || (staticOnly && !object.isStatic)) {
+            continue;
+        }
+        glm::mat4 model = object.modelMatrix();
+        const std::vector<glm::vec3>& vertices = object.model->vertices();
+        for (int i = 0; i + 2 < (int)vertices.size(); i += 3) {
+            glm::vec3 p0 = glm::vec3(model * glm::vec4(vertices[i], 1.0f));
+            glm::vec3 p1 = glm::vec3(model * glm::vec4(vertices[i + 1], 1.0f));
+            glm::vec3 p2 = glm::vec3(model * glm::vec4(vertices[i + 2], 1.0f));
+            triangles.push_back({ p0, p1 - p0, p2 - p0 });
+            Bounds bounds;
+            bounds.min = glm::min(p0, glm::min(p1, p2));
+            bounds.max = glm::max(p0, glm::max(p1, p2));
+            _triangleBounds.push_back(bounds);
+            _centroids.push_back((bounds.min + bounds.max) * 0.5f);
+        }
+    }
+
+    _buildNodes.clear();
+    _nodes.clear();
+    std::vector<int> order(triangles.size());
+    for (int i = 0; i < (int)order.size(); i++) {
+        order[i] = i;
+    }
+    // leaves reference the triangles in build order
+    _triangles.resize(triangles.size());
+    if (!triangles.empty()) {
+        buildRecursive(order, 0, (int)order.size(), 0);
+        for (int i = 0; i < (int)order.size(); i++) {
+            _triangles[i] = triangles[order[i]];
+        }
+        collapse(0);
+    }
+    _buildNodes.clear();
+    _triangleBounds.clear();
+    _centroids.clear();
+}
+
+int TriangleBvh::buildRecursive(std::vector<int>& order, int first, int count, int depth) {
+    int index = (int)_buildNodes.size();
+    _buildNodes.push_back(BuildNode());
+    Bounds bounds = emptyBounds();
+    Bounds centroidBounds = emptyBounds();
+    for (int i = first; i < first + count; i++) {
+        bounds.min = glm::min(bounds.min, _triangleBounds[order[i]].min);
+        bounds.max = glm::max(bounds.max, _triangleBounds[order[i]].max);
+        centroidBounds.min = glm::min(centroidBounds.min, _centroids[order[i]]);
+        centroidBounds.max = glm::max(centroidBounds.max, _centroids[order[i]]);
+    }
+    _buildNodes[index].bounds = bounds;
+    _buildNodes[index].first = first;
+    _buildNodes[index].count = count;
+    if (count <= LEAF_SIZE) {
+        return index;
+    }
+
+    int middle;
+    if (depth >= SAH_DEPTH) {
+        // median along the widest centroid axis
+        int axis = 0;
+        glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+        if (extent.y > extent[axis]) {
+            axis = 1;
+        }
+        if (extent.z > extent[axis]) {
+            axis = 2;
+        }
+        middle = first + count / 2;
+        std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count, [&](int a, int b) {
+            return _centroids[a][axis] < _centroids[b][axis];
+        });
+    } else {
+        // cheapest split over BINS bins of the centroids along each axis
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        int bestSplit = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            float lo = centroidBounds.min[axis];
+            float extent = centroidBounds.max[axis] - lo;
+            if (extent <= 0.0f) {
+                continue;
+            }
+            Bounds binBounds[BINS];
+            int binCounts[BINS] = {};
+            for (int b = 0; b < BINS; b++) {
+                binBounds[b] = emptyBounds();
+            }
+            for (int i = first; i < first + count; i++) {
+                int b = std::min((int)((_centroids[order[i]][axis] - lo) / extent * BINS), BINS - 1);
+                binCounts[b]++;
+                binBounds[b].min = glm::min(binBounds[b].min, _triangleBounds[order[i]].min);
+                binBounds[b].max = glm::max(binBounds[b].max, _triangleBounds[order[i]].max);
+            }
+            // areas of everything right of each split, then sweep from the left
+            float rightArea[BINS];
+            int rightCount[BINS];
+            Bounds right = emptyBounds();
+            int rightTotal = 0;
+            for (int b = BINS - 1; b > 0; b--) {
+                right.min = glm::min(right.min, binBounds[b].min);
+                right.max = glm::max(right.max, binBounds[b].max);
+                rightTotal += binCounts[b];
+                rightArea[b] = area(right);
+                rightCount[b] = rightTotal;
+            }
+            Bounds left = emptyBounds();
+            int leftTotal = 0;
+            for (int b = 1; b < BINS; b++) {
+                left.min = glm::min(left.min, binBounds[b - 1].min);
+                left.max = glm::max(left.max, binBounds[b - 1].max);
+                leftTotal += binCounts[b - 1];
+                if (leftTotal == 0 || rightCount[b] == 0) {
+                    continue;
+                }
+                float cost = area(left) * leftTotal + rightArea[b] * rightCount[b];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+        // small nodes stay leaves when no split lowers the area-weighted triangle count
+        if (bestAxis >= 0 && bestCost >= area(bounds) * count && count <= 4 * LEAF_SIZE) {
+            return index;
+        }
+
+        if (bestAxis >= 0) {
+            float lo = centroidBounds.min[bestAxis];
+            float extent = centroidBounds.max[bestAxis] - lo;
+            middle = (int)(std::partition(order.begin() + first, order.begin() + first + count, [&](int triangle) {
+                return std::min((int)((_centroids[triangle][bestAxis] - lo) / extent * BINS), BINS - 1) < bestSplit;
+            }) - order.begin());
+        } else {
+            middle = first + count / 2;
+        }
+    }
+    int left = buildRecursive(order, first, middle - first, depth + 1);
+    int right = buildRecursive(order, middle, first + count - middle, depth + 1);
+    _buildNodes[index].left = left;
+    _buildNodes[index].right = right;
+    _buildNodes[index].count = 0;
+    return index;
+}
+
+int TriangleBvh::collapse(int buildNode) {
+    // pull up grandchildren, largest first, until there are four children or only leaves
+    std::vector<int> children = { _buildNodes[buildNode].left, _buildNodes[buildNode].right };
+    if (_buildNodes[buildNode].count > 0) {
+        children = { buildNode };
+    }
+    while (children.size() < 4) {
+        int largest = -1;
+        for (int i = 0; i < (int)children.size(); i++) {
+            if (_buildNodes[children[i]].count == 0 &&
+                (largest < 0 || area(_buildNodes[children[i]].bounds) > area(_buildNodes[children[largest]].bounds))) {
+                largest = i;
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        int expanded = children[largest];
+        children[largest] = _buildNodes[expanded].left;
+        children.push_back(_buildNodes[expanded].right);
+    }
+
+    int index = (int)_nodes.size();
+    _nodes.push_back(Node());
+    for (int c = 0; c < 4; c++) {
+        Bounds bounds = c < (int)children.size() ? _buildNodes[children[c]].bounds : emptyBounds();
+        _nodes[index].minX[c] = bounds.min.x;
+        _nodes[index].minY[c] = bounds.min.y;
+        _nodes[index].minZ[c] = bounds.min.z;
+        _nodes[index].maxX[c] = bounds.max.x;
+        _nodes[index].maxY[c] = bounds.max.y;
+        _nodes[index].maxZ[c] = bounds.max.z;
+        _nodes[index].child[c] = -1;
+        _nodes[index].count[c] = 0;
+    }
+    for (int c = 0; c < (int)children.size(); c++) {
+        const BuildNode& child = _buildNodes[children[c]];
+        if (child.count > 0) {
+            _nodes[index].child[c] = child.first;
+            _nodes[index].count[c] = child.count;
+        } else {
+            int inner = collapse(children[c]);
+            _nodes[index].child[c] = inner;
+        }
+    }
+    return index;
+}
+
+bool TriangleBvh::occluded(const glm::vec3& origin, const glm::vec3& direction, float maxT) const {
+    if (_nodes.empty()) {
+        return false;
+    }
+    glm::vec3 inverse = 1.0f / direction;
+    int stack[STACK_SIZE];
+    int size = 0;
+    stack[size++] = 0;
+    while (size > 0) {
+        const Node& node = _nodes[stack[--size]];
+        for (int c = 0; c < 4 && node.child[c] >= 0; c++) {
+            float t0x = (node.minX[c] - origin.x) * inverse.x, t1x = (node.maxX[c] - origin.x) * inverse.x;
+            float t0y = (node.minY[c] - origin.y) * inverse.y, t1y = (node.maxY[c] - origin.y) * inverse.y;
+            float t0z = (node.minZ[c] - origin.z) * inverse.z, t1z = (node.maxZ[c] - origin.z) * inverse.z;
+            float enter = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), 0.0f));
+            float exit = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), maxT));
+            if (!(enter <= exit)) {
+                continue;
+            }
+            if (node.count[c] == 0) {
+                stack[size++] = node.child[c];
+                continue;
+            }
+            for (int i = node.child[c]; i < node.child[c] + node.count[c]; i++) {
+                // Moller-Trumbore
+                const Triangle& triangle = _triangles[i];
+                glm::vec3 p = glm::cross(direction, triangle.edge2);
+                float determinant = glm::dot(triangle.edge1, p);
+                if (std::abs(determinant) < 1e-12f) {
+                    continue;
+                }
+                float inverseDeterminant = 1.0f / determinant;
+                glm::vec3 s = origin - triangle.v0;
+                float u = glm::dot(s, p) * inverseDeterminant;
+                glm::vec3 q = glm::cross(s, triangle.edge1);
+                float v = glm::dot(direction, q) * inverseDeterminant;
+                float t = glm::dot(triangle.edge2, q) * inverseDeterminant;
+                if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < maxT) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+glm::vec3 TriangleBvh::closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    // Ericson, Real-Time Collision Detection 5.1.5
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) {
+        return a;
+    }
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) {
+        return b;
+    }
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+        return a + ab * (d1 / (d1 - d3));
+    }
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) {
+        return c;
+    }
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+        return a + ac * (d2 / (d2 - d6));
+    }
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    }
+    float denominator = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+float TriangleBvh::nearest(const glm::vec3& p, float maxDistance, bool& behind) const {
+    behind = false;
+    float best = maxDistance;
+    // how squarely p faces the best triangle, decides between triangles sharing the closest edge or vertex
+    float bestFacing = 0.0f;
+    if (_nodes.empty()) {
+        return best;
+    }
+    int stack[STACK_SIZE];
+    int size = 0;
+    stack[size++] = 0;
+    while (size > 0) {
+        const Node& node = _nodes[stack[--size]];
+        float boxDistances[4];
+        int order[4];
+        int children = 0;
+        for (int c = 0; c < 4 && node.child[c] >= 0; c++) {
+            float dx = std::max(std::max(node.minX[c] - p.x, p.x - node.maxX[c]), 0.0f);
+            float dy = std::max(std::max(node.minY[c] - p.y, p.y - node.maxY[c]), 0.0f);
+            float dz = std::max(std::max(node.minZ[c] - p.z, p.z - node.maxZ[c]), 0.0f);
+            boxDistances[c] = std::sqrt(dx * dx + dy * dy + dz * dz);
+            if (boxDistances[c] <= best) {
+                order[children++] = c;
+            }
+        }
+        // inner children go on the stack farthest first, so the nearest box is visited next
+        std::sort(order, order + children, [&](int a, int b) { return boxDistances[a] > boxDistances[b]; });
+        for (int o = 0; o < children; o++) {
+            int c = order[o];
+            if (node.count[c] == 0) {
+                stack[size++] = node.child[c];
+                continue;
+            }
+            for (int i = node.child[c]; i < node.child[c] + node.count[c]; i++) {
+                const Triangle& triangle = _triangles[i];
+                glm::vec3 closest = closestPointOnTriangle(p, triangle.v0, triangle.v0 + triangle.edge1, triangle.v0 + triangle.edge2);
+                glm::vec3 offset = p - closest;
+                float distance = glm::length(offset);
+                float tolerance = 1e-5f * (1.0f + best);
+                if (distance > best + tolerance) {
+                    continue;
+                }
+                glm::vec3 normal = glm::cross(triangle.edge1, triangle.edge2);
+                float normalLength = glm::length(normal);
+                float facing = distance > 0.0f && normalLength > 0.0f ? glm::dot(offset, normal) / (distance * normalLength) : 0.0f;
+                // touching meshes put coplanar faces at the same distance, being inside either one wins
+                bool squarer = std::abs(facing) > std::abs(bestFacing) + 1e-3f ||
+                               (std::abs(facing) >= std::abs(bestFacing) - 1e-3f && facing < bestFacing);
+                if (distance < best - tolerance || squarer) {
+                    best = std::min(best, distance);
+                    bestFacing = facing;
+                }
+            }
+        }
+    }
+    behind = bestFacing < 0.0f;
+    return best;
+}
+
+unsigned int TriangleBvh::occluded(const RayPacket& packet, int count) const {
+    unsigned int hits = 0;
+#ifdef __AVX2__
+    if (_nodes.empty()) {
+        return 0;
+    }
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256 ox = _mm256_loadu_ps(packet.originX), oy = _mm256_loadu_ps(packet.originY), oz = _mm256_loadu_ps(packet.originZ);
+    __m256 dx = _mm256_loadu_ps(packet.directionX), dy = _mm256_loadu_ps(packet.directionY), dz = _mm256_loadu_ps(packet.directionZ);
+    __m256 maxT = _mm256_loadu_ps(packet.maxT);
+    __m256 ix = _mm256_div_ps(one, dx), iy = _mm256_div_ps(one, dy), iz = _mm256_div_ps(one, dz);
+    // rays still looking for a hit
+    __m256 active = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(count), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+
+    int stack[STACK_SIZE];
+    int size = 0;
+    stack[size++] = 0;
+    while (size > 0) {
+        const Node& node = _nodes[stack[--size]];
+        for (int c = 0; c < 4 && node.child[c] >= 0; c++) {
+            __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.minX[c]), ox), ix);
+            __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.maxX[c]), ox), ix);
+            __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.minY[c]), oy), iy);
+            __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.maxY[c]), oy), iy);
+            __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.minZ[c]), oz), iz);
+            __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.maxZ[c]), oz), iz);
+            __m256 enter = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_max_ps(_mm256_min_ps(t0z, t1z), zero));
+            __m256 exit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_min_ps(_mm256_max_ps(t0z, t1z), maxT));
+            __m256 entered = _mm256_and_ps(active, _mm256_cmp_ps(enter, exit, _CMP_LE_OQ));
+            if (_mm256_movemask_ps(entered) == 0) {
+                continue;
+            }
+            if (node.count[c] == 0) {
+                stack[size++] = node.child[c];
+                continue;
+            }
+            for (int i = node.child[c]; i < node.child[c] + node.count[c]; i++) {
+                const Triangle& triangle = _triangles[i];
+                __m256 e1x = _mm256_set1_ps(triangle.edge1.x), e1y = _mm256_set1_ps(triangle.edge1.y), e1z = _mm256_set1_ps(triangle.edge1.z);
+                __m256 e2x = _mm256_set1_ps(triangle.edge2.x), e2y = _mm256_set1_ps(triangle.edge2.y), e2z = _mm256_set1_ps(triangle.edge2.z);
+                // p = direction x edge2
+                __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+                __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+                __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+                __m256 determinant = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+                __m256 inverseDeterminant = _mm256_div_ps(one, determinant);
+                __m256 sx = _mm256_sub_ps(ox, _mm256_set1_ps(triangle.v0.x));
+                __m256 sy = _mm256_sub_ps(oy, _mm256_set1_ps(triangle.v0.y));
+                __m256 sz = _mm256_sub_ps(oz, _mm256_set1_ps(triangle.v0.z));
+                __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), inverseDeterminant);
+                // q = s x edge1
+                __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+                __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+                __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+                __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inverseDeterminant);
+                __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inverseDeterminant);
+                __m256 absDeterminant = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), determinant);
+                __m256 hit = _mm256_cmp_ps(absDeterminant, _mm256_set1_ps(1e-12f), _CMP_GE_OQ);
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, maxT, _CMP_LT_OQ));
+                active = _mm256_andnot_ps(hit, active);
+            }
+            if (_mm256_movemask_ps(active) == 0) {
+                break;
+            }
+        }
+        if (_mm256_movemask_ps(active) == 0) {
+            break;
+        }
+    }
+    unsigned int lanes = count >= PACKET_SIZE ? 0xff : (1u << count) - 1;
+    hits = ~(unsigned int)_mm256_movemask_ps(active) & lanes;
+#else
+    for (int i = 0; i < count; i++) {
+        glm::vec3 origin(packet.originX[i], packet.originY[i], packet.originZ[i]);
+        glm::vec3 direction(packet.directionX[i], packet.directionY[i], packet.directionZ[i]);
+        if (occluded(origin, direction, packet.maxT[i])) {
+            hits |= 1u << i;
+        }
+    }
+#endif
+    return hits;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "frustum.h"
+#include "lightFrustum.h"
+#include "depthReduction.h"
+
+// Cascaded shadow map for the directional light, one layer of a depth array per cascade.
+// With sample distribution the splits only span the depth range that is actually visible
+// and every cascade's box is clipped to the light-space bounds of the visible samples, so
+// no texels are spent on empty space.
+class CascadedShadowMap {
+public:
+    static const int NUM_CASCADES = 4;
+
+    CascadedShadowMap(unsigned int size);
+
+    // splits [nearDepth, farDepth] of the camera's view range and fits one light box per cascade.
+    // samples (may be null) are the bounds of the visible samples from a depth reduction
+    void update(const glm::mat4& lightView, const glm::mat4& cameraView, float fovY, float aspect,
+                float nearDepth, float farDepth, const DepthBounds* samples);
+
+    void begin();
+    // binds cascade i's layer and clears it, returns false when the cascade sees nothing
+    bool beginCascade(int i);
+    // true when a world-space caster can throw a shadow into cascade i
+    bool overlaps(int i, const Bounds& caster) const;
+    void end();
+
+    const glm::mat4& matrix(int i) const { return _matrices[i]; }
+    // view-space distance where cascade i ends
+    float split(int i) const { return _splits[i + 1]; }
+    // depth bias per texel of cascade i, in the cascade's [0, 1] depth units
+    float biasScale(int i) const { return _biasScales[i]; }
+    GLuint texture() const { return _texture; }
+    unsigned int size() const { return _size; }
+    void deleteGLResources();
+
+private:
+    unsigned int _size;
+    GLuint _fbo;
+    GLuint _texture;
+    glm::mat4 _lightView{1.0f};
+    glm::mat4 _matrices[NUM_CASCADES];
+    Bounds _boxes[NUM_CASCADES];        // light view space
+    float _splits[NUM_CASCADES + 1];
+    float _biasScales[NUM_CASCADES];
+};
+
+CascadedShadowMap::CascadedShadowMap(unsigned int size) : _size(size) {
+    glGenTextures(1, &_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, size, size, NUM_CASCADES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+
+    glGenFramebuffers(1, &_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _texture, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ERROR::FRAMEBUFFER:: Cascaded shadow map framebuffer is not complete!" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    for (int i = 0; i < NUM_CASCADES; i++) {
+        _matrices[i] = glm::mat4(1.0f);
+        _biasScales[i] = 0.0f;
+    }
+    for (int i = 0; i <= NUM_CASCADES; i++) {
+        _splits[i] = 0.0f;
+    }
+}
+
+void CascadedShadowMap::update(const glm::mat4& lightView, const glm::mat4& cameraView, float fovY, float aspect,
+                               float nearDepth, float farDepth, const DepthBounds* samples) {
+    _lightView = lightView;
+    farDepth = std::max(farDepth, nearDepth * 1.01f);
+
+    // practical split scheme: a blend of logarithmic and uniform splits
+    const float lambda = 0.8f;
+    for (int i = 0; i <= NUM_CASCADES; i++) {
+        float t = (float)i / NUM_CASCADES;
+        float logSplit = nearDepth * std::pow(farDepth / nearDepth, t);
+        float uniformSplit = nearDepth + (farDepth - nearDepth) * t;
+        _splits[i] = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+    }
+
+    // the samples were reduced with an older light view, move their box into the current one
+    Bounds sampleBox;
+    if (samples) {
+        sampleBox.min = samples->lightMin;
+        sampleBox.max = samples->lightMax;
+        if (samples->lightView != lightView) {
+            sampleBox = sampleBox.transformed(lightView * glm::inverse(samples->lightView));
+        }
+    }
+
+    for (int i = 0; i < NUM_CASCADES; i++) {
+        Frustum slice(glm::perspective(fovY, aspect, _splits[i], _splits[i + 1]) * cameraView);
+        Bounds box = slice.bounds().transformed(lightView);
+        if (samples) {
+            box = box.intersection(sampleBox);
+        }
+        _boxes[i] = box;
+        if (box.empty()) {
+            continue;
+        }
+
+        // a few texels of margin for the PCF kernel and the frame of latency
+        glm::vec2 lo = glm::vec2(box.min);
+        glm::vec2 hi = glm::vec2(box.max);
+        glm::vec2 margin = 4.0f * (hi - lo) / (float)_size;
+        lo -= margin;
+        hi += margin;
+        glm::vec2 texel = snapToTexels(lo, hi, _size);
+
+        // the light looks down -z, casters in front of the near plane are pancaked onto it
+        float zNear = -box.max.z;
+        float zFar = -box.min.z;
+        float padding = std::max(0.01f * (zFar - zNear), 0.01f);
+        zNear -= padding;
+        zFar += padding;
+
+        _matrices[i] = glm::ortho(lo.x, hi.x, lo.y, hi.y, zNear, zFar) * lightView;
+        _biasScales[i] = std::max(texel.x, texel.y) / (zFar - zNear);
+        _boxes[i].min = glm::vec3(lo, -zFar);
+        _boxes[i].max = glm::vec3(hi, -zNear);
+    }
+}
+
+void CascadedShadowMap::begin() {
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glViewport(0, 0, _size, _size);
+    glEnable(GL_DEPTH_CLAMP);
+}
+
+bool CascadedShadowMap::beginCascade(int i) {
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _texture, 0, i);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    return !_boxes[i].empty();
+}
+
+bool CascadedShadowMap::overlaps(int i, const Bounds& caster) const {
+    Bounds box = caster.transformed(_lightView);
+    const Bounds& cascade = _boxes[i];
+    // casters further from the light than the cascade's receivers can't shadow them
+    return box.min.x <= cascade.max.x && box.max.x >= cascade.min.x &&
+           box.min.y <= cascade.max.y && box.max.y >= cascade.min.y &&
+           box.max.z >= cascade.min.z;
+}
+
+void CascadedShadowMap::end() {
+    glDisable(GL_DEPTH_CLAMP);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void CascadedShadowMap::deleteGLResources() {
+    glDeleteFramebuffers(1, &_fbo);
+    glDeleteTextures(1, &_texture);
+}
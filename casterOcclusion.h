@@ -0,0 +1,170 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "shader.h"
+#include "scene.h"
+
+// Two-phase occlusion culling of shadow casters from the light's point of view. Phase one draws
+// the casters that were visible last frame. A min/max pyramid of that partial shadow map then
+// re-tests every caster, and phase two draws the ones that were skipped but turned out visible,
+// so a caster coming out from behind an occluder never pops. The test results stay on the GPU as
+// the instance counts of indirect draws and become the next frame's phase one.
+class CasterOcclusion {
+public:
+    // the buffers start out with room for maxCasters and grow with the caster list
+    CasterOcclusion(int maxCasters);
+
+    // compute shaders and storage buffers need GL 4.3, without them every caster is drawn
+    bool supported() const { return _supported; }
+    // light-space footprints of this frame's casters, given as indices into objects; a different
+    // caster list starts over with every caster visible
+    void setCasters(const std::vector<SceneObject>& objects, const std::vector<int>& casters,
+                    const glm::mat4& lightSpaceMatrix, bool reversedZ);
+    // phase one: the casters visible last frame, with the depth shader in use
+    void drawVisible(Shader* shader);
+    // tests every caster against the pyramid of what phase one drew
+    void test(GLuint depthPyramid, bool reversedZ);
+    // phase two: the casters the test found visible that phase one skipped
+    void drawNewlyVisible(Shader* shader);
+    int casterCount() const { return (int)_casters.size(); }
+    void deleteGLResources();
+
+private:
+    struct CasterBounds {
+        glm::vec4 rect;
+        glm::vec4 depth;
+    };
+    struct DrawCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint first;
+        GLuint baseInstance;
+    };
+
+    void draw(Shader* shader, int phase);
+    // sizes the per-caster storage buffers
+    void allocate(int maxCasters);
+
+    bool _supported;
+    int _maxCasters;
+    // the scene's object list itself, which stays put while its elements move when it grows
+    const std::vector<SceneObject>* _objects = nullptr;
+    std::vector<int> _casters;
+    std::vector<CasterBounds> _bounds;
+    GLuint _boundsBuffer;
+    GLuint _drawBuffer;
+    Shader* _testShader = nullptr;
+};
+
+CasterOcclusion::CasterOcclusion(int maxCasters) : _maxCasters(maxCasters) {
+    _supported = GLAD_GL_VERSION_4_3;
+    glGenBuffers(1, &_boundsBuffer);
+    glGenBuffers(1, &_drawBuffer);
+    if (!_supported) {
+        std::cout << "Shadow caster occlusion culling needs OpenGL 4.3 compute shaders, disabled" << std::endl;
+        return;
+    }
+    allocate(maxCasters);
+    _testShader = new Shader("shaders/casterOcclusion.comp");
+}
+
+void CasterOcclusion::allocate(int maxCasters) {
+    _maxCasters = maxCasters;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _boundsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxCasters * sizeof(CasterBounds), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _drawBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * maxCasters * sizeof(DrawCommand), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void CasterOcclusion::setCasters(const std::vector<SceneObject>& objects, const std::vector<int>& casters,
+                                 const glm::mat4& lightSpaceMatrix, bool reversedZ) {
+    if (!_supported) {
+        return;
+    }
+    _objects = &objects;
+    if ((int)casters.size() > _maxCasters) {
+        // doubling keeps a streaming scene from reallocating every frame, the fresh buffers start over
+        int maxCasters = std::max(_maxCasters, 1);
+        while (maxCasters < (int)casters.size()) {
+            maxCasters *= 2;
+        }
+        allocate(maxCasters);
+        _casters.clear();
+        std::cout << "Shadow caster occlusion grew to " << maxCasters << " casters" << std::endl;
+    }
+    if (casters != _casters) {
+        // unknown visibility, phase one draws everything once
+        _casters = casters;
+        std::vector<DrawCommand> commands(2 * _casters.size());
+        for (int i = 0; i < (int)_casters.size(); i++) {
+            GLuint vertexCount = objects[_casters[i]].model->vertexCount();
+            commands[i] = { vertexCount, 1, 0, 0 };
+            commands[_casters.size() + i] = { vertexCount, 0, 0, 0 };
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, _drawBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, commands.size() * sizeof(DrawCommand), commands.data());
+    }
+
+    _bounds.resize(_casters.size());
+    for (int i = 0; i < (int)_casters.size(); i++) {
+        glm::vec3 boundsMin, boundsMax;
+        objects[_casters[i]].worldBounds(boundsMin, boundsMax);
+        glm::vec3 ndcMin, ndcMax;
+        transformBounds(lightSpaceMatrix, boundsMin, boundsMax, ndcMin, ndcMax);
+        // casters in front of the near plane are pancaked onto it
+        float nearest = reversedZ ? glm::clamp(ndcMax.z, 0.0f, 1.0f) : glm::clamp(ndcMin.z * 0.5f + 0.5f, 0.0f, 1.0f);
+        _bounds[i].rect = glm::vec4(glm::vec2(ndcMin) * 0.5f + 0.5f, glm::vec2(ndcMax) * 0.5f + 0.5f);
+        _bounds[i].depth = glm::vec4(nearest, 0.0f, 0.0f, 0.0f);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _boundsBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, _bounds.size() * sizeof(CasterBounds), _bounds.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void CasterOcclusion::draw(Shader* shader, int phase) {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _drawBuffer);
+    for (int i = 0; i < (int)_casters.size(); i++) {
+        const SceneObject& caster = (*_objects)[_casters[i]];
+        shader->setMat4("model", caster.modelMatrix());
+        caster.model->drawIndirect((phase * _casters.size() + i) * sizeof(DrawCommand));
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void CasterOcclusion::drawVisible(Shader* shader) {
+    draw(shader, 0);
+}
+
+void CasterOcclusion::test(GLuint depthPyramid, bool reversedZ) {
+    if (_casters.empty()) {
+        return;
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _boundsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _drawBuffer);
+    _testShader->use();
+    _testShader->setInt("casterCount", (int)_casters.size());
+    _testShader->setBool("reversedZ", reversedZ);
+    _testShader->setInt("depthPyramid", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depthPyramid);
+    glDispatchCompute(((int)_casters.size() + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+void CasterOcclusion::drawNewlyVisible(Shader* shader) {
+    draw(shader, 1);
+}
+
+void CasterOcclusion::deleteGLResources() {
+    glDeleteBuffers(1, &_boundsBuffer);
+    glDeleteBuffers(1, &_drawBuffer);
+    delete _testShader;
+}
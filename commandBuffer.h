@@ -0,0 +1,57 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Draws recorded away from the GL thread. A job fills one buffer per pass, cascade or light with
+// small POD commands whose values go to a float arena next to them; nothing here talks to the
+// graphics API, uniform slots and mesh handles are plain integers the replay resolves. clear()
+// keeps both arenas' capacity, so after the first frames recording doesn't allocate.
+class CommandBuffer {
+public:
+    enum Type : uint8_t {
+        SET_MAT4,
+        SET_MAT3,
+        SET_VEC4,
+        DRAW,
+    };
+
+    // 16 bytes. Uniforms use slot and the arena offset in first, draws the mesh handle in slot
+    // and the vertex range in first and count
+    struct Command {
+        Type type;
+        int32_t slot;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    void clear() {
+        _commands.clear();
+        _values.clear();
+    }
+    void setMat4(int slot, const glm::mat4& value) { record(SET_MAT4, slot, &value[0][0], 16); }
+    void setMat3(int slot, const glm::mat3& value) { record(SET_MAT3, slot, &value[0][0], 9); }
+    void setVec4(int slot, const glm::vec4& value) { record(SET_VEC4, slot, &value[0], 4); }
+    void draw(uint32_t mesh, uint32_t firstVertex, uint32_t vertexCount) {
+        _commands.push_back({ DRAW, (int32_t)mesh, firstVertex, vertexCount });
+    }
+
+    const std::vector<Command>& commands() const { return _commands; }
+    const float* values(const Command& command) const { return &_values[command.first]; }
+    int size() const { return (int)_commands.size(); }
+
+private:
+    void record(Type type, int slot, const float* value, int floats) {
+        // a slot the shader doesn't have would be ignored by the API anyway
+        if (slot < 0) {
+            return;
+        }
+        _commands.push_back({ type, slot, (uint32_t)_values.size(), (uint32_t)floats });
+        _values.insert(_values.end(), value, value + floats);
+    }
+
+    std::vector<Command> _commands;
+    std::vector<float> _values;
+};
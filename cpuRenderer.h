@@ -0,0 +1,523 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "scene.h"
+#include "threadPool.h"
+#include "bvh.h"
+
+// Software version of the main light's shadow mapping for machines where GL is missing or slow,
+// and a reference image for comparing against the GL path. It renders the orthographic shadow map
+// and then the lit pass of basic.frag (hard or 3x3 PCF shadows, no spot lights). Triangles are
+// binned into 64x64 pixel tiles and every tile is rasterized and shaded on its own thread. Edge
+// functions and depth are evaluated 8 pixels at a time with AVX2; the rasterizer only records the
+// nearest triangle and its barycentrics per pixel, so every visible pixel is shaded once.
+// Shadows can instead come from rays toward the light through a TriangleBvh of the casters,
+// which is exact and needs no resolution or bias tuning.
+class CpuRenderer {
+public:
+    // the uniforms basic.frag gets for the main light
+    struct Lighting {
+        glm::vec3 lightPos;
+        glm::vec3 eyePos;
+        glm::mat4 lightSpaceMatrix;
+        float shadowTexelDepth;
+        bool pcf;
+        // shadow rays through a BVH of the casters instead of the shadow map
+        bool rayTraced = false;
+    };
+
+    CpuRenderer(int width, int height, int shadowSize);
+
+    void render(const std::vector<SceneObject>& objects, const glm::mat4& viewProjection, const Lighting& lighting, ThreadPool* pool);
+    // binary PPM, top row first like any image viewer expects
+    bool writePPM(const char* path) const;
+    // shadow factor of every pixel of the last render, -1 where nothing was drawn
+    const std::vector<float>& shadowTerms() const { return _shadowTerms; }
+    int width() const { return _color.width; }
+    int height() const { return _color.height; }
+
+private:
+    static const int TILE_SIZE = 64;
+    // world units shadow rays start off their surface
+    static constexpr float RAY_OFFSET = 1e-3f;
+
+    struct Triangle {
+        glm::vec3 screen[3];    // pixels, window depth in z
+        float invW[3];
+        glm::vec3 world[3];
+        glm::vec3 normal[3];
+        glm::ivec2 pixelMin;
+        glm::ivec2 pixelMax;
+    };
+    struct Target {
+        int width;
+        int height;
+        std::vector<float> depth;
+        // nearest triangle and its screen-space barycentrics of vertices 1 and 2, -1 where empty
+        std::vector<int> triangle;
+        std::vector<float> b1;
+        std::vector<float> b2;
+        // RGB8
+        std::vector<uint8_t> color;
+    };
+
+    // a covered pixel waiting for its shadow and shading
+    struct Surface {
+        int pixel;
+        int triangle;
+        glm::vec3 position;
+        glm::vec3 normal;
+        float shadow;
+    };
+
+    static void resize(Target& target, int width, int height, bool visibility);
+    // transforms, clips and bins every triangle of the objects for the target
+    void setup(const std::vector<SceneObject>& objects, const glm::mat4& viewProjection, const Target& target,
+               bool depthClamp, bool casterPass);
+    void addTriangle(const glm::vec4 clip[3], const glm::vec3 world[3], const glm::vec3 normal[3], const Target& target, bool depthClamp);
+    void rasterizeTile(Target& target, int tile, bool depthClamp);
+    void shadeTile(int tile, const Lighting& lighting);
+    float shadowMapDepth(glm::vec2 uv) const;
+    float shadow(const glm::vec3& position, const glm::vec3& normal, const Lighting& lighting) const;
+    void traceShadows(std::vector<Surface>& surfaces, const Lighting& lighting) const;
+    void setColor(int pixel, glm::vec3 color);
+    void renderTarget(Target& target, bool depthClamp, ThreadPool* pool, const std::function<void(int)>& afterTile);
+
+    Target _shadow;
+    Target _color;
+    int _tilesX = 0;
+    int _tilesY = 0;
+    std::vector<Triangle> _triangles;
+    std::vector<std::vector<int>> _bins;
+    std::vector<float> _shadowTerms;
+    TriangleBvh _bvh;
+    bool _bvhValid = false;
+    std::vector<glm::mat4> _bvhCasterMatrices;
+};
+
+CpuRenderer::CpuRenderer(int width, int height, int shadowSize) {
+    resize(_color, width, height, true);
+    resize(_shadow, shadowSize, shadowSize, false);
+    _shadowTerms.resize(width * height);
+}
+
+void CpuRenderer::resize(Target& target, int width, int height, bool visibility) {
+    target.width = width;
+    target.height = height;
+    target.depth.resize(width * height);
+    if (visibility) {
+        target.triangle.resize(width * height);
+        target.b1.resize(width * height);
+        target.b2.resize(width * height);
+        target.color.resize(3 * width * height);
+    }
+}
+
+void CpuRenderer::addTriangle(const glm::vec4 clip[3], const glm::vec3 world[3], const glm::vec3 normal[3], const Target& target, bool depthClamp) {
+    Triangle triangle;
+    glm::vec2 lo(1e30f), hi(-1e30f);
+    for (int i = 0; i < 3; i++) {
+        triangle.invW[i] = 1.0f / clip[i].w;
+        glm::vec3 ndc = glm::vec3(clip[i]) * triangle.invW[i];
+        float depth = ndc.z * 0.5f + 0.5f;
+        triangle.screen[i] = glm::vec3((ndc.x * 0.5f + 0.5f) * target.width, (ndc.y * 0.5f + 0.5f) * target.height,
+                                       depthClamp ? glm::clamp(depth, 0.0f, 1.0f) : depth);
+        triangle.world[i] = world[i];
+        triangle.normal[i] = normal[i];
+        lo = glm::min(lo, glm::vec2(triangle.screen[i]));
+        hi = glm::max(hi, glm::vec2(triangle.screen[i]));
+    }
+    // pixels whose centers can be inside
+    triangle.pixelMin = glm::ivec2(std::max((int)std::floor(lo.x), 0), std::max((int)std::floor(lo.y), 0));
+    triangle.pixelMax = glm::ivec2(std::min((int)std::ceil(hi.x), target.width - 1), std::min((int)std::ceil(hi.y), target.height - 1));
+    if (triangle.pixelMin.x > triangle.pixelMax.x || triangle.pixelMin.y > triangle.pixelMax.y) {
+        return;
+    }
+
+    int index = (int)_triangles.size();
+    _triangles.push_back(triangle);
+    for (int ty = triangle.pixelMin.y / TILE_SIZE; ty <= triangle.pixelMax.y / TILE_SIZE; ty++) {
+        for (int tx = triangle.pixelMin.x / TILE_SIZE; tx <= triangle.pixelMax.x / TILE_SIZE; tx++) {
+            _bins[ty * _tilesX + tx].push_back(index);
+        }
+    }
+}
+
+void CpuRenderer::setup(const std::vector<SceneObject>& objects, const glm::mat4& viewProjection, const Target& target,
+                        bool depthClamp, bool casterPass) {
+    _tilesX = (target.width + TILE_SIZE - 1) / TILE_SIZE;
+    _tilesY = (target.height + TILE_SIZE - 1) / TILE_SIZE;
+    _triangles.clear();
+    _bins.assign(_tilesX * _tilesY, std::vector<int>());
+
+    for (const SceneObject& object : objects) {
+        if (casterPass && !object.castsShadow) {
+            continue;
+        }
+        glm::mat4 model = object.modelMatrix();
+        const glm::mat3& normalMatrix = object.normalMatrix();
+        const std::vector<glm::vec3>& vertices = object.model->vertices();
+        const std::vector<glm::vec3>& normals = object.model->normals();
+        for (int i = 0; i + 2 < (int)vertices.size(); i += 3) {
+            glm::vec4 clip[3];
+            glm::vec3 world[3];
+            glm::vec3 normal[3];
+            for (int j = 0; j < 3; j++) {
+                world[j] = glm::vec3(model * glm::vec4(vertices[i + j], 1.0f));
+                normal[j] = glm::normalize(normalMatrix * normals[i + j]);
+                clip[j] = viewProjection * glm::vec4(world[j], 1.0f);
+            }
+            if (depthClamp) {
+                // orthographic, nothing to clip
+                addTriangle(clip, world, normal, target, depthClamp);
+                continue;
+            }
+
+            // near plane clipping, z >= -w in GL clip space
+            glm::vec4 polyClip[4];
+            glm::vec3 polyWorld[4];
+            glm::vec3 polyNormal[4];
+            int count = 0;
+            for (int j = 0; j < 3; j++) {
+                int k = (j + 1) % 3;
+                float dj = clip[j].z + clip[j].w;
+                float dk = clip[k].z + clip[k].w;
+                if (dj >= 0.0f) {
+                    polyClip[count] = clip[j];
+                    polyWorld[count] = world[j];
+                    polyNormal[count] = normal[j];
+                    count++;
+                }
+                if ((dj >= 0.0f) != (dk >= 0.0f)) {
+                    float t = dj / (dj - dk);
+                    polyClip[count] = glm::mix(clip[j], clip[k], t);
+                    polyWorld[count] = glm::mix(world[j], world[k], t);
+                    polyNormal[count] = glm::mix(normal[j], normal[k], t);
+                    count++;
+                }
+            }
+            for (int j = 1; j + 1 < count; j++) {
+                glm::vec4 c[3] = { polyClip[0], polyClip[j], polyClip[j + 1] };
+                glm::vec3 w[3] = { polyWorld[0], polyWorld[j], polyWorld[j + 1] };
+                glm::vec3 n[3] = { polyNormal[0], polyNormal[j], polyNormal[j + 1] };
+                addTriangle(c, w, n, target, depthClamp);
+            }
+        }
+    }
+}
+
+void CpuRenderer::rasterizeTile(Target& target, int tile, bool depthClamp) {
+    int x0 = (tile % _tilesX) * TILE_SIZE;
+    int y0 = (tile / _tilesX) * TILE_SIZE;
+    int x1 = std::min(x0 + TILE_SIZE, target.width);
+    int y1 = std::min(y0 + TILE_SIZE, target.height);
+    bool visibility = !target.triangle.empty();
+    for (int y = y0; y < y1; y++) {
+        std::fill(target.depth.begin() + y * target.width + x0, target.depth.begin() + y * target.width + x1, 1.0f);
+        if (visibility) {
+            std::fill(target.triangle.begin() + y * target.width + x0, target.triangle.begin() + y * target.width + x1, -1);
+        }
+    }
+
+    // bins are in submission order, so equal depths resolve like GL_LESS does
+    for (int index : _bins[tile]) {
+        const Triangle& triangle = _triangles[index];
+        const glm::vec3* v = triangle.screen;
+        float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+        if (area == 0.0f) {
+            continue;
+        }
+        // edge i is opposite vertex i; both windings are drawn, like the lit pass without culling
+        float sign = area > 0.0f ? 1.0f : -1.0f;
+        float invArea = 1.0f / std::abs(area);
+        float a[3], b[3], c[3];
+        bool topLeft[3];
+        for (int i = 0; i < 3; i++) {
+            const glm::vec3& p = v[(i + 1) % 3];
+            const glm::vec3& q = v[(i + 2) % 3];
+            a[i] = sign * (p.y - q.y);
+            b[i] = sign * (q.x - p.x);
+            c[i] = sign * (p.x * q.y - p.y * q.x);
+            // pixels exactly on a shared edge belong to one triangle only
+            topLeft[i] = a[i] > 0.0f || (a[i] == 0.0f && b[i] < 0.0f);
+        }
+
+        int xs = std::max(triangle.pixelMin.x, x0);
+        int xe = std::min(triangle.pixelMax.x + 1, x1);
+        int ys = std::max(triangle.pixelMin.y, y0);
+        int ye = std::min(triangle.pixelMax.y + 1, y1);
+        for (int y = ys; y < ye; y++) {
+            float py = y + 0.5f;
+            int row = y * target.width;
+#ifdef __AVX2__
+            __m256 laneOffsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+            for (int x = xs; x < xe; x += 8) {
+                __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), laneOffsets);
+                // lanes past the end of the row are never loaded or stored
+                __m256i laneMask = _mm256_cmpgt_epi32(_mm256_set1_epi32(xe - x), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+                __m256 inside = _mm256_castsi256_ps(laneMask);
+                __m256 e[3];
+                for (int i = 0; i < 3; i++) {
+                    e[i] = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(a[i]), px), _mm256_set1_ps(b[i] * py + c[i]));
+                    __m256 passes = topLeft[i] ? _mm256_cmp_ps(e[i], _mm256_setzero_ps(), _CMP_GE_OQ)
+                                               : _mm256_cmp_ps(e[i], _mm256_setzero_ps(), _CMP_GT_OQ);
+                    inside = _mm256_and_ps(inside, passes);
+                }
+                if (_mm256_movemask_ps(inside) == 0) {
+                    continue;
+                }
+                __m256 b1 = _mm256_mul_ps(e[1], _mm256_set1_ps(invArea));
+                __m256 b2 = _mm256_mul_ps(e[2], _mm256_set1_ps(invArea));
+                __m256 z = _mm256_add_ps(_mm256_set1_ps(v[0].z), _mm256_add_ps(_mm256_mul_ps(b1, _mm256_set1_ps(v[1].z - v[0].z)),
+                                                                                 _mm256_mul_ps(b2, _mm256_set1_ps(v[2].z - v[0].z))));
+                if (!depthClamp) {
+                    // the far plane clips
+                    inside = _mm256_and_ps(inside, _mm256_cmp_ps(z, _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+                }
+                __m256 stored = _mm256_maskload_ps(&target.depth[row + x], laneMask);
+                __m256 closer = _mm256_and_ps(inside, _mm256_cmp_ps(z, stored, _CMP_LT_OQ));
+                __m256i write = _mm256_castps_si256(closer);
+                _mm256_maskstore_ps(&target.depth[row + x], write, z);
+                if (visibility) {
+                    _mm256_maskstore_epi32(&target.triangle[row + x], write, _mm256_set1_epi32(index));
+                    _mm256_maskstore_ps(&target.b1[row + x], write, b1);
+                    _mm256_maskstore_ps(&target.b2[row + x], write, b2);
+                }
+            }
+#else
+            for (int x = xs; x < xe; x++) {
+                float px = x + 0.5f;
+                float e[3];
+                bool inside = true;
+                for (int i = 0; i < 3; i++) {
+                    e[i] = a[i] * px + (b[i] * py + c[i]);
+                    inside &= topLeft[i] ? e[i] >= 0.0f : e[i] > 0.0f;
+                }
+                if (!inside) {
+                    continue;
+                }
+                float b1 = e[1] * invArea;
+                float b2 = e[2] * invArea;
+                float z = v[0].z + b1 * (v[1].z - v[0].z) + b2 * (v[2].z - v[0].z);
+                if ((!depthClamp && z > 1.0f) || z >= target.depth[row + x]) {
+                    continue;
+                }
+                target.depth[row + x] = z;
+                if (visibility) {
+                    target.triangle[row + x] = index;
+                    target.b1[row + x] = b1;
+                    target.b2[row + x] = b2;
+                }
+            }
+#endif
+        }
+    }
+}
+
+float CpuRenderer::shadowMapDepth(glm::vec2 uv) const {
+    // nearest filtering, the border is the far plane like GL_CLAMP_TO_BORDER with a white border
+    if (uv.x < 0.0f || uv.y < 0.0f || uv.x >= 1.0f || uv.y >= 1.0f) {
+        return 1.0f;
+    }
+    int x = std::min((int)(uv.x * _shadow.width), _shadow.width - 1);
+    int y = std::min((int)(uv.y * _shadow.height), _shadow.height - 1);
+    return _shadow.depth[y * _shadow.width + x];
+}
+
+float CpuRenderer::shadow(const glm::vec3& position, const glm::vec3& normal, const Lighting& lighting) const {
+    // shadowCalculation() of shadow.glsl for the orthographic map with forward float depth
+    glm::vec4 lightSpace = lighting.lightSpaceMatrix * glm::vec4(position, 1.0f);
+    glm::vec3 projCoords = glm::vec3(lightSpace) / lightSpace.w * 0.5f + 0.5f;
+    if (projCoords.z > 1.0f) {
+        return 0.0f;
+    }
+    glm::vec3 lightVector = glm::normalize(lighting.lightPos - position);
+    float NdotL = std::max(glm::dot(normal, lightVector), 0.0f);
+    float tanTheta = std::min(std::sqrt(1.0f - NdotL * NdotL) / std::max(NdotL, 1e-3f), 8.0f);
+    float bias = lighting.shadowTexelDepth * (1.0f + tanTheta) + 2.0f * std::max(projCoords.z * std::exp2(-23.0f), 1e-30f);
+
+    if (!lighting.pcf) {
+        return projCoords.z - bias > shadowMapDepth(glm::vec2(projCoords)) ? 1.0f : 0.0f;
+    }
+    float texel = 1.0f / _shadow.width;
+    float sum = 0.0f;
+    for (int x = -1; x <= 1; x++) {
+        for (int y = -1; y <= 1; y++) {
+            sum += projCoords.z - bias > shadowMapDepth(glm::vec2(projCoords) + glm::vec2(x, y) * texel) ? 1.0f : 0.0f;
+        }
+    }
+    return sum / 9.0f;
+}
+
+void CpuRenderer::shadeTile(int tile, const Lighting& lighting) {
+    int x0 = (tile % _tilesX) * TILE_SIZE;
+    int y0 = (tile / _tilesX) * TILE_SIZE;
+    int x1 = std::min(x0 + TILE_SIZE, _color.width);
+    int y1 = std::min(y0 + TILE_SIZE, _color.height);
+
+    // surface of every covered pixel, row by row so neighbouring rays end up in the same packet
+    std::vector<Surface> surfaces;
+    surfaces.reserve(TILE_SIZE * TILE_SIZE);
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            int pixel = y * _color.width + x;
+            int index = _color.triangle[pixel];
+            _shadowTerms[pixel] = -1.0f;
+            if (index < 0) {
+                continue;
+            }
+            // perspective correct interpolation from the screen-space barycentrics
+            const Triangle& triangle = _triangles[index];
+            float b1 = _color.b1[pixel], b2 = _color.b2[pixel];
+            glm::vec3 weights(1.0f - b1 - b2, b1, b2);
+            weights *= glm::vec3(triangle.invW[0], triangle.invW[1], triangle.invW[2]);
+            weights /= weights.x + weights.y + weights.z;
+            Surface surface;
+            surface.pixel = pixel;
+            surface.triangle = index;
+            surface.position = weights.x * triangle.world[0] + weights.y * triangle.world[1] + weights.z * triangle.world[2];
+            surface.normal = weights.x * triangle.normal[0] + weights.y * triangle.normal[1] + weights.z * triangle.normal[2];
+            surfaces.push_back(surface);
+        }
+    }
+
+    if (lighting.rayTraced) {
+        traceShadows(surfaces, lighting);
+    } else {
+        for (Surface& surface : surfaces) {
+            surface.shadow = shadow(surface.position, surface.normal, lighting);
+        }
+    }
+
+    const glm::vec3 clearColor(0.82f, 0.93f, 0.99f);
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            setColor(y * _color.width + x, clearColor);
+        }
+    }
+    for (const Surface& surface : surfaces) {
+        // main() of basic.frag without the spot lights
+        glm::vec3 ambient = glm::vec3(0.82f, 0.93f, 0.99f) * 0.15f;
+        glm::vec3 lightVector = glm::normalize(lighting.lightPos - surface.position);
+        glm::vec3 diffuse = glm::vec3(0.2f, 0.5f, 0.8f) * std::max(glm::dot(lightVector, surface.normal), 0.0f);
+        glm::vec3 viewDir = glm::normalize(lighting.eyePos - surface.position);
+        glm::vec3 halfwayDir = glm::normalize(lightVector + viewDir);
+        glm::vec3 specular = glm::vec3(std::pow(std::max(glm::dot(surface.normal, halfwayDir), 0.0f), 64.0f));
+        setColor(surface.pixel, ambient + (1.0f - surface.shadow) * diffuse + (1.0f - surface.shadow) * specular);
+        _shadowTerms[surface.pixel] = surface.shadow;
+    }
+}
+
+void CpuRenderer::traceShadows(std::vector<Surface>& surfaces, const Lighting& lighting) const {
+    for (int first = 0; first < (int)surfaces.size(); first += TriangleBvh::PACKET_SIZE) {
+        int count = std::min((int)surfaces.size() - first, TriangleBvh::PACKET_SIZE);
+        TriangleBvh::RayPacket packet;
+        for (int i = 0; i < count; i++) {
+            const Surface& surface = surfaces[first + i];
+            // start just off the face on the light's side so the ray can't hit its own triangle
+            const Triangle& triangle = _triangles[surface.triangle];
+            glm::vec3 face = glm::normalize(glm::cross(triangle.world[1] - triangle.world[0], triangle.world[2] - triangle.world[0]));
+            if (glm::dot(face, lighting.lightPos - surface.position) < 0.0f) {
+                face = -face;
+            }
+            glm::vec3 origin = surface.position + face * RAY_OFFSET;
+            glm::vec3 direction = lighting.lightPos - origin;
+            packet.originX[i] = origin.x;
+            packet.originY[i] = origin.y;
+            packet.originZ[i] = origin.z;
+            packet.directionX[i] = direction.x;
+            packet.directionY[i] = direction.y;
+            packet.directionZ[i] = direction.z;
+            // the light is at t = 1
+            packet.maxT[i] = 1.0f;
+        }
+        // unused lanes get harmless copies of the first ray
+        for (int i = count; i < TriangleBvh::PACKET_SIZE; i++) {
+            packet.originX[i] = packet.originX[0];
+            packet.originY[i] = packet.originY[0];
+            packet.originZ[i] = packet.originZ[0];
+            packet.directionX[i] = packet.directionX[0];
+            packet.directionY[i] = packet.directionY[0];
+            packet.directionZ[i] = packet.directionZ[0];
+            packet.maxT[i] = packet.maxT[0];
+        }
+        unsigned int hits = _bvh.occluded(packet, count);
+        for (int i = 0; i < count; i++) {
+            surfaces[first + i].shadow = (hits >> i) & 1 ? 1.0f : 0.0f;
+        }
+    }
+}
+
+void CpuRenderer::setColor(int pixel, glm::vec3 color) {
+    color = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+    for (int c = 0; c < 3; c++) {
+        _color.color[3 * pixel + c] = (uint8_t)color[c];
+    }
+}
+
+void CpuRenderer::renderTarget(Target& target, bool depthClamp, ThreadPool* pool, const std::function<void(int)>& afterTile) {
+    auto tile = [&](int i) {
+        rasterizeTile(target, i, depthClamp);
+        if (afterTile) {
+            afterTile(i);
+        }
+    };
+    if (pool) {
+        pool->parallelFor(_tilesX * _tilesY, tile);
+    } else {
+        for (int i = 0; i < _tilesX * _tilesY; i++) {
+            tile(i);
+        }
+    }
+}
+
+void CpuRenderer::render(const std::vector<SceneObject>& objects, const glm::mat4& viewProjection, const Lighting& lighting, ThreadPool* pool) {
+    if (lighting.rayTraced) {
+        // the hierarchy is only rebuilt when a caster moved
+        std::vector<glm::mat4> casterMatrices;
+        for (const SceneObject& object : objects) {
+            if (object.castsShadow) {
+                casterMatrices.push_back(object.modelMatrix());
+            }
+        }
+        if (!_bvhValid || casterMatrices != _bvhCasterMatrices) {
+            _bvh.build(objects);
+            _bvhCasterMatrices = casterMatrices;
+            _bvhValid = true;
+        }
+    } else {
+        // shadow pass: casters only, depth clamped like the GL pass
+        setup(objects, lighting.lightSpaceMatrix, _shadow, true, true);
+        renderTarget(_shadow, true, pool, nullptr);
+    }
+
+    // lit pass, each tile is shaded as soon as its visibility is known
+    setup(objects, viewProjection, _color, false, false);
+    renderTarget(_color, false, pool, [&](int i) { shadeTile(i, lighting); });
+}
+
+bool CpuRenderer::writePPM(const char* path) const {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", _color.width, _color.height);
+    // GL's origin is the bottom left
+    for (int y = _color.height - 1; y >= 0; y--) {
+        fwrite(&_color.color[3 * y * _color.width], 3, _color.width, file);
+    }
+    fclose(file);
+    return true;
+}
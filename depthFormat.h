@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// Explicitly sized depth formats, so precision and memory aren't left to the driver.
+enum DepthFormat {
+    DEPTH_16,
+    DEPTH_24,
+    DEPTH_32F,
+    NUM_DEPTH_FORMATS
+};
+const char* depthFormatNames[NUM_DEPTH_FORMATS] = { "16", "24", "32f" };
+
+GLenum depthInternalFormat(DepthFormat format) {
+    switch (format) {
+    case DEPTH_16: return GL_DEPTH_COMPONENT16;
+    case DEPTH_24: return GL_DEPTH_COMPONENT24;
+    default:       return GL_DEPTH_COMPONENT32F;
+    }
+}
+
+// fixed point bits, 0 for the float format
+int depthFormatBits(DepthFormat format) {
+    switch (format) {
+    case DEPTH_16: return 16;
+    case DEPTH_24: return 24;
+    default:       return 0;
+    }
+}
+
+// 16 bit depth has no packed depth-stencil counterpart
+bool depthFormatHasStencil(DepthFormat format) {
+    return format != DEPTH_16;
+}
+
+// (re)allocates a 2D depth texture's storage in the given format, with an 8 bit stencil packed
+// next to the depth when asked for and the format has one
+void allocateDepthTexture(GLuint texture, DepthFormat format, unsigned int width, unsigned int height, bool stencil = false) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (stencil && depthFormatHasStencil(format)) {
+        bool isFloat = format == DEPTH_32F;
+        glTexImage2D(GL_TEXTURE_2D, 0, isFloat ? GL_DEPTH32F_STENCIL8 : GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL,
+                     isFloat ? GL_FLOAT_32_UNSIGNED_INT_24_8_REV : GL_UNSIGNED_INT_24_8, NULL);
+        return;
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, depthInternalFormat(format), width, height, 0, GL_DEPTH_COMPONENT,
+                 format == DEPTH_32F ? GL_FLOAT : GL_UNSIGNED_INT, NULL);
+}
+
+// Reversed-Z maps the near plane to 1 and the far plane to 0 in a [0, 1] clip range. With a float
+// depth buffer the precision of the float exponent then offsets the precision lost to the
+// projection, so depth stays accurate across the whole range. Needs glClipControl (GL 4.5).
+bool reversedZSupported() {
+    return GLAD_GL_VERSION_4_5;
+}
+
+// clip range, depth test and clear value for rendering with or without reversed-Z
+void setDepthConvention(bool reversed) {
+    if (!reversedZSupported()) {
+        return;
+    }
+    glClipControl(GL_LOWER_LEFT, reversed ? GL_ZERO_TO_ONE : GL_NEGATIVE_ONE_TO_ONE);
+    glDepthFunc(reversed ? GL_GREATER : GL_LESS);
+    glClearDepth(reversed ? 0.0 : 1.0);
+}
+
+// swapping near and far in a [0, 1] projection gives the reversed mapping
+glm::mat4 perspectiveProjection(float fovY, float aspect, float zNear, float zFar, bool reversed) {
+    return reversed ? glm::perspectiveRH_ZO(fovY, aspect, zFar, zNear) : glm::perspective(fovY, aspect, zNear, zFar);
+}
+
+glm::mat4 orthoProjection(float left, float right, float bottom, float top, float zNear, float zFar, bool reversed) {
+    return reversed ? glm::orthoRH_ZO(left, right, bottom, top, zFar, zNear) : glm::ortho(left, right, bottom, top, zNear, zFar);
+}
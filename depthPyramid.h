@@ -0,0 +1,101 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+
+#include "shader.h"
+
+// Min/max hierarchical depth pyramid of a depth texture. Level 0 is half the resolution of
+// the source and every texel stores (min, max) of the source depths it covers, so a shader
+// can bound the depth under a large footprint with a handful of fetches instead of a dense kernel.
+class DepthPyramid {
+public:
+    DepthPyramid(unsigned int sourceWidth, unsigned int sourceHeight);
+
+    // rebuilds every level from the given depth texture; leaves the default framebuffer bound
+    void build(GLuint depthTexture);
+    GLuint texture() const { return _texture; }
+    int levels() const { return _levels; }
+    void deleteGLResources();
+
+private:
+    unsigned int _width;
+    unsigned int _height;
+    int _levels;
+
+    GLuint _texture;
+    GLuint _fbo;
+    GLuint _emptyVAO;
+    Shader* _reduceShader;
+};
+
+DepthPyramid::DepthPyramid(unsigned int sourceWidth, unsigned int sourceHeight) {
+    _width = std::max(sourceWidth / 2, 1u);
+    _height = std::max(sourceHeight / 2, 1u);
+    _levels = 1;
+    while ((std::max(_width, _height) >> _levels) > 0) {
+        _levels++;
+    }
+
+    glGenTextures(1, &_texture);
+    glBindTexture(GL_TEXTURE_2D, _texture);
+    for (int level = 0; level < _levels; level++) {
+        unsigned int w = std::max(_width >> level, 1u);
+        unsigned int h = std::max(_height >> level, 1u);
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RG32F, w, h, 0, GL_RG, GL_FLOAT, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, _levels - 1);
+
+    glGenFramebuffers(1, &_fbo);
+    // core profile refuses to draw without a VAO bound, even for attribute-less draws
+    glGenVertexArrays(1, &_emptyVAO);
+
+    _reduceShader = new Shader("shaders/fullscreen.vert", "shaders/minMaxReduce.frag");
+}
+
+void DepthPyramid::build(GLuint depthTexture) {
+    _reduceShader->use();
+    _reduceShader->setInt("source", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(_emptyVAO);
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glDisable(GL_DEPTH_TEST);
+
+    for (int level = 0; level < _levels; level++) {
+        if (level == 0) {
+            glBindTexture(GL_TEXTURE_2D, depthTexture);
+            _reduceShader->setBool("sourceIsDepth", true);
+        } else {
+            // restrict the readable range to the previous level so reading and writing
+            // the same texture is not a feedback loop
+            glBindTexture(GL_TEXTURE_2D, _texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+            _reduceShader->setBool("sourceIsDepth", false);
+        }
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _texture, level);
+        glViewport(0, 0, std::max(_width >> level, 1u), std::max(_height >> level, 1u));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, _texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, _levels - 1);
+
+    glEnable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindVertexArray(0);
+}
+
+void DepthPyramid::deleteGLResources() {
+    glDeleteTextures(1, &_texture);
+    glDeleteFramebuffers(1, &_fbo);
+    glDeleteVertexArrays(1, &_emptyVAO);
+    delete _reduceShader;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "shader.h"
+
+// What the visible samples of a depth buffer cover.
+struct DepthBounds {
+    // view-space distance along the view direction
+    float minDepth;
+    float maxDepth;
+    // light view space
+    glm::vec3 lightMin;
+    glm::vec3 lightMax;
+    // light view the light-space bounds were computed in
+    glm::mat4 lightView;
+};
+
+// Compute-shader reduction of a view depth buffer into DepthBounds. Results travel back through
+// a ring of buffers guarded by fences and are picked up once the GPU is done with them, usually
+// one frame later, so the reduction never stalls the pipeline.
+class DepthReduction {
+public:
+    DepthReduction();
+
+    bool supported() const { return _supported; }
+    // queues a reduction of the depth buffer rendered with the given projection and view
+    void reduce(GLuint viewDepth, const glm::mat4& projection, const glm::mat4& view, const glm::mat4& lightView, bool reversedZ);
+    // newest finished result, false until the first one arrived
+    bool latest(DepthBounds& bounds) const;
+    void deleteGLResources();
+
+private:
+    static const int NUM_BUFFERS = 3;
+
+    void collect();
+
+    bool _supported;
+    GLuint _buffers[NUM_BUFFERS];
+    GLsync _fences[NUM_BUFFERS] = { 0, 0, 0 };
+    glm::mat4 _lightViews[NUM_BUFFERS];
+    int _next = 0;
+    bool _hasResult = false;
+    DepthBounds _result;
+    Shader* _shader = nullptr;
+};
+
+DepthReduction::DepthReduction() {
+    _supported = GLAD_GL_VERSION_4_3;
+    glGenBuffers(NUM_BUFFERS, _buffers);
+    if (!_supported) {
+        std::cout << "Depth reduction needs OpenGL 4.3 compute shaders, disabled" << std::endl;
+        return;
+    }
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, _buffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 8 * sizeof(uint32_t), NULL, GL_DYNAMIC_READ);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    _shader = new Shader("shaders/depthReduce.comp");
+}
+
+// inverse of orderedBits() in depthReduce.comp
+static float orderedFloat(uint32_t u) {
+    u = (u & 0x80000000u) ? u & 0x7fffffffu : ~u;
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+void DepthReduction::collect() {
+    // oldest first, so the newest finished result wins
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        int slot = (_next + i) % NUM_BUFFERS;
+        if (_fences[slot] == 0 || glClientWaitSync(_fences[slot], 0, 0) == GL_TIMEOUT_EXPIRED) {
+            continue;
+        }
+        uint32_t bits[8];
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, _buffers[slot]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(bits), bits);
+        glDeleteSync(_fences[slot]);
+        _fences[slot] = 0;
+
+        // untouched buffers mean nothing but background was visible
+        if (bits[0] == 0xffffffffu) {
+            continue;
+        }
+        _result.minDepth = orderedFloat(bits[0]);
+        _result.maxDepth = orderedFloat(bits[1]);
+        _result.lightMin = glm::vec3(orderedFloat(bits[2]), orderedFloat(bits[3]), orderedFloat(bits[4]));
+        _result.lightMax = glm::vec3(orderedFloat(bits[5]), orderedFloat(bits[6]), orderedFloat(bits[7]));
+        _result.lightView = _lightViews[slot];
+        _hasResult = true;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void DepthReduction::reduce(GLuint viewDepth, const glm::mat4& projection, const glm::mat4& view, const glm::mat4& lightView, bool reversedZ) {
+    if (!_supported) {
+        return;
+    }
+    collect();
+    // every buffer still in flight, drop this reduction rather than wait
+    if (_fences[_next] != 0) {
+        return;
+    }
+
+    // min slots start at the largest encoding, max slots at the smallest
+    uint32_t reset[8] = { 0xffffffffu, 0u, 0xffffffffu, 0xffffffffu, 0xffffffffu, 0u, 0u, 0u };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _buffers[_next]);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(reset), reset);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _buffers[_next]);
+
+    _shader->use();
+    _shader->setMat4("inverseProjection", glm::inverse(projection));
+    _shader->setMat4("viewToLight", lightView * glm::inverse(view));
+    _shader->setBool("reversedZ", reversedZ);
+    _shader->setInt("viewDepth", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, viewDepth);
+    GLint width, height;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    glDispatchCompute((width + 15) / 16, (height + 15) / 16, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    _fences[_next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _lightViews[_next] = lightView;
+    _next = (_next + 1) % NUM_BUFFERS;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+bool DepthReduction::latest(DepthBounds& bounds) const {
+    if (_hasResult) {
+        bounds = _result;
+    }
+    return _hasResult;
+}
+
+void DepthReduction::deleteGLResources() {
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        if (_fences[i] != 0) {
+            glDeleteSync(_fences[i]);
+        }
+    }
+    glDeleteBuffers(NUM_BUFFERS, _buffers);
+    delete _shader;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "scene.h"
+#include "bvh.h"
+#include "threadPool.h"
+
+// One signed distance field over every static caster, sampled on a regular grid and stored as
+// a 3D texture. The distance field shadow tier marches it from the receiver toward the light and
+// keeps the narrowest opening it passed through, which gives soft shadows whose cost depends on
+// the march length and not on how many triangles the casters have. Distances are negative inside
+// closed meshes. The grid is built on the CPU, one z slice per thread pool task, with every
+// voxel asking a BVH of the casters for its nearest triangle and taking the sign from its side.
+// Where meshes interpenetrate, a point inside one but nearest to another's face comes out positive.
+class DistanceField {
+public:
+    // voxels along the longest side of the scene bounds
+    DistanceField(int resolution);
+
+    void build(const std::vector<SceneObject>& objects, ThreadPool* pool);
+    // creates or refreshes the R16F 3D texture
+    void upload();
+    GLuint texture() const { return _texture; }
+    // world-space box the texture spans
+    const Bounds& bounds() const { return _bounds; }
+    float voxelSize() const { return _voxelSize; }
+    float buildMilliseconds() const { return _buildMilliseconds; }
+    void deleteGLResources();
+
+private:
+    int _resolution;
+    glm::ivec3 _size{0};
+    Bounds _bounds;
+    float _voxelSize = 1.0f;
+    std::vector<float> _distances;
+    float _buildMilliseconds = 0.0f;
+    GLuint _texture = 0;
+};
+
+DistanceField::DistanceField(int resolution) : _resolution(resolution) {
+    _bounds.min = glm::vec3(0.0f);
+    _bounds.max = glm::vec3(0.0f);
+}
+
+void DistanceField::build(const std::vector<SceneObject>& objects, ThreadPool* pool) {
+    auto start = std::chrono::steady_clock::now();
+
+    bool any = false;
+    Bounds bounds;
+    for (const SceneObject& object : objects) {
+        if (!object.isStatic || !object.castsShadow) {
+            continue;
+        }
+        Bounds objectBounds = object.worldBounds();
+        bounds.min = any ? glm::min(bounds.min, objectBounds.min) : objectBounds.min;
+        bounds.max = any ? glm::max(bounds.max, objectBounds.max) : objectBounds.max;
+        any = true;
+    }
+    if (!any) {
+        _size = glm::ivec3(0);
+        _distances.clear();
+        return;
+    }
+    TriangleBvh bvh;
+    bvh.build(objects, true);
+
+    // cubic voxels over the casters plus a margin, so the field has room to grow away from them
+    glm::vec3 extent = bounds.max - bounds.min;
+    _voxelSize = std::max(extent.x, std::max(extent.y, extent.z)) / (_resolution - 4);
+    _size = glm::ivec3(glm::ceil(extent / _voxelSize)) + 4;
+    _bounds.min = (bounds.min + bounds.max) * 0.5f - glm::vec3(_size) * (0.5f * _voxelSize);
+    _bounds.max = _bounds.min + glm::vec3(_size) * _voxelSize;
+    _distances.assign(_size.x * _size.y * _size.z, 0.0f);
+
+    auto buildSlice = [&](int z) {
+        for (int y = 0; y < _size.y; y++) {
+            // the distance changes by at most a voxel from one voxel to the next, so the previous
+            // one bounds the search
+            float previous = std::numeric_limits<float>::max();
+            for (int x = 0; x < _size.x; x++) {
+                glm::vec3 p = _bounds.min + (glm::vec3(x, y, z) + 0.5f) * _voxelSize;
+                float bound = previous == std::numeric_limits<float>::max() ? previous : previous + 1.01f * _voxelSize;
+                bool behind;
+                float nearest = bvh.nearest(p, bound, behind);
+                previous = nearest;
+                _distances[(z * _size.y + y) * _size.x + x] = behind ? -nearest : nearest;
+            }
+        }
+    };
+    if (pool) {
+        pool->parallelFor(_size.z, buildSlice);
+    } else {
+        for (int z = 0; z < _size.z; z++) {
+            buildSlice(z);
+        }
+    }
+    _buildMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void DistanceField::upload() {
+    if (_distances.empty()) {
+        return;
+    }
+    if (_texture == 0) {
+        glGenTextures(1, &_texture);
+    }
+    glBindTexture(GL_TEXTURE_3D, _texture);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R16F, _size.x, _size.y, _size.z, 0, GL_RED, GL_FLOAT, _distances.data());
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+void DistanceField::deleteGLResources() {
+    glDeleteTextures(1, &_texture);
+    _texture = 0;
+}
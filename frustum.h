@@ -0,0 +1,79 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <limits>
+
+// Axis aligned bounding box.
+struct Bounds {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+    bool empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+    void extend(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+    void extend(const Bounds& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+    Bounds intersection(const Bounds& b) const {
+        Bounds result;
+        result.min = glm::max(min, b.min);
+        result.max = glm::min(max, b.max);
+        return result;
+    }
+    // box enclosing this box after a transform
+    Bounds transformed(const glm::mat4& m) const {
+        Bounds result;
+        for (int i = 0; i < 8; i++) {
+            glm::vec4 p = m * glm::vec4((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z, 1.0f);
+            result.extend(glm::vec3(p) / p.w);
+        }
+        return result;
+    }
+};
+
+// View frustum as six inward facing planes plus its corner points.
+struct Frustum {
+    glm::vec4 planes[6];
+    glm::vec3 corners[8];
+
+    Frustum() {}
+    explicit Frustum(const glm::mat4& viewProjection) {
+        // planes from the rows of the matrix (Gribb & Hartmann)
+        glm::vec4 row[4];
+        for (int i = 0; i < 4; i++) {
+            row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        }
+        for (int i = 0; i < 3; i++) {
+            planes[2 * i] = row[3] + row[i];
+            planes[2 * i + 1] = row[3] - row[i];
+        }
+        for (int i = 0; i < 6; i++) {
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+        }
+
+        glm::mat4 inverse = glm::inverse(viewProjection);
+        for (int i = 0; i < 8; i++) {
+            glm::vec4 p = inverse * glm::vec4((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f, 1.0f);
+            corners[i] = glm::vec3(p) / p.w;
+        }
+    }
+
+    // conservative: may accept boxes that are just outside near the frustum's edges
+    bool intersects(const Bounds& b) const {
+        for (int i = 0; i < 6; i++) {
+            glm::vec3 n = glm::vec3(planes[i]);
+            glm::vec3 positive(n.x >= 0.0f ? b.max.x : b.min.x, n.y >= 0.0f ? b.max.y : b.min.y, n.z >= 0.0f ? b.max.z : b.min.z);
+            if (glm::dot(n, positive) + planes[i].w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Bounds bounds() const {
+        Bounds result;
+        for (int i = 0; i < 8; i++) {
+            result.extend(corners[i]);
+        }
+        return result;
+    }
+};
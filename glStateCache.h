@@ -0,0 +1,101 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <vector>
+
+#include "commandBuffer.h"
+
+// Replays command buffers on the GL thread, one after another in the order they're given. The
+// state cache in front skips vertex array binds and uniform uploads that wouldn't change
+// anything, which is most of them when many objects share a mesh. Everything outside the
+// buffers touches GL directly, so the cache starts over with every replay and trusts only
+// what it set itself.
+class GLStateCache {
+public:
+    void replay(const CommandBuffer& buffer);
+    // GL calls made and skipped since the last resetCounters()
+    int issuedCalls() const { return _issued; }
+    int skippedCalls() const { return _skipped; }
+    void resetCounters() {
+        _issued = 0;
+        _skipped = 0;
+    }
+
+private:
+    struct Uniform {
+        int floats = 0;
+        float value[16];
+    };
+
+    void reset();
+    void bindVertexArray(GLuint vao);
+    // true when the uniform already holds the value, otherwise remembers it
+    bool cached(GLint location, const float* value, int floats);
+
+    GLuint _vao = 0;
+    bool _vaoKnown = false;
+    // by uniform location, floats == 0 is unknown
+    std::vector<Uniform> _uniforms;
+    int _issued = 0;
+    int _skipped = 0;
+};
+
+void GLStateCache::reset() {
+    _vaoKnown = false;
+    for (Uniform& uniform : _uniforms) {
+        uniform.floats = 0;
+    }
+}
+
+void GLStateCache::bindVertexArray(GLuint vao) {
+    if (_vaoKnown && _vao == vao) {
+        _skipped++;
+        return;
+    }
+    glBindVertexArray(vao);
+    _vao = vao;
+    _vaoKnown = true;
+    _issued++;
+}
+
+bool GLStateCache::cached(GLint location, const float* value, int floats) {
+    if (location >= (GLint)_uniforms.size()) {
+        _uniforms.resize(location + 1);
+    }
+    Uniform& uniform = _uniforms[location];
+    if (uniform.floats == floats && std::memcmp(uniform.value, value, floats * sizeof(float)) == 0) {
+        _skipped++;
+        return true;
+    }
+    uniform.floats = floats;
+    std::memcpy(uniform.value, value, floats * sizeof(float));
+    _issued++;
+    return false;
+}
+
+void GLStateCache::replay(const CommandBuffer& buffer) {
+    reset();
+    for (const CommandBuffer::Command& command : buffer.commands()) {
+        switch (command.type) {
+        case CommandBuffer::SET_MAT4:
+            if (!cached(command.slot, buffer.values(command), 16))
+                glUniformMatrix4fv(command.slot, 1, GL_FALSE, buffer.values(command));
+            break;
+        case CommandBuffer::SET_MAT3:
+            if (!cached(command.slot, buffer.values(command), 9))
+                glUniformMatrix3fv(command.slot, 1, GL_FALSE, buffer.values(command));
+            break;
+        case CommandBuffer::SET_VEC4:
+            if (!cached(command.slot, buffer.values(command), 4))
+                glUniform4fv(command.slot, 1, buffer.values(command));
+            break;
+        case CommandBuffer::DRAW:
+            bindVertexArray((GLuint)command.slot);
+            glDrawArrays(GL_TRIANGLES, (GLint)command.first, (GLsizei)command.count);
+            _issued++;
+            break;
+        }
+    }
+}
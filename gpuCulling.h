@@ -0,0 +1,295 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "shader.h"
+#include "scene.h"
+#include "depthPyramid.h"
+
+// GPU-driven frustum and Hi-Z occlusion culling for the main view. Instances live in a storage
+// buffer and a compute shader writes one indirect draw per model, so the CPU only issues a draw
+// per model no matter how many instances there are. Phase one tests against the pyramid of the
+// previous frame's depth and draws the survivors; the pyramid is then rebuilt from that depth and
+// phase two draws the instances phase one wrongly rejected. The vertex shaders fetch their model
+// matrix through the visible list when the `instanced` uniform is set.
+class GpuCulling {
+public:
+    // the buffers start out with room for maxInstances and grow with the scene
+    GpuCulling(int maxInstances, unsigned int width, unsigned int height);
+
+    // compute shaders and storage buffers need GL 4.3, without them the scene is drawn object by object
+    bool supported() const { return _supported; }
+    // the instances are the objects by index, and objects are only ever appended. Uploads the ones
+    // added since the last call, or all of them after the buffers grew or were invalidated
+    void setInstances(const std::vector<SceneObject>& objects);
+    // the objects changed in place, the next setInstances() uploads all of them again
+    void invalidateInstances() { _instancesDirty = true; }
+    // re-uploads one instance after it moved
+    void updateInstance(int index);
+    // re-uploads the instances of the given TransformSystem indices, what its update() recomputed
+    void updateTransforms(const std::vector<int>& transforms);
+    // phase one: frustum test and occlusion test against last frame's pyramid
+    void cullVisible(const glm::mat4& viewProjection, bool reversedZ);
+    // rebuilds the pyramid from the depth phase one drew and re-tests what it rejected
+    void cullNewlyVisible(GLuint depthTexture);
+    // draws a phase's survivors with the shader in use, its view and projection already set
+    void draw(Shader* shader, int phase);
+    int instanceCount() const { return _instanceCount; }
+    void deleteGLResources();
+
+private:
+    struct Instance {
+        glm::mat4 model;
+        glm::vec4 normalMatrix[3];
+        glm::vec4 boundsMin;
+        glm::vec4 boundsMax;
+        glm::vec4 lightmapRect;
+        GLuint group;
+        GLuint padding[3];
+    };
+    struct DrawCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint first;
+        GLuint baseInstance;
+    };
+
+    Instance instance(int index) const;
+    // uploads the instances in [first, end)
+    void upload(int first, int end);
+    void dispatch(int phase);
+    // sizes the per-instance storage buffers
+    void allocate(int maxInstances);
+
+    bool _supported;
+    int _maxInstances;
+    // the scene's object list itself, which stays put while its elements move when it grows
+    const std::vector<SceneObject>* _objects = nullptr;
+    int _instanceCount = 0;
+    bool _instancesDirty = false;
+    std::vector<Model*> _groups;
+    std::vector<int> _groupSizes;
+    std::vector<int> _groupOf;
+    // instance by TransformSystem index, -1 for transforms without one
+    std::vector<int> _instanceOf;
+    // phase 0 then phase 1 commands with zero instances
+    std::vector<DrawCommand> _emptyCommands;
+    GLuint _stateBuffer;
+    GLuint _drawBuffer;
+    GLuint _instanceBuffer;
+    GLuint _visibleBuffer;
+    DepthPyramid* _pyramid;
+    bool _pyramidValid = false;
+    glm::mat4 _pyramidViewProjection{1.0f};
+    bool _pyramidReversedZ = false;
+    glm::mat4 _viewProjection{1.0f};
+    bool _reversedZ = false;
+    Shader* _cullShader = nullptr;
+};
+
+GpuCulling::GpuCulling(int maxInstances, unsigned int width, unsigned int height) : _maxInstances(maxInstances) {
+    _supported = GLAD_GL_VERSION_4_3;
+    glGenBuffers(1, &_stateBuffer);
+    glGenBuffers(1, &_drawBuffer);
+    glGenBuffers(1, &_instanceBuffer);
+    glGenBuffers(1, &_visibleBuffer);
+    _pyramid = new DepthPyramid(width, height);
+    if (!_supported) {
+        std::cout << "GPU culling needs OpenGL 4.3 compute shaders, disabled" << std::endl;
+        return;
+    }
+    allocate(maxInstances);
+    _cullShader = new Shader("shaders/gpuCulling.comp");
+}
+
+void GpuCulling::allocate(int maxInstances) {
+    _maxInstances = maxInstances;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _stateBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxInstances * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _instanceBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxInstances * sizeof(Instance), NULL, GL_DYNAMIC_DRAW);
+    // a visible list per phase, each model's range is as long as its instance count
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _visibleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * maxInstances * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+GpuCulling::Instance GpuCulling::instance(int index) const {
+    const SceneObject& object = (*_objects)[index];
+    Bounds bounds = object.worldBounds();
+    const glm::mat3& normalMatrix = object.normalMatrix();
+    return { object.modelMatrix(), { glm::vec4(normalMatrix[0], 0.0f), glm::vec4(normalMatrix[1], 0.0f), glm::vec4(normalMatrix[2], 0.0f) },
+             glm::vec4(bounds.min, 1.0f), glm::vec4(bounds.max, 1.0f), object.lightmapRect, (GLuint)_groupOf[index], { 0, 0, 0 } };
+}
+
+void GpuCulling::setInstances(const std::vector<SceneObject>& objects) {
+    if (!_supported) {
+        return;
+    }
+    int count = (int)objects.size();
+    if (count == _instanceCount && !_instancesDirty) {
+        return;
+    }
+    _objects = &objects;
+    int first = _instancesDirty ? 0 : _instanceCount;
+    _instancesDirty = false;
+    if (count > _maxInstances) {
+        // doubling keeps a streaming scene from reallocating every frame
+        int maxInstances = std::max(_maxInstances, 1);
+        while (maxInstances < count) {
+            maxInstances *= 2;
+        }
+        allocate(maxInstances);
+        std::cout << "GPU culling grew to " << maxInstances << " instances" << std::endl;
+        // the new buffers start out empty
+        first = 0;
+    }
+
+    // the new objects join their model's group, the groups of the others stay as they are
+    int groupCount = (int)_groups.size();
+    for (int i = _instanceCount; i < count; i++) {
+        int group = (int)(std::find(_groups.begin(), _groups.end(), objects[i].model) - _groups.begin());
+        if (group == (int)_groups.size()) {
+            _groups.push_back(objects[i].model);
+            _groupSizes.push_back(0);
+        }
+        _groupOf.push_back(group);
+        _groupSizes[group]++;
+        if (objects[i].transform >= (int)_instanceOf.size()) {
+            _instanceOf.resize(objects[i].transform + 1, -1);
+        }
+        _instanceOf[objects[i].transform] = i;
+    }
+    _instanceCount = count;
+
+    // one draw command per model, each model's range of the visible lists moves with the sizes before it
+    _emptyCommands.resize(2 * _groups.size());
+    GLuint firstInstance = 0;
+    for (int g = 0; g < (int)_groups.size(); g++) {
+        _emptyCommands[g] = { _groups[g]->vertexCount(), 0, 0, firstInstance };
+        _emptyCommands[_groups.size() + g] = { _groups[g]->vertexCount(), 0, 0, (GLuint)_maxInstances + firstInstance };
+        firstInstance += _groupSizes[g];
+    }
+    if ((int)_groups.size() != groupCount || first == 0) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _drawBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, _emptyCommands.size() * sizeof(DrawCommand), NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+    upload(first, count);
+}
+
+void GpuCulling::upload(int first, int end) {
+    if (first >= end) {
+        return;
+    }
+    std::vector<Instance> instances(end - first);
+    for (int i = first; i < end; i++) {
+        instances[i - first] = instance(i);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _instanceBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(Instance), instances.size() * sizeof(Instance), instances.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GpuCulling::updateInstance(int index) {
+    if (!_supported || index >= _instanceCount) {
+        return;
+    }
+    upload(index, index + 1);
+}
+
+void GpuCulling::updateTransforms(const std::vector<int>& transforms) {
+    if (!_supported) {
+        return;
+    }
+    std::vector<int> indices;
+    for (int transform : transforms) {
+        if (transform < (int)_instanceOf.size() && _instanceOf[transform] >= 0) {
+            indices.push_back(_instanceOf[transform]);
+        }
+    }
+    // neighbours go up together, a whole moving crowd is a handful of uploads instead of one each
+    std::sort(indices.begin(), indices.end());
+    for (int i = 0; i < (int)indices.size();) {
+        int end = i + 1;
+        while (end < (int)indices.size() && indices[end] == indices[end - 1] + 1) {
+            end++;
+        }
+        upload(indices[i], indices[end - 1] + 1);
+        i = end;
+    }
+}
+
+void GpuCulling::dispatch(int phase) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _stateBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _drawBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, _instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, _visibleBuffer);
+    _cullShader->use();
+    _cullShader->setInt("phase", phase);
+    _cullShader->setInt("instanceCount", _instanceCount);
+    _cullShader->setInt("groupCount", (int)_groups.size());
+    _cullShader->setMat4("viewProjection", _viewProjection);
+    _cullShader->setBool("reversedZ", _reversedZ);
+    _cullShader->setInt("depthPyramid", 0);
+    _cullShader->setBool("pyramidValid", _pyramidValid);
+    _cullShader->setMat4("pyramidViewProjection", _pyramidViewProjection);
+    _cullShader->setBool("pyramidReversedZ", _pyramidReversedZ);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _pyramid->texture());
+    glDispatchCompute((_instanceCount + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GpuCulling::cullVisible(const glm::mat4& viewProjection, bool reversedZ) {
+    if (_instanceCount == 0) {
+        return;
+    }
+    _viewProjection = viewProjection;
+    _reversedZ = reversedZ;
+    // both phases start from empty commands
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _drawBuffer);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, _emptyCommands.size() * sizeof(DrawCommand), _emptyCommands.data());
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    dispatch(0);
+}
+
+void GpuCulling::cullNewlyVisible(GLuint depthTexture) {
+    if (_instanceCount == 0) {
+        return;
+    }
+    // phase two's draws only add occluders, so this pyramid stays conservative for the next frame
+    _pyramid->build(depthTexture);
+    _pyramidValid = true;
+    _pyramidViewProjection = _viewProjection;
+    _pyramidReversedZ = _reversedZ;
+    dispatch(1);
+}
+
+void GpuCulling::draw(Shader* shader, int phase) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, _instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, _visibleBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _drawBuffer);
+    shader->setBool("instanced", true);
+    for (int g = 0; g < (int)_groups.size(); g++) {
+        _groups[g]->drawIndirect((phase * _groups.size() + g) * sizeof(DrawCommand));
+    }
+    shader->setBool("instanced", false);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void GpuCulling::deleteGLResources() {
+    glDeleteBuffers(1, &_stateBuffer);
+    glDeleteBuffers(1, &_drawBuffer);
+    glDeleteBuffers(1, &_instanceBuffer);
+    glDeleteBuffers(1, &_visibleBuffer);
+    _pyramid->deleteGLResources();
+    delete _pyramid;
+    delete _cullShader;
+}
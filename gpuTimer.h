@@ -0,0 +1,70 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Measures GPU time between begin() and end() with GL_TIME_ELAPSED queries.
+// Queries live in a small ring and are only read back once the driver reports
+// them available, so timing a pass never stalls the pipeline. Timers must not be nested.
+class GpuTimer {
+public:
+    GpuTimer();
+
+    void begin();
+    void end();
+    // smoothed GPU time of the pass in milliseconds
+    float milliseconds() const { return _averageMs; }
+    void deleteGLResources();
+
+private:
+    static const int NUM_QUERIES = 4;
+
+    void collect();
+
+    GLuint _queries[NUM_QUERIES];
+    bool _pending[NUM_QUERIES];
+    int _current = 0;
+    bool _hasSample = false;
+    float _averageMs = 0.0f;
+};
+
+GpuTimer::GpuTimer() {
+    glGenQueries(NUM_QUERIES, _queries);
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        _pending[i] = false;
+    }
+}
+
+void GpuTimer::begin() {
+    collect();
+    glBeginQuery(GL_TIME_ELAPSED, _queries[_current]);
+}
+
+void GpuTimer::end() {
+    glEndQuery(GL_TIME_ELAPSED);
+    _pending[_current] = true;
+    _current = (_current + 1) % NUM_QUERIES;
+}
+
+void GpuTimer::collect() {
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        if (!_pending[i]) {
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            continue;
+        }
+        GLuint64 elapsed;
+        glGetQueryObjectui64v(_queries[i], GL_QUERY_RESULT, &elapsed);
+        _pending[i] = false;
+
+        float ms = elapsed / 1.0e6f;
+        _averageMs = _hasSample ? 0.9f * _averageMs + 0.1f * ms : ms;
+        _hasSample = true;
+    }
+}
+
+void GpuTimer::deleteGLResources() {
+    glDeleteQueries(NUM_QUERIES, _queries);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// A shadowed spot light. Its shadow map lives in a tile of the shadow atlas.
+struct SpotLight {
+    glm::vec3 position;
+    glm::vec3 direction;
+    glm::vec3 color;
+    float range;
+    // half angles of the cone in degrees
+    float innerAngle;
+    float outerAngle;
+
+    glm::mat4 viewProjection() const {
+        glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        return glm::perspective(glm::radians(2.0f * outerAngle), 1.0f, 0.1f, range) *
+               glm::lookAt(position, position + direction, up);
+    }
+};
+
+// fraction of the screen height covered by a sphere seen from the camera, 0 when it is behind the camera
+float screenCoverage(const glm::vec3& center, float radius, const glm::vec3& eyePos, const glm::vec3& eyeFront, float fovY) {
+    glm::vec3 toCenter = center - eyePos;
+    if (glm::dot(toCenter, eyeFront) < -radius) {
+        return 0.0f;
+    }
+    float distance = glm::length(toCenter);
+    if (distance <= radius) {
+        return 1.0f;
+    }
+    return std::min(radius / (distance * std::tan(glm::radians(fovY) * 0.5f)), 1.0f);
+}
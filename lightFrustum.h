@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <vector>
+
+#include "frustum.h"
+
+// Orthographic light volume in light view space.
+struct LightFit {
+    float left, right, bottom, top;
+    float zNear, zFar;
+    bool valid;
+
+    glm::mat4 projection() const { return glm::ortho(left, right, bottom, top, zNear, zFar); }
+};
+
+// Grows the light-space rectangle [lo, hi] onto a stable texel grid and returns the texel size.
+// The extent is first rounded up to the next of a fixed ladder of sizes, eight per octave, so the
+// texel size only changes when the fit crosses a step instead of with every small change of the
+// fit; the origin is then snapped to that texel, and a moving camera slides the map by whole
+// texels. One texel of slack keeps the far side covered after the origin moved down.
+glm::vec2 snapToTexels(glm::vec2& lo, glm::vec2& hi, unsigned int resolution) {
+    const float STEPS_PER_OCTAVE = 8.0f;
+    glm::vec2 extent = (hi - lo) * ((float)resolution / (float)(resolution - 1));
+    extent.x = std::exp2(std::ceil(std::log2(extent.x) * STEPS_PER_OCTAVE) / STEPS_PER_OCTAVE);
+    extent.y = std::exp2(std::ceil(std::log2(extent.y) * STEPS_PER_OCTAVE) / STEPS_PER_OCTAVE);
+    glm::vec2 texel = extent / (float)resolution;
+    lo = glm::floor(lo / texel) * texel;
+    hi = lo + extent;
+    return texel;
+}
+
+// Fits the directional light's ortho box to what can actually be seen in shadow: XY is the overlap
+// of the casters and the visible receivers (clipped to the camera frustum) in light space, and the
+// depth range only spans the visible receivers. Casters in front of the near plane must be rendered
+// with GL_DEPTH_CLAMP so they are pancaked onto it instead of clipped. XY is snapped to a stable texel
+// grid to reduce shimmering while the camera moves.
+LightFit fitLightFrustum(const glm::mat4& lightView, const std::vector<Bounds>& casters, const std::vector<Bounds>& receivers,
+                         const Frustum& cameraFrustum, unsigned int resolution) {
+    LightFit fit = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, false };
+
+    Bounds visibleRegion = cameraFrustum.bounds().transformed(lightView);
+    Bounds receiverBox;
+    for (const Bounds& receiver : receivers) {
+        if (!cameraFrustum.intersects(receiver)) {
+            continue;
+        }
+        Bounds clipped = receiver.transformed(lightView).intersection(visibleRegion);
+        if (!clipped.empty()) {
+            receiverBox.extend(clipped);
+        }
+    }
+    Bounds casterBox;
+    for (const Bounds& caster : casters) {
+        casterBox.extend(caster.transformed(lightView));
+    }
+    if (receiverBox.empty() || casterBox.empty()) {
+        return fit;
+    }
+
+    // only where casters and visible receivers overlap can a shadow be seen
+    glm::vec2 lo = glm::max(glm::vec2(receiverBox.min), glm::vec2(casterBox.min));
+    glm::vec2 hi = glm::min(glm::vec2(receiverBox.max), glm::vec2(casterBox.max));
+    if (lo.x >= hi.x || lo.y >= hi.y) {
+        return fit;
+    }
+    snapToTexels(lo, hi, resolution);
+
+    // the light looks down -z, pad the range a little so receivers on its ends are not clipped
+    float zNear = -receiverBox.max.z;
+    float zFar = -receiverBox.min.z;
+    float padding = std::max(0.01f * (zFar - zNear), 0.01f);
+
+    fit.left = lo.x;
+    fit.right = hi.x;
+    fit.bottom = lo.y;
+    fit.top = hi.y;
+    fit.zNear = zNear - padding;
+    fit.zFar = zFar + padding;
+    fit.valid = true;
+    return fit;
+}
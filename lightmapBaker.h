@@ -0,0 +1,357 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "scene.h"
+#include "bvh.h"
+#include "threadPool.h"
+
+// Bakes the main light's shadows on static receivers into one atlas texture. Every static
+// receiver gets a square of the atlas sized by its world-space triangles and addresses it through
+// its model's lightmap texcoords and SceneObject::lightmapRect. Each texel traces rays from its
+// surface point to points on the light's disk through a BVH of the static casters, so the baked
+// shadows are soft where the light's size makes them soft. Static casters then only need to go
+// into the shadow maps while something dynamic receives shadows.
+class LightmapBaker {
+public:
+    LightmapBaker(int atlasSize, float texelsPerUnit, int samples);
+
+    // places every static receiver in the atlas and writes its rect into the object, scene names
+    // where the objects came from so a lightmap saved for another scene is never loaded
+    void layout(std::vector<SceneObject>& objects, const std::string& scene);
+    // the main light's shadow on every covered texel, spread over the worker threads
+    void bake(const std::vector<SceneObject>& objects, const glm::vec3& lightPos, float lightSize, ThreadPool* pool);
+    // whether the atlas holds shadows baked for this light
+    bool matches(const glm::vec3& lightPos, float lightSize) const;
+    // binary PGM with the light it was baked for and a hash of the layout in a comment
+    bool write(const char* path) const;
+    // fails unless the file was written for the current layout
+    bool read(const char* path);
+    // creates or refreshes the R8 texture
+    void upload();
+    GLuint texture() const { return _texture; }
+    float bakeMilliseconds() const { return _bakeMilliseconds; }
+    void deleteGLResources();
+
+private:
+    static const int MIN_CELL_TEXELS = 16;
+    // texels further than this from every triangle stay empty
+    static constexpr float GUTTER_TEXELS = 1.5f;
+    static constexpr float RAY_OFFSET = 1e-3f;
+
+    // surface point a covered texel bakes
+    struct Sample {
+        float distance = 1e30f;   // texels from the triangle it lies on, 0 inside
+        glm::vec3 position;
+        glm::vec3 normal;         // face normal
+    };
+
+    void rasterize(const SceneObject& object, std::vector<Sample>& samples) const;
+    // FNV-1a
+    static uint64_t hash(uint64_t seed, const void* data, size_t size);
+
+    int _atlasSize;
+    float _texelsPerUnit;
+    int _samples;
+    std::vector<uint8_t> _texels;
+    bool _baked = false;
+    glm::vec3 _lightPos{0.0f};
+    float _lightSize = 0.0f;
+    // of the scene name and every object's rect
+    uint64_t _layoutHash = 0;
+    float _bakeMilliseconds = 0.0f;
+    GLuint _texture = 0;
+};
+
+LightmapBaker::LightmapBaker(int atlasSize, float texelsPerUnit, int samples)
+    : _atlasSize(atlasSize), _texelsPerUnit(texelsPerUnit), _samples(samples) {
+    _texels.assign(atlasSize * atlasSize, 0);
+}
+
+uint64_t LightmapBaker::hash(uint64_t seed, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        seed = (seed ^ bytes[i]) * 1099511628211ull;
+    }
+    return seed;
+}
+
+void LightmapBaker::layout(std::vector<SceneObject>& objects, const std::string& scene) {
+    // square side in texels of every baked object
+    std::vector<int> sides(objects.size(), 0);
+    std::vector<int> order;
+    for (int i = 0; i < (int)objects.size(); i++) {
+        objects[i].lightmapRect = glm::vec4(0.0f);
+        if (!objects[i].isStatic || !objects[i].receivesShadow) {
+            continue;
+        }
+        glm::mat4 model = objects[i].modelMatrix();
+        const std::vector<glm::vec3>& vertices = objects[i].model->vertices();
+        float longestEdge = 0.0f;
+        for (int v = 0; v + 2 < (int)vertices.size(); v += 3) {
+            glm::vec3 p0 = glm::vec3(model * glm::vec4(vertices[v], 1.0f));
+            glm::vec3 p1 = glm::vec3(model * glm::vec4(vertices[v + 1], 1.0f));
+            glm::vec3 p2 = glm::vec3(model * glm::vec4(vertices[v + 2], 1.0f));
+            longestEdge = std::max(longestEdge, std::max(glm::length(p1 - p0), std::max(glm::length(p2 - p1), glm::length(p0 - p2))));
+        }
+        // matches the cell grid of Model::generateLightmapTexcoords()
+        int grid = std::max((int)std::ceil(std::sqrt((float)(vertices.size() / 3))), 1);
+        sides[i] = grid * std::max((int)std::ceil(longestEdge * _texelsPerUnit), MIN_CELL_TEXELS);
+        order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return sides[a] > sides[b]; });
+
+    // shelf packing, halving the density until everything fits. Once every side is down to the
+    // smallest cell nothing shrinks any more, the objects that still don't fit stay unbaked
+    float scale = 1.0f;
+    while (true) {
+        std::vector<glm::ivec2> origins(objects.size());
+        int x = 0, y = 0, shelfHeight = 0;
+        int placed = 0;
+        for (int i : order) {
+            int side = std::max((int)(sides[i] * scale), MIN_CELL_TEXELS);
+            if (x + side > _atlasSize) {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            if (side > _atlasSize || y + side > _atlasSize) {
+                break;
+            }
+            origins[i] = glm::ivec2(x, y);
+            x += side;
+            shelfHeight = std::max(shelfHeight, side);
+            placed++;
+        }
+        // sorted largest first, so the first side is at the floor only when all of them are
+        bool atFloor = order.empty() || (int)(sides[order[0]] * scale) <= MIN_CELL_TEXELS;
+        if (placed == (int)order.size() || atFloor) {
+            for (int p = 0; p < placed; p++) {
+                int i = order[p];
+                float side = (float)std::max((int)(sides[i] * scale), MIN_CELL_TEXELS);
+                objects[i].lightmapRect = glm::vec4(side, side, origins[i].x, origins[i].y) / (float)_atlasSize;
+            }
+            if (placed < (int)order.size()) {
+                fprintf(stderr, "lightmap atlas full, %d of %d static receivers left unbaked\n",
+                        (int)order.size() - placed, (int)order.size());
+            }
+            break;
+        }
+        scale *= 0.5f;
+    }
+    _layoutHash = hash(14695981039346656037ull, scene.data(), scene.size());
+    for (const SceneObject& object : objects) {
+        float rect[4] = { object.lightmapRect.x, object.lightmapRect.y, object.lightmapRect.z, object.lightmapRect.w };
+        _layoutHash = hash(_layoutHash, rect, sizeof(rect));
+    }
+    _baked = false;
+}
+
+void LightmapBaker::rasterize(const SceneObject& object, std::vector<Sample>& samples) const {
+    glm::mat4 model = object.modelMatrix();
+    const std::vector<glm::vec3>& vertices = object.model->vertices();
+    const std::vector<glm::vec2>& texcoords = object.model->lightmapTexcoords();
+    glm::vec2 scale = glm::vec2(object.lightmapRect.x, object.lightmapRect.y) * (float)_atlasSize;
+    glm::vec2 offset = glm::vec2(object.lightmapRect.z, object.lightmapRect.w) * (float)_atlasSize;
+    for (int v = 0; v + 2 < (int)vertices.size(); v += 3) {
+        glm::vec3 world[3];
+        glm::vec2 uv[3];
+        for (int j = 0; j < 3; j++) {
+            world[j] = glm::vec3(model * glm::vec4(vertices[v + j], 1.0f));
+            uv[j] = offset + texcoords[v + j] * scale;
+        }
+        glm::vec3 normal = glm::cross(world[1] - world[0], world[2] - world[0]);
+        float area = (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[1].y - uv[0].y) * (uv[2].x - uv[0].x);
+        if (glm::length(normal) == 0.0f || area == 0.0f) {
+            continue;
+        }
+        normal = glm::normalize(normal);
+
+        glm::vec2 lo = glm::min(uv[0], glm::min(uv[1], uv[2])) - GUTTER_TEXELS;
+        glm::vec2 hi = glm::max(uv[0], glm::max(uv[1], uv[2])) + GUTTER_TEXELS;
+        int x0 = std::max((int)std::floor(lo.x), 0), x1 = std::min((int)std::ceil(hi.x), _atlasSize - 1);
+        int y0 = std::max((int)std::floor(lo.y), 0), y1 = std::min((int)std::ceil(hi.y), _atlasSize - 1);
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                glm::vec2 center(x + 0.5f, y + 0.5f);
+                float b1 = ((center.x - uv[0].x) * (uv[2].y - uv[0].y) - (center.y - uv[0].y) * (uv[2].x - uv[0].x)) / area;
+                float b2 = ((uv[1].x - uv[0].x) * (center.y - uv[0].y) - (uv[1].y - uv[0].y) * (center.x - uv[0].x)) / area;
+                glm::vec3 weights(1.0f - b1 - b2, b1, b2);
+                // texels in the gutter bake the nearest point of the triangle, so bilinear
+                // filtering at the edges reads the right shadow
+                weights = glm::max(weights, glm::vec3(0.0f));
+                weights /= weights.x + weights.y + weights.z;
+                glm::vec2 nearest = weights.x * uv[0] + weights.y * uv[1] + weights.z * uv[2];
+                float distance = glm::length(center - nearest);
+                Sample& sample = samples[y * _atlasSize + x];
+                if (distance > GUTTER_TEXELS || distance >= sample.distance) {
+                    continue;
+                }
+                sample.distance = distance;
+                sample.position = weights.x * world[0] + weights.y * world[1] + weights.z * world[2];
+                sample.normal = normal;
+            }
+        }
+    }
+}
+
+void LightmapBaker::bake(const std::vector<SceneObject>& objects, const glm::vec3& lightPos, float lightSize, ThreadPool* pool) {
+    auto start = std::chrono::steady_clock::now();
+
+    // only static casters, dynamic ones still go through the shadow map
+    std::vector<SceneObject> staticCasters;
+    for (const SceneObject& object : objects) {
+        if (object.isStatic && object.castsShadow) {
+            staticCasters.push_back(object);
+        }
+    }
+    TriangleBvh bvh;
+    bvh.build(staticCasters);
+
+    std::vector<Sample> samples(_atlasSize * _atlasSize);
+    for (const SceneObject& object : objects) {
+        if (object.lightmapRect.x > 0.0f) {
+            rasterize(object, samples);
+        }
+    }
+
+    // Vogel disk, rotated per texel so the sample pattern turns into noise instead of banding
+    std::vector<glm::vec2> disk(_samples);
+    for (int i = 0; i < _samples; i++) {
+        float radius = std::sqrt((i + 0.5f) / _samples);
+        float angle = i * 2.39996323f;
+        disk[i] = radius * glm::vec2(std::cos(angle), std::sin(angle));
+    }
+
+    auto bakeRow = [&](int y) {
+        for (int x = 0; x < _atlasSize; x++) {
+            const Sample& sample = samples[y * _atlasSize + x];
+            if (sample.distance > GUTTER_TEXELS) {
+                _texels[y * _atlasSize + x] = 0;
+                continue;
+            }
+            glm::vec3 toLight = lightPos - sample.position;
+            // start just off the face on the light's side
+            glm::vec3 origin = sample.position + (glm::dot(sample.normal, toLight) < 0.0f ? -sample.normal : sample.normal) * RAY_OFFSET;
+            // the light's disk faces the texel
+            glm::vec3 axis = glm::normalize(toLight);
+            glm::vec3 tangent = glm::normalize(glm::cross(axis, std::abs(axis.y) < 0.99f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0)));
+            glm::vec3 bitangent = glm::cross(axis, tangent);
+            unsigned int hash = (unsigned int)(x * 73856093) ^ (unsigned int)(y * 19349663);
+            hash = (hash ^ (hash >> 13)) * 0x5bd1e995u;
+            float rotation = (hash & 0xffff) / 65536.0f * glm::two_pi<float>();
+            float c = std::cos(rotation), s = std::sin(rotation);
+
+            int blocked = 0;
+            for (int first = 0; first < _samples; first += TriangleBvh::PACKET_SIZE) {
+                int count = std::min(_samples - first, TriangleBvh::PACKET_SIZE);
+                TriangleBvh::RayPacket packet;
+                for (int i = 0; i < TriangleBvh::PACKET_SIZE; i++) {
+                    glm::vec2 point = disk[first + std::min(i, count - 1)];
+                    point = glm::vec2(c * point.x - s * point.y, s * point.x + c * point.y) * (0.5f * lightSize);
+                    glm::vec3 direction = lightPos + tangent * point.x + bitangent * point.y - origin;
+                    packet.originX[i] = origin.x;
+                    packet.originY[i] = origin.y;
+                    packet.originZ[i] = origin.z;
+                    packet.directionX[i] = direction.x;
+                    packet.directionY[i] = direction.y;
+                    packet.directionZ[i] = direction.z;
+                    // the light sample is at t = 1
+                    packet.maxT[i] = 1.0f;
+                }
+                unsigned int hits = bvh.occluded(packet, count);
+                for (int i = 0; i < count; i++) {
+                    blocked += (hits >> i) & 1;
+                }
+            }
+            _texels[y * _atlasSize + x] = (uint8_t)std::lround(255.0f * blocked / _samples);
+        }
+    };
+    if (pool) {
+        pool->parallelFor(_atlasSize, bakeRow);
+    } else {
+        for (int y = 0; y < _atlasSize; y++) {
+            bakeRow(y);
+        }
+    }
+
+    _baked = true;
+    _lightPos = lightPos;
+    _lightSize = lightSize;
+    _bakeMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool LightmapBaker::matches(const glm::vec3& lightPos, float lightSize) const {
+    return _baked && lightPos == _lightPos && lightSize == _lightSize;
+}
+
+bool LightmapBaker::write(const char* path) const {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "P5\n# light %.9g %.9g %.9g %.9g layout %016llx\n%d %d\n255\n", _lightPos.x, _lightPos.y, _lightPos.z, _lightSize,
+            (unsigned long long)_layoutHash, _atlasSize, _atlasSize);
+    bool written = fwrite(_texels.data(), 1, _texels.size(), file) == _texels.size();
+    fclose(file);
+    return written;
+}
+
+bool LightmapBaker::read(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    glm::vec3 lightPos;
+    float lightSize;
+    unsigned long long layoutHash;
+    int width, height, maxValue;
+    // baked for another scene or layout, bake again instead
+    bool valid = fscanf(file, "P5 # light %f %f %f %f layout %llx %d %d %d", &lightPos.x, &lightPos.y, &lightPos.z, &lightSize,
+                        &layoutHash, &width, &height, &maxValue) == 8 &&
+                 layoutHash == _layoutHash && width == _atlasSize && height == _atlasSize && maxValue == 255 && fgetc(file) == '\n';
+    std::vector<uint8_t> texels(_atlasSize * _atlasSize);
+    valid = valid && fread(texels.data(), 1, texels.size(), file) == texels.size();
+    fclose(file);
+    if (!valid) {
+        return false;
+    }
+    _texels = texels;
+    _baked = true;
+    _lightPos = lightPos;
+    _lightSize = lightSize;
+    return true;
+}
+
+void LightmapBaker::upload() {
+    if (_texture == 0) {
+        glGenTextures(1, &_texture);
+        glBindTexture(GL_TEXTURE_2D, _texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, _atlasSize, _atlasSize, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, _texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _atlasSize, _atlasSize, GL_RED, GL_UNSIGNED_BYTE, _texels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void LightmapBaker::deleteGLResources() {
+    glDeleteTextures(1, &_texture);
+    _texture = 0;
+}
@@ -4,21 +4,62 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/constants.hpp>
 
 #include <iostream>
+#include <chrono>
 
 #include "utilities.h"
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "gpuTimer.h"
+#include "depthPyramid.h"
+#include "pointShadow.h"
+#include "scene.h"
+#include "light.h"
+#include "shadowAtlas.h"
+#include "shadowScheduler.h"
+#include "framebuffer.h"
+#include "virtualShadowMap.h"
+#include "lightFrustum.h"
+#include "cascadedShadowMap.h"
+#include "depthFormat.h"
+#include "receiverMask.h"
+#include "casterOcclusion.h"
+#include "shadowMask.h"
+#include "blueNoise.h"
+#include "gpuCulling.h"
+#include "occlusionQueries.h"
+#include "maskedOcclusion.h"
+#include "threadPool.h"
+#include "cpuRenderer.h"
+#include "lightmapBaker.h"
+#include "distanceField.h"
+#include "sceneFile.h"
+#include "commandBuffer.h"
+#include "glStateCache.h"
 
 GLFWwindow* initWindow();
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow *window);
 unsigned int loadTexture(const char *path);
 unsigned int loadCubemap(std::vector<std::string> faces);
+std::vector<Model*> applySceneHeader(const SceneHeader& scene);
+void addSceneObjects(const std::vector<SceneRecord>& records, const std::vector<Model*>& models, TransformSystem& transforms,
+                     std::vector<SceneObject>& sceneObjects);
+bool loadScene(std::vector<Model*>& models, TransformSystem& transforms, std::vector<SceneObject>& sceneObjects);
+void prepareStaticObjects(std::vector<SceneObject>& sceneObjects);
+LightFit fitMainLight(const std::vector<SceneObject>& sceneObjects, const glm::mat4& lightView, unsigned int shadowSize);
+int cpuRender(int argc, char** argv);
+int bakeLightmaps();
+int convertScene(int argc, char** argv);
+
+// meshes, objects, lights and shadow settings, chosen with --scene
+const char* scenePath = "scenes/default.scene";
 
 // settings
 const unsigned int SCR_WIDTH = 1200;
@@ -32,26 +73,176 @@ bool firstMouse = true;
 
 // Light
 glm::vec3 lightPos{-2, 4, 0};
+glm::vec3 lightTarget{0.0, 0.0, -2.0};
+// fixed ortho box of the main light, the fallback when fitting it finds nothing
+const float near_plane = 1.0f, far_plane = 100.0f;
+const float ortho_size = 10.0f;
 glm::vec3 lightDir{1.0, -1.0, -1.0};
+// world-space size of the area light, drives the PCSS penumbra width
+float lightSize = 0.4f;
+
+// shadow filtering tiers, selected with the number keys
+enum ShadowQuality {
+    SHADOW_HARD,
+    SHADOW_PCF,
+    SHADOW_PCSS,
+    // a few blue noise rotated taps per frame, accumulated over frames in the shadow mask
+    SHADOW_STOCHASTIC,
+    // soft shadows of the static casters marched through their distance field, PCF for the rest
+    SHADOW_DISTANCE_FIELD,
+    NUM_SHADOW_QUALITIES
+};
+const char* shadowQualityNames[NUM_SHADOW_QUALITIES] = { "hard", "pcf", "pcss", "stochastic", "distance field" };
+int shadowQuality = SHADOW_PCSS;
+
+// how the light's shadows are projected, selected with Z/X/C
+enum ShadowProjection {
+    SHADOW_PROJECTION_ORTHO,
+    SHADOW_PROJECTION_CUBE,
+    SHADOW_PROJECTION_DUAL_PARABOLOID
+};
+const char* shadowProjectionNames[] = { "ortho", "cube", "dual paraboloid" };
+int shadowProjection = SHADOW_PROJECTION_ORTHO;
+
+// precision of the main shadow map, cycled with T. R toggles reversed-Z for the shadow map and
+// the main view, which needs the float format
+DepthFormat shadowDepthFormat = DEPTH_32F;
+bool shadowDepthFormatChanged = false;
+bool reversedZ = false;
+
+// skip caster fragments in shadow map regions no visible receiver samples, toggled with N
+bool receiverMaskEnabled = true;
+ReceiverMask* receiverMask;
+
+// skip casters hidden behind other casters from the light, toggled with H
+bool casterOcclusionEnabled = true;
+CasterOcclusion* casterOcclusion;
+
+// main light shadow evaluated once per texel of a half (or quarter) resolution mask after a depth
+// prepass instead of per lit fragment. Q toggles it, E switches the resolution
+bool shadowMaskEnabled = false;
+int shadowMaskScale = 2;
+GpuTimer* shadowMaskTimer;
+// varies the stochastic tier's blue noise every frame
+unsigned int frameIndex = 0;
+
+// lay down the main view's depth first with the position-only program, so the lit pass runs with
+// GL_EQUAL and shades every visible pixel exactly once. Toggled with U, the shadow mask forces it
+bool depthPrepassEnabled = true;
+GpuTimer* depthPrepassTimer;
+
+// frustum and Hi-Z occlusion culling of the main view on the GPU with indirect draws, toggled with Y.
+// Runs inside the depth prepass, which it forces
+bool gpuCullingEnabled = true;
+GpuCulling* gpuCulling;
+// without compute shaders, hardware occlusion queries with temporal coherence cull the main view
+// instead, toggled with F1. Also runs inside the depth prepass
+bool occlusionQueriesEnabled = true;
+OcclusionQueries* occlusionQueries;
+// the designated occluders are rasterized on the CPU into a small masked depth buffer and every
+// object is tested against it before submission. F2 toggles it for objects drawn one by one,
+// F3 also tests the shadow casters from the light
+bool softwareOcclusionEnabled = true;
+bool softwareOcclusionLightView = false;
+MaskedOcclusion* cameraOcclusion;
+MaskedOcclusion* lightOcclusion;
+ThreadPool* threadPool;
+float softwareOcclusionMs = 0.0f;
+int softwareOccludedObjects = 0;
+// wall time of the frame's job graph
+float frameJobsMs = 0.0f;
+// replays the draws the jobs recorded
+GLStateCache* stateCache;
+
+// the main light's shadows on static receivers come from a baked lightmap while the light stays
+// where it was baked; F4 toggles them, F5 bakes again for the current light position
+LightmapBaker* lightmapBaker;
+bool lightmapsEnabled = true;
+bool lightmapBakeRequested = false;
+const char* LIGHTMAP_PATH = "lightmap.pgm";
+const int LIGHTMAP_SIZE = 2048;
+const float LIGHTMAP_TEXELS_PER_UNIT = 4.0f;
+const int LIGHTMAP_SAMPLES = 16;
+
+// signed distance field of the static casters for the distance field tier
+DistanceField* distanceField;
+const int DISTANCE_FIELD_RESOLUTION = 128;
+
+// fit the light's ortho box to the casters and visible receivers every frame, toggled with F
+bool autoFitLightFrustum = true;
+// receivers further away than this don't get shadows from the fitted map
+const float SHADOW_DISTANCE = 40.0f;
+
+// additional shadowed spot lights sharing the shadow atlas, toggled with M
+bool spotLightsEnabled = true;
 
 // timing
 float deltaTime = 0.0f;	// time between current frame and last frame
 float lastFrame = 0.0f;
 
+// gpu timings, the lit pass is timed separately for every shadow tier, without and with the depth prepass
+GpuTimer* shadowPassTimer;
+GpuTimer* pyramidTimer;
+GpuTimer* litPassTimers[NUM_SHADOW_QUALITIES][2];
+GpuTimer* atlasPassTimer;
+
+// spends a per-frame budget on the spot light shadow maps, B switches the budget unit
+const float SHADOW_CASTER_BUDGET = 12.0f;
+const float SHADOW_MICROSECOND_BUDGET = 250.0f;
+ShadowScheduler* shadowScheduler;
+
+// sparse 16k^2 shadow map for the main light, pages are marked from the view depth. Toggled with V
+const float VSM_EXTENT = 40.0f;
+bool virtualShadowsEnabled = true;
+VirtualShadowMap* virtualShadowMap;
+GpuTimer* virtualShadowTimer;
+
+// cascades split over the depth range of the visible samples (sample distribution shadow maps),
+// the range comes from a GPU reduction of the view depth read back a frame late. Toggled with G
+bool cascadesEnabled = true;
+DepthReduction* depthReduction;
+CascadedShadowMap* cascadedShadowMap;
+GpuTimer* cascadeTimer;
+GpuTimer* depthReductionTimer;
+
 // wireframe mode
 bool wireframe = false;
 
-int main()
+int main(int argc, char** argv)
 {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--scene")
+            scenePath = argv[i + 1];
+    }
+    // headless reference render, no window or GL context
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--convert-scene")
+            return convertScene(argc, argv);
+        if (std::string(argv[i]) == "--cpu-render")
+            return cpuRender(argc, argv);
+        if (std::string(argv[i]) == "--bake-lightmaps")
+            return bakeLightmaps();
+    }
+
     GLFWwindow* window = initWindow();
 
     glEnable(GL_DEPTH_TEST);
 
     Shader *basicShader = new Shader("shaders/basic.vert", "shaders/basic.frag");
     Shader *depthShader = new Shader("shaders/simpleDepth.vert", "shaders/simpleDepth.frag");
+    Shader *prepassShader = new Shader("shaders/depthPrepass.vert", "shaders/simpleDepth.frag");
 
-    Model *cube1 = new Model("cube.obj");
-    cube1->setupBuffers();
+    // meshes and settings come from the scene file's header, its objects stream in over the first frames
+    SceneLoader sceneLoader;
+    if (!sceneLoader.open(scenePath)) {
+        glfwTerminate();
+        return -1;
+    }
+    std::vector<Model*> sceneModels = applySceneHeader(sceneLoader.header());
+    for (Model* model : sceneModels)
+        model->setupBuffers();
+    Model *lightCubeModel = new Model("cube.obj");
+    lightCubeModel->setupBuffers();
     GLuint brickTexture = loadTexture("resources/brickwall.jpg");
 
     // set up buffers for the dubgging quad
@@ -93,11 +284,20 @@ int main()
     glBindVertexArray(0);
    
 
-    glm::mat4 modelMat = glm::mat4(1);
     glm::mat4 view;
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    auto trans = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.5, -2.0));
-    auto scale = glm::scale(glm::mat4(1.0f), glm::vec3(10, 0.5, 10));
+    const float fovY = glm::radians(camera.Zoom);
+    glm::mat4 projection = perspectiveProjection(fovY, (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f, reversedZ);
+
+    // scene objects, drawn by both the shadow and the lit pass. The light cube comes first so its
+    // index stays put while the scene file's objects are appended
+    TransformSystem sceneTransforms;
+    std::vector<SceneObject> sceneObjects = {
+        { lightCubeModel, &sceneTransforms, sceneTransforms.create(lightPos, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.3f)), false, false }
+    };
+    // the culling passes refer to objects by index, so a reallocation while streaming is only a
+    // copy; a binary scene's count is reserved once to skip even that, text scenes grow geometrically
+    sceneObjects.reserve(1 + std::min(sceneLoader.objectCount(), 1u << 24));
+    const int LIGHT_CUBE = 0;
 
 
     // Shadow Map stuff
@@ -108,8 +308,8 @@ int main()
     // create depth texture
     unsigned int depthMap;
     glGenTextures(1, &depthMap);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    // the receiver mask rejects casters with the stencil
+    allocateDepthTexture(depthMap, shadowDepthFormat, SHADOW_WIDTH, SHADOW_HEIGHT, true);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -118,12 +318,89 @@ int main()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
     float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
     glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);  
-    // attach depth texture as FBO's depth buffer
+    // attach depth texture as FBO's depth buffer, and as its stencil where the format packs one
+    auto attachShadowDepth = [&] {
+        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D,
+                               depthFormatHasStencil(shadowDepthFormat) ? depthMap : 0, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    };
+    attachShadowDepth();
     glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // cube / dual paraboloid shadows for treating lightPos as a point light
+    const unsigned int POINT_SHADOW_SIZE = 512;
+    const float POINT_SHADOW_FAR = 25.0f;
+    PointShadowMap* pointShadowMap = new PointShadowMap(POINT_SHADOW_SIZE);
+
+    // spot lights circling the scene, their shadow maps are tiles of one atlas
+    std::vector<SpotLight> spotLights = sceneLoader.header().spotLights;
+    float spotLightAngle = 0.0f;
+    ShadowAtlas* shadowAtlas = new ShadowAtlas(4096, 128, 1024);
+    glUniformBlockBinding(basicShader->ID, glGetUniformBlockIndex(basicShader->ID, "AtlasLights"), 0);
+    shadowScheduler = new ShadowScheduler(ShadowScheduler::BUDGET_CASTERS, SHADOW_CASTER_BUDGET);
+
+    // the main view renders offscreen so its depth can drive the virtual shadow map
+    RenderTarget* sceneTarget = new RenderTarget(SCR_WIDTH, SCR_HEIGHT);
+    ShadowMask* shadowMask = new ShadowMask(SCR_WIDTH, SCR_HEIGHT, shadowMaskScale);
+    GLuint maskAtlasBlock = glGetUniformBlockIndex(shadowMask->maskShader()->ID, "AtlasLights");
+    if (maskAtlasBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(shadowMask->maskShader()->ID, maskAtlasBlock, 0);
+    GLuint blueNoiseTexture = BlueNoise(64).createTexture();
+    glm::mat4 previousViewProjection = projection * camera.GetViewMatrix();
+    bool previousReversedZ = reversedZ;
+    virtualShadowMap = new VirtualShadowMap(4096, 64);
+    virtualShadowsEnabled = virtualShadowMap->supported();
+
+    depthReduction = new DepthReduction();
+    receiverMask = new ReceiverMask(SHADOW_WIDTH, 128);
+    receiverMaskEnabled = receiverMask->supported();
+    casterOcclusion = new CasterOcclusion(1024);
+    casterOcclusionEnabled = casterOcclusion->supported();
+    cascadedShadowMap = new CascadedShadowMap(SHADOW_WIDTH);
+    gpuCulling = new GpuCulling(1 << 17, SCR_WIDTH, SCR_HEIGHT);
+    gpuCullingEnabled = gpuCulling->supported();
+    occlusionQueries = new OcclusionQueries(4);
+    threadPool = new ThreadPool();
+    stateCache = new GLStateCache();
+    cameraOcclusion = new MaskedOcclusion(256, 128);
+    lightOcclusion = new MaskedOcclusion(256, 256);
+
+    // both are set up for the static objects once the whole scene has streamed in
+    lightmapBaker = new LightmapBaker(LIGHTMAP_SIZE, LIGHTMAP_TEXELS_PER_UNIT, LIGHTMAP_SAMPLES);
+    distanceField = new DistanceField(DISTANCE_FIELD_RESOLUTION);
+    bool sceneLoaded = false;
+    float sceneLoadStart = glfwGetTime();
+
+    // min/max pyramid of the shadow map for the PCSS blocker search and the caster occlusion test
+    DepthPyramid* depthPyramid = new DepthPyramid(SHADOW_WIDTH, SHADOW_HEIGHT);
+
+    shadowPassTimer = new GpuTimer();
+    pyramidTimer = new GpuTimer();
+    for (int i = 0; i < NUM_SHADOW_QUALITIES; i++) {
+        litPassTimers[i][0] = new GpuTimer();
+        litPassTimers[i][1] = new GpuTimer();
+    }
+    atlasPassTimer = new GpuTimer();
+    virtualShadowTimer = new GpuTimer();
+    cascadeTimer = new GpuTimer();
+    depthReductionTimer = new GpuTimer();
+    shadowMaskTimer = new GpuTimer();
+    depthPrepassTimer = new GpuTimer();
+
+    // every pass, cascade and spot light records into its own buffer, reused from frame to frame
+    CommandBuffer mainLightCommands, prepassCommands, litCommands;
+    CommandBuffer cascadeCommands[CascadedShadowMap::NUM_CASCADES];
+    std::vector<CommandBuffer> spotCommands;
+    int depthModelSlot = depthShader->uniformLocation("model");
+    int prepassModelSlot = prepassShader->uniformLocation("model");
+    int litModelSlot = basicShader->uniformLocation("model");
+    int litNormalMatrixSlot = basicShader->uniformLocation("normalMatrix");
+    int litLightmapRectSlot = basicShader->uniformLocation("lightmapRect");
    
     // render loop
     // -----------
@@ -133,6 +410,25 @@ int main()
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
         processInput(window);
+        shadowMask->setScale(shadowMaskScale);
+
+        if (!sceneLoaded) {
+            std::vector<SceneRecord> records;
+            sceneLoaded = sceneLoader.poll(records);
+            addSceneObjects(records, sceneModels, sceneTransforms, sceneObjects);
+            if (sceneLoaded) {
+                fprintf(stderr, "loaded %d objects from %s in %.1f ms\n", (int)sceneObjects.size() - 1, scenePath,
+                        1000.0f * (glfwGetTime() - sceneLoadStart));
+                prepareStaticObjects(sceneObjects);
+            }
+        }
+
+        if (shadowDepthFormatChanged) {
+            allocateDepthTexture(depthMap, shadowDepthFormat, SHADOW_WIDTH, SHADOW_HEIGHT, true);
+            attachShadowDepth();
+            shadowDepthFormatChanged = false;
+        }
+        projection = perspectiveProjection(fovY, (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f, reversedZ);
 
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -140,87 +436,535 @@ int main()
 
         // First render to depth map
         // configure shader and matrices
-        float near_plane = 1.0f, far_plane = 100.0f;
-        glm::mat4 lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, near_plane, far_plane);
         glm::mat4 lightView = glm::lookAt(lightPos, 
-                                        glm::vec3(0.0, 0.0, -2.0), 
+                                        lightTarget, 
                                         glm::vec3( 0.0f, 1.0f,  0.0f));
+        // the fit only looks at casters and receivers, so it doesn't need the light cube's new position yet
+        LightFit lightFit = fitMainLight(sceneObjects, lightView, SHADOW_WIDTH);
+        glm::mat4 lightProjection = orthoProjection(lightFit.left, lightFit.right, lightFit.bottom, lightFit.top, lightFit.zNear, lightFit.zFar, reversedZ);
         glm::mat4 lightSpaceMatrix =  lightProjection * lightView;
-        depthShader->use();
-        depthShader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
+        // only a moved light dirties the cube, so a still frame recomputes no transforms at all
+        if (sceneTransforms.position(sceneObjects[LIGHT_CUBE].transform) != lightPos)
+            sceneTransforms.setPosition(sceneObjects[LIGHT_CUBE].transform, lightPos);
 
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+        if (lightmapBakeRequested) {
+            lightmapBaker->bake(sceneObjects, lightPos, lightSize, threadPool);
+            lightmapBaker->upload();
+            if (!lightmapBaker->write(LIGHTMAP_PATH))
+                fprintf(stderr, "failed to write %s\n", LIGHTMAP_PATH);
+            fprintf(stderr, "baked lightmaps in %.1f ms on %d threads\n", lightmapBaker->bakeMilliseconds(), threadPool->threadCount());
+            lightmapBakeRequested = false;
+        }
+        // static casters only need the shadow maps while something dynamic receives shadows
+        bool useLightmaps = lightmapsEnabled && shadowQuality != SHADOW_DISTANCE_FIELD && lightmapBaker->matches(lightPos, lightSize);
+        bool dynamicReceivers = false, dynamicCasters = false;
+        for (const SceneObject& object : sceneObjects) {
+            // a static receiver the atlas had no room for needs the shadow maps too
+            dynamicReceivers |= object.receivesShadow && (!object.isStatic || object.lightmapRect.x == 0.0f);
+            dynamicCasters |= object.castsShadow && !object.isStatic;
+        }
+        bool bakedStaticCasters = useLightmaps && !dynamicReceivers;
+        // the distance field tier marches the static casters, the main light's maps only hold the rest
+        bool fieldStaticCasters = shadowProjection == SHADOW_PROJECTION_ORTHO && shadowQuality == SHADOW_DISTANCE_FIELD &&
+                                  distanceField->texture() != 0;
+        auto castsRealtimeShadow = [&](const SceneObject& object) {
+            return object.castsShadow && !((bakedStaticCasters || fieldStaticCasters) && object.isStatic);
+        };
+
+        // The stochastic tier always goes through the shadow mask, the history lives there
+        bool useShadowMask = shadowMaskEnabled || shadowQuality == SHADOW_STOCHASTIC;
+        bool useOcclusionQueries = occlusionQueriesEnabled && !gpuCullingEnabled;
+        view = camera.GetViewMatrix();
+
+        // the cascade matrices only need last frame's depth bounds, the readback stays on this thread
+        bool renderCascades = shadowProjection == SHADOW_PROJECTION_ORTHO && cascadesEnabled;
+        if (renderCascades) {
+            DepthBounds samples;
+            bool haveSamples = depthReduction->latest(samples);
+            float nearDepth = 0.1f, farDepth = SHADOW_DISTANCE;
+            if (haveSamples) {
+                // the samples are a frame old, leave some room for camera movement
+                nearDepth = std::max(0.9f * samples.minDepth, 0.1f);
+                farDepth = std::min(1.1f * samples.maxDepth, SHADOW_DISTANCE);
+            }
+            cascadedShadowMap->update(lightView, view, fovY, (float)SCR_WIDTH / (float)SCR_HEIGHT,
+                                      nearDepth, farDepth, haveSamples ? &samples : nullptr);
+        }
+        if (spotLightsEnabled)
+            spotLightAngle += 0.3f * deltaTime;
+
+        // The frame's CPU work as a job graph: the transforms first, then the culling and the draw
+        // commands of every pass side by side. The GL passes below only replay what was recorded
+        float jobsStart = glfwGetTime();
+        stateCache->resetCounters();
+        auto recordDraw = [](CommandBuffer& commands, const SceneObject& object) {
+            commands.draw(object.model->vao(), 0, object.model->vertexCount());
+        };
+        int transformJob = threadPool->addJob([&] { sceneTransforms.update(lightSpaceMatrix, threadPool); });
+        int objectCount = (int)sceneObjects.size();
+
+        // main light casters, minus the ones hidden behind the occluders when the GPU test doesn't run
+        std::vector<int> mainLightCasters;
+        if (shadowProjection == SHADOW_PROJECTION_ORTHO) {
+            threadPool->addJob([&] {
+                bool testOcclusion = softwareOcclusionEnabled && softwareOcclusionLightView && !casterOcclusionEnabled;
+                if (testOcclusion) {
+                    lightOcclusion->begin(lightSpaceMatrix, reversedZ);
+                    for (const SceneObject& object : sceneObjects) {
+                        if (object.occluder && object.castsShadow)
+                            lightOcclusion->addOccluder(object.model->vertices(), object.modelMatrix());
+                    }
+                    lightOcclusion->rasterize(threadPool);
+                }
+                mainLightCasters = threadPool->parallelFilter(objectCount, [&](int i) {
+                    return castsRealtimeShadow(sceneObjects[i]) &&
+                           (!testOcclusion || lightOcclusion->testBounds(sceneObjects[i].worldBounds()));
+                });
+                // the transforms already hold the light-space MVPs, the caster occlusion test draws on its own
+                mainLightCommands.clear();
+                if (!casterOcclusionEnabled) {
+                    for (int i : mainLightCasters) {
+                        mainLightCommands.setMat4(depthModelSlot, sceneTransforms.lightSpaceMvp(sceneObjects[i].transform));
+                        recordDraw(mainLightCommands, sceneObjects[i]);
+                    }
+                }
+            }, { transformJob });
+        }
+
+        std::vector<int> cascadeCasters[CascadedShadowMap::NUM_CASCADES];
+        if (renderCascades) {
+            for (int c = 0; c < CascadedShadowMap::NUM_CASCADES; c++) {
+                threadPool->addJob([&, c] {
+                    cascadeCasters[c] = threadPool->parallelFilter(objectCount, [&](int i) {
+                        return castsRealtimeShadow(sceneObjects[i]) && cascadedShadowMap->overlaps(c, sceneObjects[i].worldBounds());
+                    });
+                    cascadeCommands[c].clear();
+                    for (int i : cascadeCasters[c]) {
+                        cascadeCommands[c].setMat4(depthModelSlot, sceneObjects[i].modelMatrix());
+                        recordDraw(cascadeCommands[c], sceneObjects[i]);
+                    }
+                }, { transformJob });
+            }
+        }
+
+        // spot lights move, then gather the casters within their range
+        std::vector<float> importance(spotLights.size());
+        std::vector<std::vector<int>> spotCasters(spotLights.size());
+        spotCommands.resize(spotLights.size());
+        if (spotLightsEnabled) {
+            for (int l = 0; l < (int)spotLights.size(); l++) {
+                threadPool->addJob([&, l] {
+                    SpotLight& light = spotLights[l];
+                    float angle = spotLightAngle + glm::two_pi<float>() * l / spotLights.size();
+                    float radius = 4.0f + 2.0f * std::sin(0.5f * spotLightAngle + l);
+                    light.position = glm::vec3(radius * std::cos(angle), 3.5f, -2.0f + radius * std::sin(angle));
+                    light.direction = glm::normalize(glm::vec3(0.0f, 0.0f, -2.0f) - light.position);
+                    importance[l] = screenCoverage(light.position, light.range, camera.Position, camera.Front, camera.Zoom);
+                    spotCasters[l] = threadPool->parallelFilter(objectCount, [&](int i) {
+                        if (!sceneObjects[i].castsShadow)
+                            return false;
+                        glm::vec3 boundsMin, boundsMax;
+                        sceneObjects[i].worldBounds(boundsMin, boundsMax);
+                        glm::vec3 closest = glm::clamp(light.position, boundsMin, boundsMax);
+                        return glm::length(closest - light.position) <= light.range;
+                    });
+                    // recorded for every light, the scheduler picks the ones that get replayed
+                    spotCommands[l].clear();
+                    for (int i : spotCasters[l]) {
+                        spotCommands[l].setMat4(depthModelSlot, sceneObjects[i].modelMatrix());
+                        recordDraw(spotCommands[l], sceneObjects[i]);
+                    }
+                }, { transformJob });
+            }
+        }
+
+        // CPU occlusion culling for the objects submitted one by one, no readback involved
+        std::vector<int> cameraDraws;
+        if (!gpuCullingEnabled && !useOcclusionQueries) {
+            int cameraJob = threadPool->addJob([&] {
+                if (!softwareOcclusionEnabled) {
+                    cameraDraws.resize(objectCount);
+                    for (int i = 0; i < objectCount; i++) {
+                        cameraDraws[i] = i;
+                    }
+                    return;
+                }
+                float start = glfwGetTime();
+                cameraOcclusion->begin(projection * view, reversedZ);
+                for (const SceneObject& object : sceneObjects) {
+                    if (object.occluder)
+                        cameraOcclusion->addOccluder(object.model->vertices(), object.modelMatrix());
+                }
+                cameraOcclusion->rasterize(threadPool);
+                cameraDraws = threadPool->parallelFilter(objectCount, [&](int i) {
+                    return cameraOcclusion->testBounds(sceneObjects[i].worldBounds());
+                });
+                softwareOccludedObjects = objectCount - (int)cameraDraws.size();
+                softwareOcclusionMs = 1000.0f * (glfwGetTime() - start);
+            }, { transformJob });
+            threadPool->addJob([&] {
+                prepassCommands.clear();
+                for (int i : cameraDraws) {
+                    prepassCommands.setMat4(prepassModelSlot, sceneObjects[i].modelMatrix());
+                    recordDraw(prepassCommands, sceneObjects[i]);
+                }
+            }, { cameraJob });
+            threadPool->addJob([&] {
+                litCommands.clear();
+                for (int i : cameraDraws) {
+                    litCommands.setMat4(litModelSlot, sceneObjects[i].modelMatrix());
+                    litCommands.setMat3(litNormalMatrixSlot, sceneObjects[i].normalMatrix());
+                    litCommands.setVec4(litLightmapRectSlot, sceneObjects[i].lightmapRect);
+                    recordDraw(litCommands, sceneObjects[i]);
+                }
+            }, { cameraJob });
+        }
+        threadPool->runJobs();
+        frameJobsMs = 1000.0f * (glfwGetTime() - jobsStart);
+
+        shadowPassTimer->begin();
+        glCullFace(GL_FRONT);
+        if (shadowProjection == SHADOW_PROJECTION_ORTHO) {
+            // receivers from the last frame's depth, reprojected with this frame's light. The mask
+            // lives in the stencil, which 16 bit depth doesn't come with
+            bool useReceiverMask = receiverMaskEnabled && depthFormatHasStencil(shadowDepthFormat);
+            if (useReceiverMask)
+                receiverMask->build(sceneTarget->depthTexture(), glm::inverse(previousViewProjection), previousReversedZ, lightSpaceMatrix);
+
+            glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+                setDepthConvention(reversedZ);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                if (useReceiverMask)
+                    receiverMask->apply();
+
+                depthShader->use();
+                depthShader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
+                // casters in front of the fitted near plane are pancaked onto it
+                glEnable(GL_DEPTH_CLAMP);
+                // render scene
+                if (casterOcclusionEnabled) {
+                    casterOcclusion->setCasters(sceneObjects, mainLightCasters, lightSpaceMatrix, reversedZ);
+                    casterOcclusion->drawVisible(depthShader);
+
+                    // re-test everything against what was drawn so far, then fill in the misses
+                    depthPyramid->build(depthMap);
+                    casterOcclusion->test(depthPyramid->texture(), reversedZ);
+                    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+                    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+                    depthShader->use();
+                    depthShader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
+                    casterOcclusion->drawNewlyVisible(depthShader);
+                } else {
+                    depthShader->setMat4("lightSpaceMatrix", glm::mat4(1.0f));
+                    stateCache->replay(mainLightCommands);
+                }
+                glDisable(GL_DEPTH_CLAMP);
+                if (useReceiverMask)
+                    receiverMask->end();
+                // every other shadow pass uses forward depth
+                setDepthConvention(false);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        } else {
+            // every caster is submitted once and only reaches the faces its bounds overlap
+            pointShadowMap->begin(shadowProjection == SHADOW_PROJECTION_CUBE ? PointShadowMap::CUBE : PointShadowMap::DUAL_PARABOLOID,
+                                  lightPos, POINT_SHADOW_FAR);
+            for (const SceneObject& object : sceneObjects) {
+                if (!castsRealtimeShadow(object))
+                    continue;
+                glm::vec3 boundsMin, boundsMax;
+                object.worldBounds(boundsMin, boundsMax);
+                unsigned int mask = pointShadowMap->faceMask(boundsMin, boundsMax);
+                if (mask != 0)
+                    pointShadowMap->drawCaster(object.model, object.modelMatrix(), mask);
+            }
+            pointShadowMap->end();
+        }
+        shadowPassTimer->end();
+
+        // virtual shadow map: request the pages the last frame's pixels sampled and render
+        // the missing ones, everything else stays cached
+        if (shadowProjection == SHADOW_PROJECTION_ORTHO && virtualShadowsEnabled) {
+            virtualShadowTimer->begin();
+            glm::mat4 vsmProjection = glm::ortho(-VSM_EXTENT, VSM_EXTENT, -VSM_EXTENT, VSM_EXTENT, near_plane, far_plane);
+            virtualShadowMap->setLight(vsmProjection * lightView);
+            virtualShadowMap->markPages(sceneTarget->depthTexture(), glm::inverse(previousViewProjection), previousReversedZ);
+            virtualShadowMap->update();
+
+            std::vector<glm::vec2> casterMin, casterMax;
+            std::vector<const SceneObject*> casters;
+            for (const SceneObject& object : sceneObjects) {
+                if (!castsRealtimeShadow(object))
+                    continue;
+                glm::vec3 boundsMin, boundsMax;
+                object.worldBounds(boundsMin, boundsMax);
+                glm::vec2 ndcMin, ndcMax;
+                virtualShadowMap->lightSpaceRect(boundsMin, boundsMax, ndcMin, ndcMax);
+                casters.push_back(&object);
+                casterMin.push_back(ndcMin);
+                casterMax.push_back(ndcMax);
+            }
+
+            depthShader->use();
+            virtualShadowMap->begin();
+            for (int page = 0; page < virtualShadowMap->pendingPages(); page++) {
+                depthShader->setMat4("lightSpaceMatrix", virtualShadowMap->beginPage(page));
+                for (int i = 0; i < (int)casters.size(); i++) {
+                    if (!virtualShadowMap->pageOverlaps(page, casterMin[i], casterMax[i]))
+                        continue;
+                    depthShader->setMat4("model", casters[i]->modelMatrix());
+                    casters[i]->model->draw();
+                }
+            }
+            virtualShadowMap->end();
+            virtualShadowTimer->end();
+        }
+
+        // cascades: without a reduction result yet they cover the whole shadow distance
+        if (renderCascades) {
+            cascadeTimer->begin();
+            depthShader->use();
+            cascadedShadowMap->begin();
+            for (int i = 0; i < CascadedShadowMap::NUM_CASCADES; i++) {
+                if (!cascadedShadowMap->beginCascade(i))
+                    continue;
+                depthShader->setMat4("lightSpaceMatrix", cascadedShadowMap->matrix(i));
+                stateCache->replay(cascadeCommands[i]);
+            }
+            cascadedShadowMap->end();
+            cascadeTimer->end();
+        }
+
+        // spot light shadows: one framebuffer, one viewport per atlas tile
+        if (spotLightsEnabled) {
+            shadowAtlas->allocate(importance);
+
+            // only the lights picked by the scheduler are re-rendered, the others keep their tiles
+            std::vector<ShadowRequest> requests(spotLights.size());
+            for (int i = 0; i < (int)spotLights.size(); i++) {
+                requests[i] = { spotLights[i].position, spotLights[i].direction, importance[i],
+                                glm::length(spotLights[i].position - camera.Position), (int)spotCasters[i].size(),
+                                shadowAtlas->tile(i).valid() && shadowAtlas->tileChanged(i) };
+            }
+            const std::vector<int>& updates = shadowScheduler->schedule(requests);
+
+            int castersDrawn = 0;
+            atlasPassTimer->begin();
+            depthShader->use();
+            shadowAtlas->begin();
+            for (int i : updates) {
+                glm::mat4 spotLightSpaceMatrix = spotLights[i].viewProjection();
+                if (!shadowAtlas->beginTile(i, spotLightSpaceMatrix))
+                    continue;
+                depthShader->setMat4("lightSpaceMatrix", spotLightSpaceMatrix);
+                stateCache->replay(spotCommands[i]);
+                castersDrawn += (int)spotCasters[i].size();
+                shadowAtlas->markRendered(i);
+            }
+            shadowAtlas->end();
+            atlasPassTimer->end();
+            shadowScheduler->reportCost(castersDrawn, atlasPassTimer->milliseconds());
+            shadowAtlas->uploadLights(spotLights);
+        }
+
+        // the pyramid is only read by the PCSS blocker search
+        if (shadowProjection == SHADOW_PROJECTION_ORTHO && shadowQuality == SHADOW_PCSS) {
+            pyramidTimer->begin();
+            depthPyramid->build(depthMap);
+            pyramidTimer->end();
+        }
+
+
+        glm::vec3 camPos = camera.Position;
+
+        // every uniform and texture the lookups in shadow.glsl read, for the lit pass and the shadow mask
+        float shadowTexelSize = std::max(lightFit.right - lightFit.left, lightFit.top - lightFit.bottom) / SHADOW_WIDTH;
+        // penumbra growth per unit of NDC depth, in shadow map UV
+        float lightAngle = lightSize / glm::length(lightTarget - lightPos);
+        auto setShadowUniforms = [&](Shader* shader) {
+            shader->use();
+            shader->setVec3("lightPos", lightPos);
+            shader->setMat4("view", view);
+            shader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
+            shader->setInt("shadowQuality", shadowQuality);
+            shader->setInt("shadowDepthBits", depthFormatBits(shadowDepthFormat));
+            shader->setBool("shadowReversedZ", reversedZ);
+            shader->setFloat("shadowTexelDepth", shadowTexelSize / (lightFit.zFar - lightFit.zNear));
+            shader->setFloat("pcssLightSize", lightAngle * (lightFit.zFar - lightFit.zNear) / (lightFit.right - lightFit.left));
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, depthMap);
+            shader->setInt("shadowMap", 0);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, depthPyramid->texture());
+            shader->setInt("depthPyramid", 1);
+            shader->setInt("shadowProjection", shadowProjection);
+            shader->setFloat("pointFarPlane", pointShadowMap->farPlane());
+            shader->setMat4("paraboloidViews[0]", pointShadowMap->paraboloidView(0));
+            shader->setMat4("paraboloidViews[1]", pointShadowMap->paraboloidView(1));
+            // every sampler type gets its own unit, even when unused
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, pointShadowMap->cubeTexture());
+            shader->setInt("pointShadowCube", 2);
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, pointShadowMap->paraboloidTexture());
+            shader->setInt("pointShadowParaboloid", 3);
+            glActiveTexture(GL_TEXTURE4);
+            glBindTexture(GL_TEXTURE_2D, shadowAtlas->texture());
+            shader->setInt("shadowAtlas", 4);
+            glBindBufferBase(GL_UNIFORM_BUFFER, 0, shadowAtlas->uniformBuffer());
+            shader->setBool("virtualShadowsEnabled", shadowProjection == SHADOW_PROJECTION_ORTHO && virtualShadowsEnabled);
+            shader->setMat4("vsmLightSpaceMatrix", virtualShadowMap->lightSpaceMatrix());
+            shader->setInt("vsmPhysicalPagesPerSide", virtualShadowMap->physicalPagesPerSide());
+            glActiveTexture(GL_TEXTURE5);
+            glBindTexture(GL_TEXTURE_2D, virtualShadowMap->pageTable());
+            shader->setInt("vsmPageTable", 5);
+            glActiveTexture(GL_TEXTURE6);
+            glBindTexture(GL_TEXTURE_2D, virtualShadowMap->physicalTexture());
+            shader->setInt("vsmPhysical", 6);
+            shader->setBool("cascadesEnabled", shadowProjection == SHADOW_PROJECTION_ORTHO && cascadesEnabled);
+            glm::vec4 cascadeSplits, cascadeBiasScales;
+            for (int i = 0; i < CascadedShadowMap::NUM_CASCADES; i++) {
+                shader->setMat4("cascadeMatrices[" + std::to_string(i) + "]", cascadedShadowMap->matrix(i));
+                cascadeSplits[i] = cascadedShadowMap->split(i);
+                cascadeBiasScales[i] = cascadedShadowMap->biasScale(i);
+            }
+            shader->setVec4("cascadeSplits", cascadeSplits);
+            shader->setVec4("cascadeBiasScales", cascadeBiasScales);
+            glActiveTexture(GL_TEXTURE7);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, cascadedShadowMap->texture());
+            shader->setInt("cascadeShadowMap", 7);
+            // the R2 sequence moves the tile by an irrational amount each frame, so consecutive
+            // frames see uncorrelated rotations and the accumulated taps cover the whole disk
+            glm::vec2 r2 = glm::fract((float)(frameIndex % 4096) * glm::vec2(0.7548776662f, 0.5698402910f));
+            shader->setInt("frameIndex", (int)(frameIndex % 16));
+            shader->setIVec2("blueNoiseOffset", glm::ivec2(r2 * 64.0f));
+            glActiveTexture(GL_TEXTURE9);
+            glBindTexture(GL_TEXTURE_2D, blueNoiseTexture);
+            shader->setInt("blueNoise", 9);
+            shader->setBool("distanceFieldEnabled", fieldStaticCasters);
+            shader->setVec3("distanceFieldMin", distanceField->bounds().min);
+            shader->setVec3("distanceFieldMax", distanceField->bounds().max);
+            shader->setFloat("distanceFieldVoxelSize", distanceField->voxelSize());
+            shader->setFloat("distanceFieldLightSize", lightSize);
+            glActiveTexture(GL_TEXTURE11);
+            glBindTexture(GL_TEXTURE_3D, distanceField->texture());
+            shader->setInt("distanceField", 11);
+        };
+
+        bool useDepthPrepass = depthPrepassEnabled || useShadowMask || gpuCullingEnabled || useOcclusionQueries;
+        if (useDepthPrepass) {
+            depthPrepassTimer->begin();
+            if (gpuCullingEnabled) {
+                gpuCulling->setInstances(sceneObjects);
+                gpuCulling->updateTransforms(sceneTransforms.updated());
+                gpuCulling->cullVisible(projection * view, reversedZ);
+            }
+            sceneTarget->bind();
+            setDepthConvention(reversedZ);
             glClear(GL_DEPTH_BUFFER_BIT);
-            glCullFace(GL_FRONT);
-            // render scene
-            modelMat = glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 1.0f, -5.0f));
-            depthShader->setMat4("model", modelMat);
-            cube1->draw();
-
-            // cube2
-            modelMat = glm::translate(glm::mat4(1.0f), glm::vec3(-2.0f, 2.0f, -3.0f));
-            depthShader->setMat4("model", modelMat);
-            cube1->draw();
-
-            // floor
-            modelMat = trans * scale;
-            depthShader->setMat4("model", modelMat);
-            cube1->draw();
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glCullFace(GL_BACK);
+            // no color writes, the fragment shader is empty anyway
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            prepassShader->use();
+            prepassShader->setMat4("view", view);
+            prepassShader->setMat4("projection", projection);
+            if (gpuCullingEnabled) {
+                gpuCulling->draw(prepassShader, 0);
+                // the pyramid is rendered, so color writes have to be back on
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                gpuCulling->cullNewlyVisible(sceneTarget->depthTexture());
+                sceneTarget->bind();
+                setDepthConvention(reversedZ);
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                prepassShader->use();
+                gpuCulling->draw(prepassShader, 1);
+            } else if (useOcclusionQueries) {
+                occlusionQueries->drawPrepass(sceneObjects, prepassShader, projection * view, camPos);
+            } else {
+                stateCache->replay(prepassCommands);
+            }
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            depthPrepassTimer->end();
+        }
 
+        // deferred shadows: the main light's shadow at reduced resolution from the prepass depth
+        if (useShadowMask) {
+            shadowMaskTimer->begin();
+            setShadowUniforms(shadowMask->maskShader());
+            shadowMask->render(sceneTarget->depthTexture(), projection, view, reversedZ,
+                               shadowQuality == SHADOW_STOCHASTIC, previousViewProjection);
+            shadowMaskTimer->end();
+        }
 
         // Then render the scene as normal with shadow mapping
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+        sceneTarget->bind();
+        setDepthConvention(reversedZ);
         glClearColor(0.82, 0.93, 0.99, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (useDepthPrepass) {
+            // keep the prepass depth, the lit pass only shades the surfaces it laid down. The
+            // invariant positions make the depths bit-identical, so EQUAL is safe
+            glClear(GL_COLOR_BUFFER_BIT);
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        } else {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
         glCullFace(GL_BACK);
 
-
-        // Render the debugging quad
-        passthroughShader->use();
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
-        passthroughShader->setInt("depthMap", 0);
-        glBindVertexArray(quadVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-
+        litPassTimers[shadowQuality][useDepthPrepass]->begin();
 
         // Render the rest of the cubes
-        view = camera.GetViewMatrix();
-        glm::vec3 camPos = camera.Position;
-
-        basicShader->use();
-        basicShader->setVec3("lightPos", lightPos);
+        setShadowUniforms(basicShader);
         basicShader->setVec3("eyePos", camPos);
-        basicShader->setMat4("view", view);
         basicShader->setMat4("projection", projection);
-        basicShader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
+        basicShader->setBool("spotLightsEnabled", spotLightsEnabled);
+        basicShader->setBool("shadowMaskEnabled", useShadowMask);
+        basicShader->setBool("lightmapsEnabled", useLightmaps);
+        basicShader->setBool("dynamicCasters", dynamicCasters || !bakedStaticCasters);
+        glActiveTexture(GL_TEXTURE10);
+        glBindTexture(GL_TEXTURE_2D, lightmapBaker->texture());
+        basicShader->setInt("lightmap", 10);
+        glActiveTexture(GL_TEXTURE8);
+        glBindTexture(GL_TEXTURE_2D, shadowMask->texture());
+        basicShader->setInt("shadowMask", 8);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
-        basicShader->setInt("depthMap", 0);
+        if (gpuCullingEnabled) {
+            // both phases' survivors, the prepass already resolved visibility
+            gpuCulling->draw(basicShader, 0);
+            gpuCulling->draw(basicShader, 1);
+        } else if (useOcclusionQueries) {
+            occlusionQueries->draw(basicShader);
+        } else {
+            stateCache->replay(litCommands);
+        }
 
-        // cube1
-        modelMat = glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 1.0f, -5.0f));
-        basicShader->setMat4("model", modelMat);
-        cube1->draw();
+        litPassTimers[shadowQuality][useDepthPrepass]->end();
+        glDepthMask(GL_TRUE);
+        setDepthConvention(reversedZ);
 
-        // cube2
-        modelMat = glm::translate(glm::mat4(1.0f), glm::vec3(-2.0f, 2.0f, -3.0f));
-        basicShader->setMat4("model", modelMat);
-        cube1->draw();
+        // the debugging quad goes on top, whichever way depth runs
+        glDisable(GL_DEPTH_TEST);
+        passthroughShader->use();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depthMap);
+        passthroughShader->setInt("depthMap", 0);
+        glBindVertexArray(quadVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glEnable(GL_DEPTH_TEST);
 
-        // floor
-        modelMat = trans * scale;
-        basicShader->setMat4("model", modelMat);
-        cube1->draw();
+        // min/max depth and light-space bounds of what this frame sees, for next frame's cascades
+        if (cascadesEnabled) {
+            depthReductionTimer->begin();
+            depthReduction->reduce(sceneTarget->depthTexture(), projection, view, lightView, reversedZ);
+            depthReductionTimer->end();
+        }
 
-        // lightCube
-        modelMat = glm::translate(glm::mat4(1.0f), lightPos) * glm::scale(glm::mat4(1.0f), glm::vec3(0.3));
-        basicShader->setMat4("model", modelMat);
-        cube1->draw();
+        sceneTarget->blitToScreen();
+        previousViewProjection = projection * view;
+        previousReversedZ = reversedZ;
+        setDepthConvention(false);
+        frameIndex++;
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
@@ -228,10 +972,62 @@ int main()
         glfwPollEvents();
     }
 
-    cube1->deleteGLResources();
-    delete cube1;
+    lightCubeModel->deleteGLResources();
+    delete lightCubeModel;
+    for (Model* model : sceneModels) {
+        model->deleteGLResources();
+        delete model;
+    }
     delete basicShader;
 
+    shadowMask->deleteGLResources();
+    delete shadowMask;
+    shadowMaskTimer->deleteGLResources();
+    depthPrepassTimer->deleteGLResources();
+    glDeleteTextures(1, &blueNoiseTexture);
+    delete prepassShader;
+    casterOcclusion->deleteGLResources();
+    delete casterOcclusion;
+    gpuCulling->deleteGLResources();
+    delete gpuCulling;
+    occlusionQueries->deleteGLResources();
+    delete occlusionQueries;
+    delete cameraOcclusion;
+    delete lightOcclusion;
+    lightmapBaker->deleteGLResources();
+    delete lightmapBaker;
+    distanceField->deleteGLResources();
+    delete distanceField;
+    delete threadPool;
+    delete stateCache;
+    receiverMask->deleteGLResources();
+    delete receiverMask;
+    cascadedShadowMap->deleteGLResources();
+    delete cascadedShadowMap;
+    depthReduction->deleteGLResources();
+    delete depthReduction;
+    cascadeTimer->deleteGLResources();
+    depthReductionTimer->deleteGLResources();
+    virtualShadowMap->deleteGLResources();
+    delete virtualShadowMap;
+    virtualShadowTimer->deleteGLResources();
+    sceneTarget->deleteGLResources();
+    delete sceneTarget;
+    shadowAtlas->deleteGLResources();
+    delete shadowAtlas;
+    pointShadowMap->deleteGLResources();
+    delete pointShadowMap;
+    depthPyramid->deleteGLResources();
+    delete depthPyramid;
+    shadowPassTimer->deleteGLResources();
+    pyramidTimer->deleteGLResources();
+    for (int i = 0; i < NUM_SHADOW_QUALITIES; i++) {
+        litPassTimers[i][0]->deleteGLResources();
+        litPassTimers[i][1]->deleteGLResources();
+    }
+    atlasPassTimer->deleteGLResources();
+    delete shadowScheduler;
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -268,13 +1064,140 @@ void processInput(GLFWwindow *window)
     if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
         lightPos.z -= increment;
 
+    if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
+        shadowQuality = SHADOW_HARD;
+    if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
+        shadowQuality = SHADOW_PCF;
+    if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS)
+        shadowQuality = SHADOW_PCSS;
+    if (glfwGetKey(window, GLFW_KEY_4) == GLFW_PRESS)
+        shadowQuality = SHADOW_STOCHASTIC;
+    if (glfwGetKey(window, GLFW_KEY_5) == GLFW_PRESS)
+        shadowQuality = SHADOW_DISTANCE_FIELD;
+
+    if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS)
+        shadowProjection = SHADOW_PROJECTION_ORTHO;
+    if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS)
+        shadowProjection = SHADOW_PROJECTION_CUBE;
+    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS)
+        shadowProjection = SHADOW_PROJECTION_DUAL_PARABOLOID;
+
     if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
         fprintf(stderr, "light pos = [ %f %f %f]\n", lightPos.x, lightPos.y, lightPos.z);
         fprintf(stderr, "cam pos = [ %f %f %f]\n", camera.Position.x, camera.Position.y, camera.Position.z);
+        fprintf(stderr, "frame jobs = %.3f ms on %d threads, replay made %d GL calls and skipped %d\n", frameJobsMs,
+                threadPool->threadCount(), stateCache->issuedCalls(), stateCache->skippedCalls());
+        fprintf(stderr, "shadow pass = %.3f ms, pyramid = %.3f ms\n", shadowPassTimer->milliseconds(), pyramidTimer->milliseconds());
+        fprintf(stderr, "spot shadows = %.3f ms, budget %.1f %s, spent %.1f, overruns %d\n", atlasPassTimer->milliseconds(),
+                shadowScheduler->budget(), shadowScheduler->budgetType() == ShadowScheduler::BUDGET_CASTERS ? "casters" : "us",
+                shadowScheduler->spent(), shadowScheduler->overruns());
+        fprintf(stderr, "virtual shadows = %.3f ms, %d pages requested, %d resident\n", virtualShadowTimer->milliseconds(),
+                virtualShadowMap->requestedPages(), virtualShadowMap->residentPages());
+        fprintf(stderr, "depth prepass = %.3f ms%s\n", depthPrepassTimer->milliseconds(),
+                depthPrepassEnabled || shadowMaskEnabled || gpuCullingEnabled || occlusionQueriesEnabled ||
+                shadowQuality == SHADOW_STOCHASTIC ? "" : " [off]");
+        if (gpuCullingEnabled)
+            fprintf(stderr, "  gpu culled\n");
+        else if (occlusionQueriesEnabled)
+            fprintf(stderr, "  occlusion queries, %d of %d objects visible\n", occlusionQueries->visibleCount(), occlusionQueries->objectCount());
+        else if (softwareOcclusionEnabled)
+            fprintf(stderr, "  software occlusion = %.3f ms on %d threads, %d triangles, %d objects culled\n", softwareOcclusionMs,
+                    threadPool->threadCount(), cameraOcclusion->triangleCount(), softwareOccludedObjects);
+        if (shadowMaskEnabled || shadowQuality == SHADOW_STOCHASTIC)
+            fprintf(stderr, "shadow mask (1/%d) = %.3f ms\n", shadowMaskScale, shadowMaskTimer->milliseconds());
+        fprintf(stderr, "cascades = %.3f ms, depth reduction = %.3f ms, splits", cascadeTimer->milliseconds(), depthReductionTimer->milliseconds());
+        for (int i = 0; i < CascadedShadowMap::NUM_CASCADES; i++) {
+            fprintf(stderr, " %.2f", cascadedShadowMap->split(i));
+        }
+        fprintf(stderr, "\n");
+        for (int i = 0; i < shadowScheduler->lightCount(); i++) {
+            fprintf(stderr, "  spot light %d updated in %.0f%% of frames\n", i, 100.0f * shadowScheduler->updateFrequency(i));
+        }
+        for (int i = 0; i < NUM_SHADOW_QUALITIES; i++) {
+            // with the prepass its own cost has to be added for a fair comparison
+            fprintf(stderr, "lit pass (%s) = %.3f ms, with prepass %.3f + %.3f ms%s\n", shadowQualityNames[i],
+                    litPassTimers[i][0]->milliseconds(), depthPrepassTimer->milliseconds(), litPassTimers[i][1]->milliseconds(),
+                    i == shadowQuality ? " [active]" : "");
+        }
     }
     
 }
 
+// glfw: toggles react to the key press itself rather than to the key being held down
+// ----------------------------------------------------------------------------------
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (action != GLFW_PRESS)
+        return;
+
+    if (key == GLFW_KEY_M)
+        spotLightsEnabled = !spotLightsEnabled;
+    if (key == GLFW_KEY_F)
+        autoFitLightFrustum = !autoFitLightFrustum;
+    if (key == GLFW_KEY_T) {
+        shadowDepthFormat = (DepthFormat)((shadowDepthFormat + 1) % NUM_DEPTH_FORMATS);
+        shadowDepthFormatChanged = true;
+        // reversed-Z only pays off with float depth
+        if (shadowDepthFormat != DEPTH_32F)
+            reversedZ = false;
+        fprintf(stderr, "shadow depth format = %s\n", depthFormatNames[shadowDepthFormat]);
+    }
+    if (key == GLFW_KEY_R && reversedZSupported()) {
+        reversedZ = !reversedZ;
+        if (reversedZ && shadowDepthFormat != DEPTH_32F) {
+            shadowDepthFormat = DEPTH_32F;
+            shadowDepthFormatChanged = true;
+        }
+        fprintf(stderr, "reversed-Z %s\n", reversedZ ? "on" : "off");
+    }
+    if (key == GLFW_KEY_Q)
+        shadowMaskEnabled = !shadowMaskEnabled;
+    if (key == GLFW_KEY_U) {
+        depthPrepassEnabled = !depthPrepassEnabled;
+        fprintf(stderr, "depth prepass %s\n", depthPrepassEnabled ? "on" : "off");
+    }
+    if (key == GLFW_KEY_E)
+        shadowMaskScale = shadowMaskScale == 2 ? 4 : 2;
+    if (key == GLFW_KEY_Y) {
+        gpuCullingEnabled = !gpuCullingEnabled && gpuCulling->supported();
+        // whatever moved while it was off never reached the instances
+        gpuCulling->invalidateInstances();
+        fprintf(stderr, "gpu culling %s\n", gpuCullingEnabled ? "on" : "off");
+    }
+    if (key == GLFW_KEY_F1) {
+        occlusionQueriesEnabled = !occlusionQueriesEnabled;
+        fprintf(stderr, "occlusion queries %s\n", occlusionQueriesEnabled ? "on" : "off");
+    }
+    if (key == GLFW_KEY_F2) {
+        softwareOcclusionEnabled = !softwareOcclusionEnabled;
+        fprintf(stderr, "software occlusion culling %s\n", softwareOcclusionEnabled ? "on" : "off");
+    }
+    if (key == GLFW_KEY_F3) {
+        softwareOcclusionLightView = !softwareOcclusionLightView;
+        fprintf(stderr, "software occlusion culling from the light %s\n", softwareOcclusionLightView ? "on" : "off");
+    }
+    if (key == GLFW_KEY_F4) {
+        lightmapsEnabled = !lightmapsEnabled;
+        fprintf(stderr, "lightmaps %s\n", lightmapsEnabled ? "on" : "off");
+    }
+    if (key == GLFW_KEY_F5)
+        lightmapBakeRequested = true;
+    if (key == GLFW_KEY_H)
+        casterOcclusionEnabled = !casterOcclusionEnabled && casterOcclusion->supported();
+    if (key == GLFW_KEY_N)
+        receiverMaskEnabled = !receiverMaskEnabled && receiverMask->supported();
+    if (key == GLFW_KEY_G)
+        cascadesEnabled = !cascadesEnabled;
+    if (key == GLFW_KEY_V)
+        virtualShadowsEnabled = !virtualShadowsEnabled && virtualShadowMap->supported();
+    if (key == GLFW_KEY_B) {
+        if (shadowScheduler->budgetType() == ShadowScheduler::BUDGET_CASTERS)
+            shadowScheduler->setBudget(ShadowScheduler::BUDGET_GPU_MICROSECONDS, SHADOW_MICROSECOND_BUDGET);
+        else
+            shadowScheduler->setBudget(ShadowScheduler::BUDGET_CASTERS, SHADOW_CASTER_BUDGET);
+    }
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
@@ -332,6 +1255,7 @@ GLFWwindow* initWindow() {
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    glfwSetKeyCallback(window, key_callback);
 
     // tell GLFW to capture our mouse
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -345,4 +1269,224 @@ GLFWwindow* initWindow() {
     }
 
     return window;
-}
\ No newline at end of file
+}
+// takes the main light and the shadow settings from the scene and loads its meshes, without
+// touching GL
+std::vector<Model*> applySceneHeader(const SceneHeader& scene) {
+    lightPos = scene.lightPosition;
+    lightTarget = scene.lightTarget;
+    lightSize = scene.lightSize;
+    for (int i = 0; i < NUM_SHADOW_QUALITIES; i++) {
+        if (scene.shadowQuality == shadowQualityNames[i])
+            shadowQuality = i;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (scene.shadowProjection == shadowProjectionNames[i])
+            shadowProjection = i;
+    }
+    std::vector<Model*> models;
+    for (const std::string& path : scene.meshPaths)
+        models.push_back(new Model(path.c_str()));
+    return models;
+}
+
+void addSceneObjects(const std::vector<SceneRecord>& records, const std::vector<Model*>& models, TransformSystem& transforms,
+                     std::vector<SceneObject>& sceneObjects) {
+    for (const SceneRecord& record : records) {
+        int transform = transforms.create(record.position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), record.scale);
+        SceneObject object = { models[record.mesh], &transforms, transform,
+                               (record.flags & SCENE_CASTS_SHADOW) != 0, (record.flags & SCENE_RECEIVES_SHADOW) != 0 };
+        object.occluder = (record.flags & SCENE_OCCLUDER) != 0;
+        object.isStatic = (record.flags & SCENE_STATIC) != 0;
+        sceneObjects.push_back(object);
+    }
+}
+
+// the whole scene at once, with the light cube first like the windowed mode
+bool loadScene(std::vector<Model*>& models, TransformSystem& transforms, std::vector<SceneObject>& sceneObjects) {
+    SceneLoader loader;
+    if (!loader.open(scenePath))
+        return false;
+    models = applySceneHeader(loader.header());
+    models.push_back(new Model("cube.obj"));
+    sceneObjects = { { models.back(), &transforms, transforms.create(lightPos, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.3f)), false, false } };
+    std::vector<SceneRecord> records;
+    loader.wait(records);
+    addSceneObjects(records, models, transforms, sceneObjects);
+    return true;
+}
+
+// lays out and loads or bakes the lightmaps and builds the distance field, once every static object is known
+void prepareStaticObjects(std::vector<SceneObject>& sceneObjects) {
+    // baked shadows of the static receivers, from disk when they were baked for this light
+    lightmapBaker->layout(sceneObjects, scenePath);
+    // the rects were written into the objects, the GPU-culled instances hold copies
+    gpuCulling->invalidateInstances();
+    if (!lightmapBaker->read(LIGHTMAP_PATH) || !lightmapBaker->matches(lightPos, lightSize))
+        lightmapBakeRequested = true;
+    else
+        lightmapBaker->upload();
+
+    distanceField->build(sceneObjects, threadPool);
+    distanceField->upload();
+    fprintf(stderr, "built distance field in %.1f ms on %d threads\n", distanceField->buildMilliseconds(), threadPool->threadCount());
+}
+
+// tighten the ortho box around what can be seen in shadow, the fixed box is the fallback
+LightFit fitMainLight(const std::vector<SceneObject>& sceneObjects, const glm::mat4& lightView, unsigned int shadowSize) {
+    LightFit lightFit = { -ortho_size, ortho_size, -ortho_size, ortho_size, near_plane, far_plane, true };
+    if (autoFitLightFrustum) {
+        std::vector<Bounds> casterBounds, receiverBounds;
+        for (const SceneObject& object : sceneObjects) {
+            if (object.castsShadow)
+                casterBounds.push_back(object.worldBounds());
+            if (object.receivesShadow)
+                receiverBounds.push_back(object.worldBounds());
+        }
+        glm::mat4 shadowViewProjection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, SHADOW_DISTANCE) *
+                                         camera.GetViewMatrix();
+        LightFit fitted = fitLightFrustum(lightView, casterBounds, receiverBounds, Frustum(shadowViewProjection), shadowSize);
+        if (fitted.valid)
+            lightFit = fitted;
+    }
+    return lightFit;
+}
+
+// --cpu-render [--shadow-rays] [--output path] [--frames n]: renders the start view with CpuRenderer,
+// prints frames/s for 1, 2, 4, ... threads up to the hardware thread count, how far the shadow
+// map is from ray traced shadows, and writes the image as PPM
+int cpuRender(int argc, char** argv) {
+    const char* output = "cpu_render.ppm";
+    int frames = 10;
+    bool shadowRays = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--shadow-rays")
+            shadowRays = true;
+        else if (std::string(argv[i]) == "--output" && i + 1 < argc)
+            output = argv[i + 1];
+        else if (std::string(argv[i]) == "--frames" && i + 1 < argc)
+            frames = std::max(atoi(argv[i + 1]), 1);
+    }
+
+    // loading the objs doesn't touch GL, the buffers are never set up
+    std::vector<Model*> models;
+    TransformSystem transforms;
+    std::vector<SceneObject> sceneObjects;
+    if (!loadScene(models, transforms, sceneObjects))
+        return 1;
+    const unsigned int SHADOW_SIZE = 1024;
+
+    // forward depth and the main light's orthographic map, what basic.frag sees without the extra shadow techniques
+    glm::mat4 lightView = glm::lookAt(lightPos, lightTarget, glm::vec3(0.0f, 1.0f, 0.0f));
+    LightFit lightFit = fitMainLight(sceneObjects, lightView, SHADOW_SIZE);
+    CpuRenderer::Lighting lighting;
+    lighting.lightPos = lightPos;
+    lighting.eyePos = camera.Position;
+    lighting.lightSpaceMatrix = orthoProjection(lightFit.left, lightFit.right, lightFit.bottom, lightFit.top, lightFit.zNear, lightFit.zFar, false) * lightView;
+    float shadowTexelSize = std::max(lightFit.right - lightFit.left, lightFit.top - lightFit.bottom) / SHADOW_SIZE;
+    lighting.shadowTexelDepth = shadowTexelSize / (lightFit.zFar - lightFit.zNear);
+    // pcss and stochastic fall back to pcf
+    lighting.pcf = shadowQuality != SHADOW_HARD;
+    lighting.rayTraced = shadowRays;
+    glm::mat4 viewProjection = perspectiveProjection(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f, false) *
+                               camera.GetViewMatrix();
+
+    CpuRenderer renderer(SCR_WIDTH, SCR_HEIGHT, SHADOW_SIZE);
+    int maxThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+    double baseline = 0.0;
+    for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+        // the calling thread is one of them, one thread runs without a pool
+        ThreadPool* pool = threads > 1 ? new ThreadPool(threads - 1) : nullptr;
+        renderer.render(sceneObjects, viewProjection, lighting, pool);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++)
+            renderer.render(sceneObjects, viewProjection, lighting, pool);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double fps = frames / seconds;
+        if (threads == 1)
+            baseline = fps;
+        fprintf(stderr, "cpu render %ux%u, %s, %2d threads: %7.2f frames/s (%.2fx)\n", SCR_WIDTH, SCR_HEIGHT,
+                shadowRays ? "shadow rays" : "shadow map", threads, fps, fps / baseline);
+        delete pool;
+        if (threads == maxThreads)
+            break;
+    }
+
+    // shadow map error against the exact shadows, over the pixels both cover
+    ThreadPool pool;
+    CpuRenderer::Lighting other = lighting;
+    other.rayTraced = !shadowRays;
+    CpuRenderer reference(SCR_WIDTH, SCR_HEIGHT, SHADOW_SIZE);
+    reference.render(sceneObjects, viewProjection, other, &pool);
+    const std::vector<float>& ours = renderer.shadowTerms();
+    const std::vector<float>& theirs = reference.shadowTerms();
+    int covered = 0, wrong = 0;
+    double error = 0.0;
+    for (int i = 0; i < (int)ours.size(); i++) {
+        if (ours[i] < 0.0f || theirs[i] < 0.0f)
+            continue;
+        covered++;
+        error += std::abs(ours[i] - theirs[i]);
+        if (std::abs(ours[i] - theirs[i]) >= 0.5f)
+            wrong++;
+    }
+    fprintf(stderr, "shadow map vs shadow rays: mean error %.4f, %d of %d pixels flipped\n",
+            covered ? error / covered : 0.0, wrong, covered);
+
+    bool written = renderer.writePPM(output);
+    if (written)
+        fprintf(stderr, "wrote %s\n", output);
+    else
+        fprintf(stderr, "failed to write %s\n", output);
+    for (Model* model : models)
+        delete model;
+    return written ? 0 : 1;
+}
+
+// --bake-lightmaps: bakes the static receivers for the start light position without a window,
+// the next run loads the result instead of baking at startup
+int bakeLightmaps() {
+    std::vector<Model*> models;
+    TransformSystem transforms;
+    std::vector<SceneObject> sceneObjects;
+    if (!loadScene(models, transforms, sceneObjects))
+        return 1;
+    ThreadPool pool;
+    LightmapBaker baker(LIGHTMAP_SIZE, LIGHTMAP_TEXELS_PER_UNIT, LIGHTMAP_SAMPLES);
+    baker.layout(sceneObjects, scenePath);
+    baker.bake(sceneObjects, lightPos, lightSize, &pool);
+    fprintf(stderr, "baked lightmaps in %.1f ms on %d threads\n", baker.bakeMilliseconds(), pool.threadCount());
+    bool written = baker.write(LIGHTMAP_PATH);
+    fprintf(stderr, written ? "wrote %s\n" : "failed to write %s\n", LIGHTMAP_PATH);
+    for (Model* model : models)
+        delete model;
+    return written ? 0 : 1;
+}
+
+// --convert-scene <output>: writes the --scene file in the other form, binary for a text scene and
+// text for a binary one
+int convertScene(int argc, char** argv) {
+    const char* output = nullptr;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--convert-scene")
+            output = argv[i + 1];
+    }
+    SceneLoader loader;
+    if (!output || !loader.open(scenePath)) {
+        fprintf(stderr, "usage: main --scene <input> --convert-scene <output>\n");
+        return 1;
+    }
+    std::vector<SceneRecord> records;
+    auto start = std::chrono::steady_clock::now();
+    loader.wait(records);
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    FILE* file = fopen(scenePath, "rb");
+    char magic[4] = {};
+    bool binary = file && fread(magic, 1, 4, file) == 4 && memcmp(magic, SCENE_BINARY_MAGIC, 4) == 0;
+    if (file)
+        fclose(file);
+    bool written = binary ? writeSceneText(output, loader.header(), records) : writeSceneBinary(output, loader.header(), records);
+    fprintf(stderr, "read %d objects in %.1f ms, %s %s\n", (int)records.size(), 1000.0f * seconds,
+            written ? "wrote" : "failed to write", output);
+    return written ? 0 : 1;
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "frustum.h"
+#include "threadPool.h"
+
+// Low resolution software depth buffer for culling on the CPU, after masked occlusion culling
+// (Andersson et al. 2015). The screen is split into 32x8 pixel tiles, and instead of per-pixel
+// depth every tile keeps a 256 bit coverage mask and two depths: the farthest depth of the whole
+// tile and the farthest depth of the pixels in the mask. One scanline of a tile is a 32 bit word,
+// so with AVX2 a triangle's coverage of a whole tile comes out of a few vector shifts.
+// Designated occluders are rasterized in bands of tile rows on a thread pool, then object bounds
+// are tested against it before anything is submitted to GL.
+class MaskedOcclusion {
+public:
+    static const int TILE_WIDTH = 32;
+    static const int TILE_HEIGHT = 8;
+
+    // the size is rounded up to whole tiles
+    MaskedOcclusion(int width, int height);
+
+    // clears to the far plane and sets the view for the occluders and tests that follow
+    void begin(const glm::mat4& viewProjection, bool reversedZ);
+    // queues a triangle list in object space
+    void addOccluder(const std::vector<glm::vec3>& vertices, const glm::mat4& model);
+    // rasterizes the queued occluders, pool may be null
+    void rasterize(ThreadPool* pool);
+    // false when the box is hidden behind the occluders or off screen
+    bool testBounds(const Bounds& bounds) const;
+
+    int width() const { return _tilesX * TILE_WIDTH; }
+    int height() const { return _tilesY * TILE_HEIGHT; }
+    int triangleCount() const { return (int)_triangles.size(); }
+
+private:
+    struct Tile {
+        uint32_t mask[TILE_HEIGHT];     // bit x of word y covers pixel (x, y) of the tile
+        float zMax0;                    // bounds every pixel of the tile
+        float zMax1;                    // bounds the pixels in the mask
+    };
+    // screen space, x/y in pixels and depth growing away from the eye whichever convention the view uses
+    struct Triangle {
+        glm::vec3 v[3];
+        glm::ivec2 tileMin;
+        glm::ivec2 tileMax;
+    };
+
+    void addTriangle(glm::vec4 a, glm::vec4 b, glm::vec4 c);
+    glm::vec3 toScreen(const glm::vec4& clip) const;
+    void rasterizeTriangle(const Triangle& triangle, int tileRowBegin, int tileRowEnd);
+    // bits of the pixels of tile (tx, ty) whose centers lie inside the triangle, one word per row
+    void coverage(const Triangle& triangle, int tx, int ty, uint32_t rows[TILE_HEIGHT]) const;
+    static void updateTile(Tile& tile, const uint32_t rows[TILE_HEIGHT], float zTriangle);
+
+    int _tilesX;
+    int _tilesY;
+    std::vector<Tile> _tiles;
+    std::vector<Triangle> _triangles;
+    glm::mat4 _viewProjection{1.0f};
+    bool _reversedZ = false;
+};
+
+MaskedOcclusion::MaskedOcclusion(int width, int height) {
+    _tilesX = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+    _tilesY = (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    _tiles.resize(_tilesX * _tilesY);
+}
+
+void MaskedOcclusion::begin(const glm::mat4& viewProjection, bool reversedZ) {
+    _viewProjection = viewProjection;
+    _reversedZ = reversedZ;
+    _triangles.clear();
+    for (Tile& tile : _tiles) {
+        std::fill(tile.mask, tile.mask + TILE_HEIGHT, 0u);
+        tile.zMax0 = std::numeric_limits<float>::max();
+        tile.zMax1 = -std::numeric_limits<float>::max();
+    }
+}
+
+glm::vec3 MaskedOcclusion::toScreen(const glm::vec4& clip) const {
+    glm::vec3 ndc = glm::vec3(clip) / clip.w;
+    float depth = _reversedZ ? 1.0f - ndc.z : ndc.z * 0.5f + 0.5f;
+    return glm::vec3((ndc.x * 0.5f + 0.5f) * width(), (ndc.y * 0.5f + 0.5f) * height(), depth);
+}
+
+void MaskedOcclusion::addOccluder(const std::vector<glm::vec3>& vertices, const glm::mat4& model) {
+    glm::mat4 toClip = _viewProjection * model;
+    for (int i = 0; i + 2 < (int)vertices.size(); i += 3) {
+        glm::vec4 clip[3];
+        for (int j = 0; j < 3; j++) {
+            clip[j] = toClip * glm::vec4(vertices[i + j], 1.0f);
+        }
+
+        // clip against the camera plane, a triangle crossing it turns into one or two
+        const float minW = 1e-4f;
+        glm::vec4 polygon[4];
+        int count = 0;
+        for (int j = 0; j < 3; j++) {
+            const glm::vec4& p = clip[j];
+            const glm::vec4& q = clip[(j + 1) % 3];
+            if (p.w >= minW) {
+                polygon[count++] = p;
+            }
+            if ((p.w >= minW) != (q.w >= minW)) {
+                polygon[count++] = p + (q - p) * ((minW - p.w) / (q.w - p.w));
+            }
+        }
+        for (int j = 1; j + 1 < count; j++) {
+            addTriangle(polygon[0], polygon[j], polygon[j + 1]);
+        }
+    }
+}
+
+void MaskedOcclusion::addTriangle(glm::vec4 a, glm::vec4 b, glm::vec4 c) {
+    Triangle triangle;
+    triangle.v[0] = toScreen(a);
+    triangle.v[1] = toScreen(b);
+    triangle.v[2] = toScreen(c);
+    // counter-clockwise, both windings are occluders
+    glm::vec2 e0 = glm::vec2(triangle.v[1] - triangle.v[0]);
+    glm::vec2 e1 = glm::vec2(triangle.v[2] - triangle.v[0]);
+    float area = e0.x * e1.y - e0.y * e1.x;
+    if (area == 0.0f) {
+        return;
+    }
+    if (area < 0.0f) {
+        std::swap(triangle.v[1], triangle.v[2]);
+    }
+
+    glm::vec2 lo = glm::min(glm::vec2(triangle.v[0]), glm::min(glm::vec2(triangle.v[1]), glm::vec2(triangle.v[2])));
+    glm::vec2 hi = glm::max(glm::vec2(triangle.v[0]), glm::max(glm::vec2(triangle.v[1]), glm::vec2(triangle.v[2])));
+    triangle.tileMin = glm::ivec2(std::max((int)std::floor(lo.x / TILE_WIDTH), 0), std::max((int)std::floor(lo.y / TILE_HEIGHT), 0));
+    triangle.tileMax = glm::ivec2(std::min((int)std::floor(hi.x / TILE_WIDTH), _tilesX - 1), std::min((int)std::floor(hi.y / TILE_HEIGHT), _tilesY - 1));
+    if (triangle.tileMin.x > triangle.tileMax.x || triangle.tileMin.y > triangle.tileMax.y) {
+        return;
+    }
+    _triangles.push_back(triangle);
+}
+
+void MaskedOcclusion::coverage(const Triangle& triangle, int tx, int ty, uint32_t rows[TILE_HEIGHT]) const {
+    // each row's covered span is the intersection of the three edges' half-planes. Going
+    // counter-clockwise, an edge heading up bounds the span on the right, one heading down on the left
+    float tileX = (float)(tx * TILE_WIDTH);
+    float rowY = (float)(ty * TILE_HEIGHT) + 0.5f;
+#ifdef __AVX2__
+    __m256 y = _mm256_add_ps(_mm256_set1_ps(rowY), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256 left = _mm256_set1_ps(-std::numeric_limits<float>::max());
+    __m256 right = _mm256_set1_ps(std::numeric_limits<float>::max());
+    __m256 empty = _mm256_setzero_ps();
+    for (int e = 0; e < 3; e++) {
+        const glm::vec3& a = triangle.v[e];
+        const glm::vec3& b = triangle.v[(e + 1) % 3];
+        float dy = b.y - a.y;
+        if (dy == 0.0f) {
+            // horizontal: the inside is above when heading +x
+            __m256 edgeY = _mm256_set1_ps(a.y);
+            __m256 outside = b.x > a.x ? _mm256_cmp_ps(y, edgeY, _CMP_LT_OQ) : _mm256_cmp_ps(y, edgeY, _CMP_GT_OQ);
+            empty = _mm256_or_ps(empty, outside);
+            continue;
+        }
+        __m256 x = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(y, _mm256_set1_ps(a.y)), _mm256_set1_ps((b.x - a.x) / dy)), _mm256_set1_ps(a.x));
+        if (dy > 0.0f) {
+            right = _mm256_min_ps(right, x);
+        } else {
+            left = _mm256_max_ps(left, x);
+        }
+    }
+    // pixel centers: the span covers pixels ceil(left - 0.5) up to ceil(right - 0.5), exclusive.
+    // Clamped to the tile before the conversion, so spans far off screen can't overflow
+    __m256 tileLo = _mm256_set1_ps(tileX);
+    __m256 tileHi = _mm256_set1_ps(tileX + TILE_WIDTH);
+    __m256 halfPixel = _mm256_set1_ps(0.5f);
+    __m256 startX = _mm256_min_ps(_mm256_max_ps(_mm256_ceil_ps(_mm256_sub_ps(left, halfPixel)), tileLo), tileHi);
+    __m256 endX = _mm256_min_ps(_mm256_max_ps(_mm256_ceil_ps(_mm256_sub_ps(right, halfPixel)), tileLo), tileHi);
+    __m256i start = _mm256_cvtps_epi32(_mm256_sub_ps(startX, tileLo));
+    __m256i end = _mm256_cvtps_epi32(_mm256_sub_ps(endX, tileLo));
+    // bits [start, end); variable shifts of 32 or more give zero
+    __m256i ones = _mm256_set1_epi32(-1);
+    __m256i mask = _mm256_andnot_si256(_mm256_sllv_epi32(ones, end), _mm256_sllv_epi32(ones, start));
+    mask = _mm256_andnot_si256(_mm256_castps_si256(empty), mask);
+    _mm256_storeu_si256((__m256i*)rows, mask);
+#else
+    for (int r = 0; r < TILE_HEIGHT; r++) {
+        float y = rowY + r;
+        float left = -std::numeric_limits<float>::max();
+        float right = std::numeric_limits<float>::max();
+        bool empty = false;
+        for (int e = 0; e < 3; e++) {
+            const glm::vec3& a = triangle.v[e];
+            const glm::vec3& b = triangle.v[(e + 1) % 3];
+            float dy = b.y - a.y;
+            if (dy == 0.0f) {
+                empty |= b.x > a.x ? y < a.y : y > a.y;
+                continue;
+            }
+            float x = a.x + (y - a.y) * (b.x - a.x) / dy;
+            if (dy > 0.0f) {
+                right = std::min(right, x);
+            } else {
+                left = std::max(left, x);
+            }
+        }
+        int start = (int)(std::min(std::max(std::ceil(left - 0.5f), tileX), tileX + TILE_WIDTH) - tileX);
+        int end = (int)(std::min(std::max(std::ceil(right - 0.5f), tileX), tileX + TILE_WIDTH) - tileX);
+        uint32_t below = end >= TILE_WIDTH ? ~0u : (1u << end) - 1u;
+        uint32_t first = start >= TILE_WIDTH ? 0u : ~0u << start;
+        rows[r] = empty ? 0u : below & first;
+    }
+#endif
+}
+
+void MaskedOcclusion::updateTile(Tile& tile, const uint32_t rows[TILE_HEIGHT], float zTriangle) {
+    // the covered pixels can't be farther than what the tile already guarantees
+    zTriangle = std::min(zTriangle, tile.zMax0);
+    // a triangle much nearer than the working layer starts a new one, merging would
+    // throw away most of what the triangle is worth
+    if (tile.zMax1 - zTriangle > tile.zMax0 - tile.zMax1) {
+        std::fill(tile.mask, tile.mask + TILE_HEIGHT, 0u);
+        tile.zMax1 = -std::numeric_limits<float>::max();
+    }
+    tile.zMax1 = std::max(tile.zMax1, zTriangle);
+    bool full = true;
+    for (int r = 0; r < TILE_HEIGHT; r++) {
+        tile.mask[r] |= rows[r];
+        full &= tile.mask[r] == ~0u;
+    }
+    // a fully covered working layer becomes the tile's depth
+    if (full) {
+        tile.zMax0 = tile.zMax1;
+        std::fill(tile.mask, tile.mask + TILE_HEIGHT, 0u);
+        tile.zMax1 = -std::numeric_limits<float>::max();
+    }
+}
+
+void MaskedOcclusion::rasterizeTriangle(const Triangle& triangle, int tileRowBegin, int tileRowEnd) {
+    // depth plane through the vertices, its farthest value over a tile bounds the triangle there
+    const glm::vec3& a = triangle.v[0];
+    glm::vec3 e0 = triangle.v[1] - a;
+    glm::vec3 e1 = triangle.v[2] - a;
+    float area = e0.x * e1.y - e0.y * e1.x;
+    float dzdx = (e0.z * e1.y - e1.z * e0.y) / area;
+    float dzdy = (e1.z * e0.x - e0.z * e1.x) / area;
+    float zFarthest = std::max(a.z, std::max(triangle.v[1].z, triangle.v[2].z));
+
+    int rowBegin = std::max(triangle.tileMin.y, tileRowBegin);
+    int rowEnd = std::min(triangle.tileMax.y + 1, tileRowEnd);
+    for (int ty = rowBegin; ty < rowEnd; ty++) {
+        for (int tx = triangle.tileMin.x; tx <= triangle.tileMax.x; tx++) {
+            uint32_t rows[TILE_HEIGHT];
+            coverage(triangle, tx, ty, rows);
+            uint32_t any = 0;
+            for (int r = 0; r < TILE_HEIGHT; r++) {
+                any |= rows[r];
+            }
+            if (!any) {
+                continue;
+            }
+            float x = (float)(tx * TILE_WIDTH) + (dzdx > 0.0f ? TILE_WIDTH : 0.0f);
+            float y = (float)(ty * TILE_HEIGHT) + (dzdy > 0.0f ? TILE_HEIGHT : 0.0f);
+            float z = std::min(a.z + dzdx * (x - a.x) + dzdy * (y - a.y), zFarthest);
+            updateTile(_tiles[ty * _tilesX + tx], rows, z);
+        }
+    }
+}
+
+void MaskedOcclusion::rasterize(ThreadPool* pool) {
+    // every band owns its tiles, so the threads never touch the same one
+    int bands = pool ? std::min(pool->threadCount() * 2, _tilesY) : 1;
+    auto band = [&](int i) {
+        int begin = _tilesY * i / bands;
+        int end = _tilesY * (i + 1) / bands;
+        for (const Triangle& triangle : _triangles) {
+            if (triangle.tileMax.y >= begin && triangle.tileMin.y < end) {
+                rasterizeTriangle(triangle, begin, end);
+            }
+        }
+    };
+    if (pool) {
+        pool->parallelFor(bands, band);
+    } else {
+        band(0);
+    }
+}
+
+bool MaskedOcclusion::testBounds(const Bounds& bounds) const {
+    glm::vec2 lo(std::numeric_limits<float>::max());
+    glm::vec2 hi(-std::numeric_limits<float>::max());
+    float nearest = std::numeric_limits<float>::max();
+    for (int i = 0; i < 8; i++) {
+        glm::vec4 clip = _viewProjection * glm::vec4((i & 1) ? bounds.max.x : bounds.min.x,
+                                                     (i & 2) ? bounds.max.y : bounds.min.y,
+                                                     (i & 4) ? bounds.max.z : bounds.min.z, 1.0f);
+        // reaches behind the eye, no screen bounds
+        if (clip.w <= 1e-4f) {
+            return true;
+        }
+        glm::vec3 p = toScreen(clip);
+        lo = glm::min(lo, glm::vec2(p));
+        hi = glm::max(hi, glm::vec2(p));
+        nearest = std::min(nearest, p.z);
+    }
+
+    // pixels whose centers the rectangle covers
+    int x0 = std::max((int)std::ceil(lo.x - 0.5f), 0);
+    int y0 = std::max((int)std::ceil(lo.y - 0.5f), 0);
+    int x1 = std::min((int)std::ceil(hi.x - 0.5f), width());
+    int y1 = std::min((int)std::ceil(hi.y - 0.5f), height());
+    if (x0 >= x1 || y0 >= y1) {
+        // smaller than a pixel counts as visible as long as it's on screen
+        return hi.x >= 0.0f && hi.y >= 0.0f && lo.x <= width() && lo.y <= height();
+    }
+
+    for (int ty = y0 / TILE_HEIGHT; ty <= (y1 - 1) / TILE_HEIGHT; ty++) {
+        for (int tx = x0 / TILE_WIDTH; tx <= (x1 - 1) / TILE_WIDTH; tx++) {
+            const Tile& tile = _tiles[ty * _tilesX + tx];
+            if (nearest > tile.zMax0) {
+                continue;
+            }
+            // the part of the rectangle in this tile has to lie in the working layer's mask
+            int start = std::max(x0 - tx * TILE_WIDTH, 0);
+            int end = std::min(x1 - tx * TILE_WIDTH, TILE_WIDTH);
+            uint32_t span = (end >= TILE_WIDTH ? ~0u : (1u << end) - 1u) & (~0u << start);
+            bool inMask = true;
+            for (int r = std::max(y0 - ty * TILE_HEIGHT, 0); r < std::min(y1 - ty * TILE_HEIGHT, TILE_HEIGHT); r++) {
+                inMask &= (span & ~tile.mask[r]) == 0u;
+            }
+            if (!(inMask && nearest > tile.zMax1)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
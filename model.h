@@ -6,25 +6,52 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cmath>
+
 class Model {
 public:
     Model(const char* path) {
         loadObj(path, _vertices, _normals, _texcoords);
+        computeBounds();
+        generateLightmapTexcoords();
     }
 
     void setupBuffers();
     void draw();
+    // draws with a DrawArraysIndirectCommand from the bound GL_DRAW_INDIRECT_BUFFER
+    void drawIndirect(GLintptr offset);
+    unsigned int vertexCount() const { return (unsigned int)_vertices.size(); }
+    // what a recorded draw refers to the mesh by
+    GLuint vao() const { return _vao; }
+    // object-space triangle list, for CPU-side rasterization
+    const std::vector<glm::vec3>& vertices() const { return _vertices; }
+    // object-space normal of every vertex
+    const std::vector<glm::vec3>& normals() const { return _normals; }
+    // non-overlapping [0, 1] texcoords of every vertex, for baked lighting
+    const std::vector<glm::vec2>& lightmapTexcoords() const { return _lightmapTexcoords; }
     void deleteGLResources();
 
+    // object-space axis aligned bounding box
+    const glm::vec3& boundsMin() const { return _boundsMin; }
+    const glm::vec3& boundsMax() const { return _boundsMax; }
+
 private:
+    void computeBounds();
+    void generateLightmapTexcoords();
+
     std::vector<glm::vec3> _vertices;
     std::vector<glm::vec2> _texcoords;
+    std::vector<glm::vec2> _lightmapTexcoords;
     std::vector<glm::vec3> _normals;
+    glm::vec3 _boundsMin{0.0f};
+    glm::vec3 _boundsMax{0.0f};
 
     GLuint _vao;
     GLuint _vertexBuffer;
     GLuint _texcoordBuffer;
     GLuint _normalBuffer;
+    GLuint _lightmapTexcoordBuffer;
 };
 
 void Model::setupBuffers() {
@@ -49,15 +76,50 @@ void Model::setupBuffers() {
     glGenBuffers(1, &_texcoordBuffer);
     glBindBuffer(GL_ARRAY_BUFFER, _texcoordBuffer);
     glBufferData(GL_ARRAY_BUFFER, _texcoords.size() * sizeof(_texcoords.at(0)), _texcoords.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(1, 2, GL_FLOAT, false, sizeof(glm::vec2), (void *) 0);
+    glVertexAttribPointer(2, 2, GL_FLOAT, false, sizeof(glm::vec2), (void *) 0);
     glEnableVertexAttribArray(2);
 
+    // lightmap texcoord buffer
+    glGenBuffers(1, &_lightmapTexcoordBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _lightmapTexcoordBuffer);
+    glBufferData(GL_ARRAY_BUFFER, _lightmapTexcoords.size() * sizeof(_lightmapTexcoords.at(0)), _lightmapTexcoords.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(3, 2, GL_FLOAT, false, sizeof(glm::vec2), (void *) 0);
+    glEnableVertexAttribArray(3);
+
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 }
 
+void Model::computeBounds() {
+    if (_vertices.empty()) {
+        return;
+    }
+    _boundsMin = _vertices[0];
+    _boundsMax = _vertices[0];
+    for (const glm::vec3& v : _vertices) {
+        _boundsMin = glm::min(_boundsMin, v);
+        _boundsMax = glm::max(_boundsMax, v);
+    }
+}
+
+void Model::generateLightmapTexcoords() {
+    // every triangle gets its own cell of a square grid, as the lower left half of the cell.
+    // The inset leaves a gutter the baker fills, so filtering never reads a neighbouring triangle
+    const float inset = 0.1f;
+    int triangles = (int)_vertices.size() / 3;
+    int grid = std::max((int)std::ceil(std::sqrt((float)triangles)), 1);
+    _lightmapTexcoords.resize(_vertices.size());
+    for (int i = 0; i < (int)_vertices.size(); i++) {
+        int triangle = i / 3;
+        glm::vec2 cell((float)(triangle % grid), (float)(triangle / grid));
+        glm::vec2 corner(i % 3 == 1 ? 1.0f - inset : inset, i % 3 == 2 ? 1.0f - inset : inset);
+        _lightmapTexcoords[i] = (cell + corner) / (float)grid;
+    }
+}
+
 void Model::deleteGLResources() {
     glDeleteBuffers(1, &_vertexBuffer);
+    glDeleteBuffers(1, &_lightmapTexcoordBuffer);
     glDeleteBuffers(1, &_texcoordBuffer);
     glDeleteBuffers(1, &_normalBuffer);
     glDeleteVertexArrays(1, &_vao);
@@ -66,4 +128,9 @@ void Model::deleteGLResources() {
 void Model::draw() {
     glBindVertexArray(_vao);
     glDrawArrays(GL_TRIANGLES, 0, _vertices.size());
-}
\ No newline at end of file
+}
+
+void Model::drawIndirect(GLintptr offset) {
+    glBindVertexArray(_vao);
+    glDrawArraysIndirect(GL_TRIANGLES, (const void*)offset);
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "shader.h"
+#include "scene.h"
+
+// Coherent hierarchical culling with hardware occlusion queries (CHC++ style), for contexts
+// without compute shaders. Results are only read once available, so they arrive a frame late and
+// never stall. Objects visible last frame are drawn right away and only re-queried every few
+// frames, on their own geometry. Hidden objects are tested every frame by drawing their bounds
+// after the visible ones filled the depth, and are themselves drawn under conditional rendering
+// on that query, so an object that shows up again is never missing for a frame.
+class OcclusionQueries {
+public:
+    OcclusionQueries(int requeryInterval);
+
+    // depth pass: draws the visible objects, then queries and conditionally draws the hidden ones.
+    // The shader is in use with its view and projection set. Objects keep their state by index and
+    // are only ever appended, the new ones start out visible
+    void drawPrepass(const std::vector<SceneObject>& objects, Shader* shader,
+                     const glm::mat4& viewProjection, const glm::vec3& eye);
+    // the same set again with another shader, the hidden objects conditional on the prepass queries
+    void draw(Shader* shader);
+    int visibleCount() const;
+    int objectCount() const { return (int)_states.size(); }
+    void deleteGLResources();
+
+private:
+    struct ObjectState {
+        GLuint query;
+        bool pending;       // a query was issued and its result not read yet
+        bool visible;
+        bool conditional;   // drawn under conditional rendering this frame
+    };
+
+    void collect();
+    void drawObject(Shader* shader, int i);
+
+    int _requeryInterval;
+    int _frame = 0;
+    GLenum _queryTarget;
+    // the scene's object list itself, which stays put while its elements move when it grows
+    const std::vector<SceneObject>* _objects = nullptr;
+    std::vector<ObjectState> _states;
+    GLuint _cubeVAO;
+    GLuint _cubeBuffer;
+    Shader* _boundsShader;
+};
+
+OcclusionQueries::OcclusionQueries(int requeryInterval) : _requeryInterval(requeryInterval) {
+    // the conservative variant lets the hardware answer early, it needs GL 4.3
+    _queryTarget = GLAD_GL_VERSION_4_3 ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE : GL_ANY_SAMPLES_PASSED;
+
+    // unit cube as 12 triangles, stretched over the bounds in the vertex shader
+    std::vector<glm::vec3> vertices;
+    const int faces[6][4] = { {0, 2, 6, 4}, {1, 5, 7, 3}, {0, 4, 5, 1}, {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 6, 7, 5} };
+    for (const auto& face : faces) {
+        const int corners[6] = { face[0], face[1], face[2], face[0], face[2], face[3] };
+        for (int corner : corners) {
+            vertices.push_back(glm::vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1));
+        }
+    }
+    glGenVertexArrays(1, &_cubeVAO);
+    glBindVertexArray(_cubeVAO);
+    glGenBuffers(1, &_cubeBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _cubeBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, false, sizeof(glm::vec3), (void *) 0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    _boundsShader = new Shader("shaders/boundsQuery.vert", "shaders/simpleDepth.frag");
+}
+
+void OcclusionQueries::collect() {
+    for (ObjectState& state : _states) {
+        if (!state.pending) {
+            continue;
+        }
+        GLuint available = 0;
+        glGetQueryObjectuiv(state.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            continue;
+        }
+        GLuint samplesPassed = 0;
+        glGetQueryObjectuiv(state.query, GL_QUERY_RESULT, &samplesPassed);
+        state.visible = samplesPassed != 0;
+        state.pending = false;
+    }
+}
+
+void OcclusionQueries::drawObject(Shader* shader, int i) {
+    const SceneObject& object = (*_objects)[i];
+    shader->setMat4("model", object.modelMatrix());
+    shader->setMat3("normalMatrix", object.normalMatrix());
+    shader->setVec4("lightmapRect", object.lightmapRect);
+    object.model->draw();
+}
+
+void OcclusionQueries::drawPrepass(const std::vector<SceneObject>& objects, Shader* shader,
+                                   const glm::mat4& viewProjection, const glm::vec3& eye) {
+    _objects = &objects;
+    int known = (int)_states.size();
+    if ((int)objects.size() > known) {
+        // only the appended objects need queries, the others keep theirs and what they learned
+        std::vector<GLuint> queries(objects.size() - known);
+        glGenQueries((GLsizei)queries.size(), queries.data());
+        _states.resize(objects.size());
+        for (int i = known; i < (int)_states.size(); i++) {
+            _states[i] = { queries[i - known], false, true, false };
+        }
+    }
+    collect();
+    _frame++;
+
+    // visible objects fill the depth, a staggered few of them are re-queried on their own geometry
+    for (int i = 0; i < (int)_states.size(); i++) {
+        ObjectState& state = _states[i];
+        state.conditional = false;
+        if (!state.visible) {
+            continue;
+        }
+        bool requery = !state.pending && (_frame + i) % _requeryInterval == 0;
+        if (requery) {
+            glBeginQuery(_queryTarget, state.query);
+        }
+        drawObject(shader, i);
+        if (requery) {
+            glEndQuery(_queryTarget);
+            state.pending = true;
+        }
+    }
+
+    // bounds of the hidden objects, batched so the shader only switches once
+    _boundsShader->use();
+    _boundsShader->setMat4("viewProjection", viewProjection);
+    glBindVertexArray(_cubeVAO);
+    glDepthMask(GL_FALSE);
+    std::vector<int> around;
+    for (int i = 0; i < (int)_states.size(); i++) {
+        ObjectState& state = _states[i];
+        if (state.visible) {
+            continue;
+        }
+        Bounds bounds = (*_objects)[i].worldBounds();
+        // the near plane would clip a box around the eye, it can't be tested
+        glm::vec3 outside = glm::max(bounds.min - eye, eye - bounds.max);
+        if (std::max(outside.x, std::max(outside.y, outside.z)) <= 0.5f) {
+            state.visible = true;
+            around.push_back(i);
+            continue;
+        }
+        state.conditional = true;
+        // a query still in flight from last frame is reused for the conditional draw
+        if (state.pending) {
+            continue;
+        }
+        _boundsShader->setVec3("boundsMin", bounds.min);
+        _boundsShader->setVec3("boundsMax", bounds.max);
+        glBeginQuery(_queryTarget, state.query);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glEndQuery(_queryTarget);
+        state.pending = true;
+    }
+    glDepthMask(GL_TRUE);
+    glBindVertexArray(0);
+
+    // hidden objects whose bounds passed are drawn without waiting for the CPU
+    shader->use();
+    for (int i : around) {
+        drawObject(shader, i);
+    }
+    for (int i = 0; i < (int)_states.size(); i++) {
+        if (!_states[i].conditional) {
+            continue;
+        }
+        glBeginConditionalRender(_states[i].query, GL_QUERY_NO_WAIT);
+        drawObject(shader, i);
+        glEndConditionalRender();
+    }
+}
+
+void OcclusionQueries::draw(Shader* shader) {
+    for (int i = 0; i < (int)_states.size(); i++) {
+        const ObjectState& state = _states[i];
+        if (state.conditional) {
+            glBeginConditionalRender(state.query, GL_QUERY_NO_WAIT);
+            drawObject(shader, i);
+            glEndConditionalRender();
+        } else if (state.visible) {
+            drawObject(shader, i);
+        }
+    }
+}
+
+int OcclusionQueries::visibleCount() const {
+    int count = 0;
+    for (const ObjectState& state : _states) {
+        count += state.visible ? 1 : 0;
+    }
+    return count;
+}
+
+void OcclusionQueries::deleteGLResources() {
+    for (ObjectState& state : _states) {
+        glDeleteQueries(1, &state.query);
+    }
+    glDeleteVertexArrays(1, &_cubeVAO);
+    glDeleteBuffers(1, &_cubeBuffer);
+    delete _boundsShader;
+}
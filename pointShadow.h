@@ -0,0 +1,198 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+
+#include "shader.h"
+#include "model.h"
+
+// Omnidirectional shadow map for a point light, rendered in a single pass. A geometry shader
+// routes every caster triangle to the cube faces (or the two paraboloid hemispheres) its bounds
+// touch, so each caster is submitted once and faces without casters only pay for the clear.
+class PointShadowMap {
+public:
+    enum Mode {
+        CUBE,
+        DUAL_PARABOLOID
+    };
+
+    PointShadowMap(unsigned int size);
+
+    // binds the layered framebuffer and clears every face
+    void begin(Mode mode, const glm::vec3& lightPos, float farPlane);
+    // bit i is set when the world-space box overlaps face (or hemisphere) i, 0 when it can be skipped
+    unsigned int faceMask(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const;
+    void drawCaster(Model* model, const glm::mat4& modelMat, unsigned int mask);
+    void end();
+
+    GLuint cubeTexture() const { return _cubeTexture; }
+    GLuint paraboloidTexture() const { return _paraboloidTexture; }
+    const glm::mat4& paraboloidView(int hemisphere) const { return _paraboloidViews[hemisphere]; }
+    float farPlane() const { return _farPlane; }
+    // number of faces that received at least one caster during the last pass
+    int facesRendered() const;
+    void deleteGLResources();
+
+private:
+    unsigned int _size;
+    Mode _mode = CUBE;
+    glm::vec3 _lightPos{0.0f};
+    float _farPlane = 25.0f;
+    unsigned int _usedFaces = 0;
+    glm::mat4 _paraboloidViews[2];
+
+    GLuint _cubeTexture;
+    GLuint _paraboloidTexture;
+    GLuint _cubeFBO;
+    GLuint _paraboloidFBO;
+    Shader* _shader;
+};
+
+PointShadowMap::PointShadowMap(unsigned int size) : _size(size) {
+    _paraboloidViews[0] = glm::mat4(1.0f);
+    _paraboloidViews[1] = glm::mat4(1.0f);
+
+    glGenTextures(1, &_cubeTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, _cubeTexture);
+    for (unsigned int i = 0; i < 6; i++) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT32F, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    glGenTextures(1, &_paraboloidTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _paraboloidTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, size, size, 2, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+
+    // layered attachments, the geometry shader picks the face with gl_Layer
+    glGenFramebuffers(1, &_cubeFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, _cubeFBO);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _cubeTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+
+    glGenFramebuffers(1, &_paraboloidFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, _paraboloidFBO);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _paraboloidTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    _shader = new Shader("shaders/pointShadow.vert", "shaders/pointShadow.frag", "shaders/pointShadow.geom");
+}
+
+void PointShadowMap::begin(Mode mode, const glm::vec3& lightPos, float farPlane) {
+    _mode = mode;
+    _lightPos = lightPos;
+    _farPlane = farPlane;
+    _usedFaces = 0;
+
+    _shader->use();
+    _shader->setInt("projectionMode", mode == CUBE ? 0 : 1);
+    _shader->setVec3("lightPos", lightPos);
+    _shader->setFloat("farPlane", farPlane);
+
+    if (mode == CUBE) {
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, farPlane);
+        glm::mat4 faceMatrices[6] = {
+            projection * glm::lookAt(lightPos, lightPos + glm::vec3( 1.0,  0.0,  0.0), glm::vec3(0.0, -1.0,  0.0)),
+            projection * glm::lookAt(lightPos, lightPos + glm::vec3(-1.0,  0.0,  0.0), glm::vec3(0.0, -1.0,  0.0)),
+            projection * glm::lookAt(lightPos, lightPos + glm::vec3( 0.0,  1.0,  0.0), glm::vec3(0.0,  0.0,  1.0)),
+            projection * glm::lookAt(lightPos, lightPos + glm::vec3( 0.0, -1.0,  0.0), glm::vec3(0.0,  0.0, -1.0)),
+            projection * glm::lookAt(lightPos, lightPos + glm::vec3( 0.0,  0.0,  1.0), glm::vec3(0.0, -1.0,  0.0)),
+            projection * glm::lookAt(lightPos, lightPos + glm::vec3( 0.0,  0.0, -1.0), glm::vec3(0.0, -1.0,  0.0))
+        };
+        for (int i = 0; i < 6; i++) {
+            _shader->setMat4("faceMatrices[" + std::to_string(i) + "]", faceMatrices[i]);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, _cubeFBO);
+    } else {
+        // hemisphere 0 looks down, hemisphere 1 looks up
+        _paraboloidViews[0] = glm::lookAt(lightPos, lightPos + glm::vec3(0.0, -1.0, 0.0), glm::vec3(0.0, 0.0, -1.0));
+        _paraboloidViews[1] = glm::lookAt(lightPos, lightPos + glm::vec3(0.0,  1.0, 0.0), glm::vec3(0.0, 0.0,  1.0));
+        _shader->setMat4("paraboloidViews[0]", _paraboloidViews[0]);
+        _shader->setMat4("paraboloidViews[1]", _paraboloidViews[1]);
+        glBindFramebuffer(GL_FRAMEBUFFER, _paraboloidFBO);
+        glEnable(GL_CLIP_DISTANCE0);
+    }
+
+    glViewport(0, 0, _size, _size);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+unsigned int PointShadowMap::faceMask(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const {
+    glm::vec3 lo = boundsMin - _lightPos;
+    glm::vec3 hi = boundsMax - _lightPos;
+
+    // casters entirely beyond the far plane are never sampled
+    glm::vec3 closest = glm::clamp(glm::vec3(0.0f), lo, hi);
+    if (glm::length(closest) > _farPlane) {
+        return 0;
+    }
+
+    if (_mode == DUAL_PARABOLOID) {
+        unsigned int mask = 0;
+        if (lo.y <= 0.0f) mask |= 1;
+        if (hi.y >= 0.0f) mask |= 2;
+        return mask;
+    }
+
+    // smallest |coordinate| the box reaches on every axis
+    glm::vec3 nearest = glm::abs(closest);
+    unsigned int mask = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        // face +axis covers the points with coord[axis] >= max(|coord[u]|, |coord[v]|)
+        if (hi[axis] >= 0.0f && hi[axis] >= nearest[u] && hi[axis] >= nearest[v]) {
+            mask |= 1u << (2 * axis);
+        }
+        if (lo[axis] <= 0.0f && -lo[axis] >= nearest[u] && -lo[axis] >= nearest[v]) {
+            mask |= 1u << (2 * axis + 1);
+        }
+    }
+    return mask;
+}
+
+void PointShadowMap::drawCaster(Model* model, const glm::mat4& modelMat, unsigned int mask) {
+    _usedFaces |= mask;
+    _shader->setInt("faceMask", mask);
+    _shader->setMat4("model", modelMat);
+    model->draw();
+}
+
+void PointShadowMap::end() {
+    glDisable(GL_CLIP_DISTANCE0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+int PointShadowMap::facesRendered() const {
+    int count = 0;
+    for (int i = 0; i < 6; i++) {
+        if (_usedFaces & (1u << i)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void PointShadowMap::deleteGLResources() {
+    glDeleteTextures(1, &_cubeTexture);
+    glDeleteTextures(1, &_paraboloidTexture);
+    glDeleteFramebuffers(1, &_cubeFBO);
+    glDeleteFramebuffers(1, &_paraboloidFBO);
+    delete _shader;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <iostream>
+
+#include "shader.h"
+
+// Coarse mask of the shadow map regions visible receivers can sample. The tiles are marked by a
+// compute pass over the view depth buffer, then everything outside them is marked in the shadow
+// map's stencil before the casters are drawn, so the stencil test (and the hardware's hierarchical
+// stencil) rejects caster fragments nobody will ever look up. The depth there keeps its clear
+// value, so a receiver that comes into view before the next mask is built is lit rather than
+// shadowed, and nothing fake ends up in the depth pyramids built from the map. Everything stays on
+// the GPU.
+class ReceiverMask {
+public:
+    ReceiverMask(unsigned int shadowSize, int tilesPerSide);
+
+    // compute shaders and storage buffers need GL 4.3, without them nothing is masked
+    bool supported() const { return _supported; }
+    // marks the tiles the receivers in the given depth buffer fall into
+    void build(GLuint viewDepth, const glm::mat4& inverseViewProjection, bool reversedZ, const glm::mat4& lightSpaceMatrix);
+    // marks the unmasked regions in the bound shadow map's stencil and leaves the stencil test on,
+    // so the casters drawn next only reach the receiver regions. The framebuffer needs a stencil
+    void apply();
+    // turns the stencil test back off once the casters are drawn
+    void end();
+    void deleteGLResources();
+
+private:
+    bool _supported;
+    unsigned int _shadowSize;
+    int _tilesPerSide;
+    GLuint _tileBuffer;
+    GLuint _emptyVAO;
+    Shader* _markShader = nullptr;
+    Shader* _fillShader = nullptr;
+};
+
+ReceiverMask::ReceiverMask(unsigned int shadowSize, int tilesPerSide) : _shadowSize(shadowSize), _tilesPerSide(tilesPerSide) {
+    _supported = GLAD_GL_VERSION_4_3;
+    glGenBuffers(1, &_tileBuffer);
+    // core profile refuses to draw without a VAO bound, even for attribute-less draws
+    glGenVertexArrays(1, &_emptyVAO);
+    if (!_supported) {
+        std::cout << "Receiver masking needs OpenGL 4.3 compute shaders, disabled" << std::endl;
+        return;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _tileBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, tilesPerSide * tilesPerSide * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    _markShader = new Shader("shaders/receiverMask.comp");
+    _fillShader = new Shader("shaders/fullscreen.vert", "shaders/receiverMask.frag");
+}
+
+void ReceiverMask::build(GLuint viewDepth, const glm::mat4& inverseViewProjection, bool reversedZ, const glm::mat4& lightSpaceMatrix) {
+    if (!_supported) {
+        return;
+    }
+    GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _tileBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _tileBuffer);
+
+    _markShader->use();
+    _markShader->setMat4("inverseViewProjection", inverseViewProjection);
+    _markShader->setBool("reversedZ", reversedZ);
+    _markShader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
+    _markShader->setInt("tilesPerSide", _tilesPerSide);
+    _markShader->setInt("viewDepth", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, viewDepth);
+    GLint width, height;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void ReceiverMask::apply() {
+    if (!_supported) {
+        return;
+    }
+    glClearStencil(0);
+    glClear(GL_STENCIL_BUFFER_BIT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _tileBuffer);
+    _fillShader->use();
+    _fillShader->setInt("tilesPerSide", _tilesPerSide);
+    _fillShader->setInt("shadowSize", _shadowSize);
+    _fillShader->setInt("dilation", 2);
+    // only the stencil is written, the depth keeps its clear value
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_ALWAYS, 1, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(_emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+    glStencilFunc(GL_EQUAL, 0, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+}
+
+void ReceiverMask::end() {
+    if (!_supported) {
+        return;
+    }
+    glDisable(GL_STENCIL_TEST);
+}
+
+void ReceiverMask::deleteGLResources() {
+    glDeleteBuffers(1, &_tileBuffer);
+    glDeleteVertexArrays(1, &_emptyVAO);
+    delete _markShader;
+    delete _fillShader;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <limits>
+#include <vector>
+
+#include "model.h"
+#include "frustum.h"
+#include "transformSystem.h"
+
+// An instance of a model placed in the world.
+struct SceneObject {
+    Model* model;
+    // the system holding the object's position, rotation, scale and matrices, and its index there
+    TransformSystem* transforms;
+    int transform;
+    bool castsShadow;
+    bool receivesShadow;
+    // large enough to be worth rasterizing for the CPU occlusion culling
+    bool occluder = false;
+    // never moves, so the main light's shadows on it can be baked
+    bool isStatic = false;
+    // scale in xy and offset in zw of the object's lightmap texcoords in the atlas, zero without one
+    glm::vec4 lightmapRect{0.0f};
+
+    // as of the last TransformSystem::update()
+    const glm::mat4& modelMatrix() const {
+        return transforms->world(transform);
+    }
+    const glm::mat3& normalMatrix() const {
+        return transforms->normalMatrix(transform);
+    }
+
+    // world-space axis aligned bounding box
+    void worldBounds(glm::vec3& outMin, glm::vec3& outMax) const;
+    Bounds worldBounds() const {
+        Bounds bounds;
+        worldBounds(bounds.min, bounds.max);
+        return bounds;
+    }
+};
+
+// transforms an axis aligned box and returns the axis aligned box enclosing the result
+void transformBounds(const glm::mat4& m, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                     glm::vec3& outMin, glm::vec3& outMax) {
+    outMin = glm::vec3(std::numeric_limits<float>::max());
+    outMax = glm::vec3(-std::numeric_limits<float>::max());
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner((i & 1) ? boundsMax.x : boundsMin.x,
+                         (i & 2) ? boundsMax.y : boundsMin.y,
+                         (i & 4) ? boundsMax.z : boundsMin.z);
+        glm::vec4 p = m * glm::vec4(corner, 1.0f);
+        glm::vec3 transformed = glm::vec3(p) / p.w;
+        outMin = glm::min(outMin, transformed);
+        outMax = glm::max(outMax, transformed);
+    }
+}
+
+void SceneObject::worldBounds(glm::vec3& outMin, glm::vec3& outMax) const {
+    transformBounds(modelMatrix(), model->boundsMin(), model->boundsMax(), outMin, outMax);
+}
@@ -0,0 +1,436 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "light.h"
+
+// Scene files describe the meshes, the objects placed with them, the lights and the shadow
+// settings. The text form is for editing, one directive per line and '#' starts a comment:
+//
+//   mesh <name> <obj path>
+//   light <x y z> <target x y z> <size>
+//   spot <r g b> <range> <inner angle> <outer angle>
+//   shadow quality <name>
+//   shadow projection <name>
+//   object <mesh name> <x y z> <scale x y z> [casts] [receives] [occluder] [static]
+//
+// Every object line comes after the other directives, so the objects can be streamed. The binary
+// form holds the same data with the objects as fixed size records, --convert-scene writes it.
+
+// object flags, in the binary records and in SceneRecord
+enum SceneObjectFlags {
+    SCENE_CASTS_SHADOW = 1,
+    SCENE_RECEIVES_SHADOW = 2,
+    SCENE_OCCLUDER = 4,
+    SCENE_STATIC = 8
+};
+
+// Everything in a scene file ahead of its objects
+struct SceneHeader {
+    std::vector<std::string> meshNames;
+    std::vector<std::string> meshPaths;
+    glm::vec3 lightPosition{-2.0f, 4.0f, 0.0f};
+    glm::vec3 lightTarget{0.0f, 0.0f, -2.0f};
+    float lightSize = 0.4f;
+    // positions and directions are animated, the file only sets color, range and angles
+    std::vector<SpotLight> spotLights;
+    // names as in shadowQualityNames and shadowProjectionNames, empty keeps the default
+    std::string shadowQuality;
+    std::string shadowProjection;
+};
+
+// One object, its mesh is an index into SceneHeader's meshes
+struct SceneRecord {
+    uint32_t mesh;
+    glm::vec3 position;
+    glm::vec3 scale;
+    uint32_t flags;
+};
+
+// Reads a scene file's header right away and its objects on a background thread, so a large
+// scene can be drawn while it is still loading. Either form is detected from the first bytes.
+class SceneLoader {
+public:
+    ~SceneLoader();
+
+    // false when the file can't be opened or its header is malformed
+    bool open(const char* path);
+    const SceneHeader& header() const { return _header; }
+    // objects a binary file declares up front, 0 for a text file
+    uint32_t objectCount() const { return _binary ? _objectCount : 0; }
+    // appends the objects read since the last call, true once every object has been handed out
+    bool poll(std::vector<SceneRecord>& records);
+    // blocks until the whole file is read and returns every remaining object
+    void wait(std::vector<SceneRecord>& records);
+
+private:
+    bool readTextHeader();
+    bool readBinaryHeader();
+    void streamText();
+    void streamBinary();
+    // hands a block of objects to poll(), skipping the ones with an unknown mesh. The last one
+    // marks the stream done under the same lock, so poll() can't take it and still see more coming
+    void publish(std::vector<SceneRecord>& block, bool last = false);
+    int meshIndex(const char* name) const;
+
+    FILE* _file = nullptr;
+    std::string _path;
+    SceneHeader _header;
+    bool _binary = false;
+    // the text header has to read the first object line to find where the header ends
+    std::string _firstObjectLine;
+    uint32_t _objectCount = 0;
+
+    std::thread _thread;
+    std::mutex _mutex;
+    std::vector<SceneRecord> _pending;
+    bool _done = false;
+    bool _complete = false;
+};
+
+bool writeSceneText(const char* path, const SceneHeader& header, const std::vector<SceneRecord>& records);
+bool writeSceneBinary(const char* path, const SceneHeader& header, const std::vector<SceneRecord>& records);
+
+const char SCENE_BINARY_MAGIC[4] = { 'S', 'C', 'N', 'B' };
+const uint32_t SCENE_BINARY_VERSION = 1;
+// objects read between two hand-offs to the render thread
+const int SCENE_STREAM_BLOCK = 4096;
+
+SceneLoader::~SceneLoader() {
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+int SceneLoader::meshIndex(const char* name) const {
+    for (int i = 0; i < (int)_header.meshNames.size(); i++) {
+        if (_header.meshNames[i] == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool SceneLoader::open(const char* path) {
+    _file = fopen(path, "rb");
+    if (!_file) {
+        fprintf(stderr, "unable to open scene %s\n", path);
+        return false;
+    }
+    _path = path;
+    char magic[4];
+    _binary = fread(magic, 1, 4, _file) == 4 && memcmp(magic, SCENE_BINARY_MAGIC, 4) == 0;
+    if (!_binary) {
+        rewind(_file);
+    }
+    if (!(_binary ? readBinaryHeader() : readTextHeader())) {
+        fprintf(stderr, "malformed scene header in %s\n", path);
+        fclose(_file);
+        _file = nullptr;
+        return false;
+    }
+    _thread = std::thread(_binary ? &SceneLoader::streamBinary : &SceneLoader::streamText, this);
+    return true;
+}
+
+bool SceneLoader::readTextHeader() {
+    char line[512];
+    while (fgets(line, sizeof(line), _file)) {
+        char keyword[32];
+        if (sscanf(line, "%31s", keyword) != 1 || keyword[0] == '#') {
+            continue;
+        }
+        if (strcmp(keyword, "object") == 0) {
+            _firstObjectLine = line;
+            return true;
+        }
+        bool valid = true;
+        if (strcmp(keyword, "mesh") == 0) {
+            char name[128], meshPath[256];
+            valid = sscanf(line, "mesh %127s %255s", name, meshPath) == 2;
+            if (valid) {
+                _header.meshNames.push_back(name);
+                _header.meshPaths.push_back(meshPath);
+            }
+        } else if (strcmp(keyword, "light") == 0) {
+            glm::vec3& p = _header.lightPosition;
+            glm::vec3& t = _header.lightTarget;
+            valid = sscanf(line, "light %f %f %f %f %f %f %f", &p.x, &p.y, &p.z, &t.x, &t.y, &t.z, &_header.lightSize) == 7;
+        } else if (strcmp(keyword, "spot") == 0) {
+            SpotLight light = { glm::vec3(0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(1.0f), 0.0f, 0.0f, 0.0f };
+            valid = sscanf(line, "spot %f %f %f %f %f %f", &light.color.x, &light.color.y, &light.color.z,
+                           &light.range, &light.innerAngle, &light.outerAngle) == 6;
+            if (valid) {
+                _header.spotLights.push_back(light);
+            }
+        } else if (strcmp(keyword, "shadow") == 0) {
+            // the value is the rest of the line, names can contain spaces
+            char setting[32];
+            int offset = 0;
+            valid = sscanf(line, "shadow %31s %n", setting, &offset) == 1 && offset > 0;
+            std::string value = valid ? std::string(line + offset) : std::string();
+            while (!value.empty() && (value.back() == '\n' || value.back() == '\r' || value.back() == ' ')) {
+                value.pop_back();
+            }
+            if (valid && strcmp(setting, "quality") == 0) {
+                _header.shadowQuality = value;
+            } else if (valid && strcmp(setting, "projection") == 0) {
+                _header.shadowProjection = value;
+            } else {
+                valid = false;
+            }
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            fprintf(stderr, "%s: can't parse '%s'\n", _path.c_str(), keyword);
+            return false;
+        }
+    }
+    // a scene without objects
+    return true;
+}
+
+void SceneLoader::streamText() {
+    std::vector<SceneRecord> block;
+    std::string line = _firstObjectLine;
+    char buffer[512];
+    while (!line.empty() || fgets(buffer, sizeof(buffer), _file)) {
+        if (line.empty()) {
+            line = buffer;
+        }
+        char keyword[32];
+        if (sscanf(line.c_str(), "%31s", keyword) == 1 && keyword[0] != '#') {
+            char name[128];
+            SceneRecord record = { 0, glm::vec3(0.0f), glm::vec3(1.0f), 0 };
+            int offset = 0;
+            if (strcmp(keyword, "object") != 0 ||
+                sscanf(line.c_str(), "object %127s %f %f %f %f %f %f%n", name, &record.position.x, &record.position.y, &record.position.z,
+                       &record.scale.x, &record.scale.y, &record.scale.z, &offset) != 7) {
+                fprintf(stderr, "%s: skipping '%s', only objects can follow the first object\n", _path.c_str(), keyword);
+            } else {
+                record.mesh = (uint32_t)meshIndex(name);
+                const char* flags = line.c_str() + offset;
+                char flag[32];
+                int length;
+                while (sscanf(flags, "%31s%n", flag, &length) == 1) {
+                    if (strcmp(flag, "casts") == 0)
+                        record.flags |= SCENE_CASTS_SHADOW;
+                    else if (strcmp(flag, "receives") == 0)
+                        record.flags |= SCENE_RECEIVES_SHADOW;
+                    else if (strcmp(flag, "occluder") == 0)
+                        record.flags |= SCENE_OCCLUDER;
+                    else if (strcmp(flag, "static") == 0)
+                        record.flags |= SCENE_STATIC;
+                    flags += length;
+                }
+                block.push_back(record);
+                if ((int)block.size() == SCENE_STREAM_BLOCK) {
+                    publish(block);
+                }
+            }
+        }
+        line.clear();
+    }
+    fclose(_file);
+    _file = nullptr;
+    publish(block, true);
+}
+
+bool readSceneString(FILE* file, std::string& out) {
+    uint32_t length;
+    if (fread(&length, sizeof(length), 1, file) != 1 || length > 4096) {
+        return false;
+    }
+    out.resize(length);
+    return length == 0 || fread(&out[0], 1, length, file) == length;
+}
+
+void writeSceneString(FILE* file, const std::string& value) {
+    uint32_t length = (uint32_t)value.size();
+    fwrite(&length, sizeof(length), 1, file);
+    fwrite(value.data(), 1, length, file);
+}
+
+bool SceneLoader::readBinaryHeader() {
+    uint32_t version, meshCount, spotCount;
+    if (fread(&version, sizeof(version), 1, _file) != 1 || version != SCENE_BINARY_VERSION ||
+        fread(&meshCount, sizeof(meshCount), 1, _file) != 1) {
+        return false;
+    }
+    _header.meshNames.resize(meshCount);
+    _header.meshPaths.resize(meshCount);
+    for (uint32_t i = 0; i < meshCount; i++) {
+        if (!readSceneString(_file, _header.meshNames[i]) || !readSceneString(_file, _header.meshPaths[i])) {
+            return false;
+        }
+    }
+    float light[7];
+    if (fread(light, sizeof(float), 7, _file) != 7 || fread(&spotCount, sizeof(spotCount), 1, _file) != 1) {
+        return false;
+    }
+    _header.lightPosition = glm::vec3(light[0], light[1], light[2]);
+    _header.lightTarget = glm::vec3(light[3], light[4], light[5]);
+    _header.lightSize = light[6];
+    for (uint32_t i = 0; i < spotCount; i++) {
+        float spot[6];
+        if (fread(spot, sizeof(float), 6, _file) != 6) {
+            return false;
+        }
+        _header.spotLights.push_back({ glm::vec3(0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(spot[0], spot[1], spot[2]), spot[3], spot[4], spot[5] });
+    }
+    return readSceneString(_file, _header.shadowQuality) && readSceneString(_file, _header.shadowProjection) &&
+           fread(&_objectCount, sizeof(_objectCount), 1, _file) == 1;
+}
+
+void SceneLoader::streamBinary() {
+    // mesh, position, scale, flags: 32 bytes per object
+    const int RECORD_WORDS = 8;
+    std::vector<uint32_t> raw(SCENE_STREAM_BLOCK * RECORD_WORDS);
+    std::vector<SceneRecord> block;
+    uint32_t remaining = _objectCount;
+    while (remaining > 0) {
+        uint32_t count = std::min(remaining, (uint32_t)SCENE_STREAM_BLOCK);
+        if (fread(raw.data(), RECORD_WORDS * sizeof(uint32_t), count, _file) != count) {
+            fprintf(stderr, "%s: truncated, %u objects missing\n", _path.c_str(), remaining);
+            break;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t* r = &raw[i * RECORD_WORDS];
+            SceneRecord record;
+            record.mesh = r[0];
+            float values[6];
+            memcpy(values, &r[1], sizeof(values));
+            record.position = glm::vec3(values[0], values[1], values[2]);
+            record.scale = glm::vec3(values[3], values[4], values[5]);
+            record.flags = r[7];
+            block.push_back(record);
+        }
+        remaining -= count;
+        if (remaining > 0) {
+            publish(block);
+        }
+    }
+    fclose(_file);
+    _file = nullptr;
+    // the last block goes out together with the end of the stream
+    publish(block, true);
+}
+
+void SceneLoader::publish(std::vector<SceneRecord>& block, bool last) {
+    std::vector<SceneRecord> valid;
+    valid.reserve(block.size());
+    for (const SceneRecord& record : block) {
+        if (record.mesh < _header.meshNames.size()) {
+            valid.push_back(record);
+        }
+    }
+    if (valid.size() != block.size()) {
+        fprintf(stderr, "%s: skipped %d objects with an unknown mesh\n", _path.c_str(), (int)(block.size() - valid.size()));
+    }
+    block.clear();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pending.insert(_pending.end(), valid.begin(), valid.end());
+    _done = last;
+}
+
+bool SceneLoader::poll(std::vector<SceneRecord>& records) {
+    if (_complete) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        records.insert(records.end(), _pending.begin(), _pending.end());
+        _pending.clear();
+        // nothing can be published after _done, so this hand-off was the last one
+        _complete = _done;
+    }
+    if (_complete && _thread.joinable()) {
+        _thread.join();
+    }
+    return _complete;
+}
+
+void SceneLoader::wait(std::vector<SceneRecord>& records) {
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    poll(records);
+}
+
+bool writeSceneText(const char* path, const SceneHeader& header, const std::vector<SceneRecord>& records) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    for (int i = 0; i < (int)header.meshNames.size(); i++) {
+        fprintf(file, "mesh %s %s\n", header.meshNames[i].c_str(), header.meshPaths[i].c_str());
+    }
+    const glm::vec3& p = header.lightPosition;
+    const glm::vec3& t = header.lightTarget;
+    fprintf(file, "light %g %g %g  %g %g %g  %g\n", p.x, p.y, p.z, t.x, t.y, t.z, header.lightSize);
+    for (const SpotLight& light : header.spotLights) {
+        fprintf(file, "spot %g %g %g  %g %g %g\n", light.color.x, light.color.y, light.color.z, light.range, light.innerAngle, light.outerAngle);
+    }
+    if (!header.shadowQuality.empty())
+        fprintf(file, "shadow quality %s\n", header.shadowQuality.c_str());
+    if (!header.shadowProjection.empty())
+        fprintf(file, "shadow projection %s\n", header.shadowProjection.c_str());
+    for (const SceneRecord& record : records) {
+        fprintf(file, "object %s  %g %g %g  %g %g %g", header.meshNames[record.mesh].c_str(), record.position.x, record.position.y, record.position.z,
+                record.scale.x, record.scale.y, record.scale.z);
+        fprintf(file, "%s%s%s%s\n", (record.flags & SCENE_CASTS_SHADOW) ? " casts" : "", (record.flags & SCENE_RECEIVES_SHADOW) ? " receives" : "",
+                (record.flags & SCENE_OCCLUDER) ? " occluder" : "", (record.flags & SCENE_STATIC) ? " static" : "");
+    }
+    bool written = !ferror(file);
+    fclose(file);
+    return written;
+}
+
+bool writeSceneBinary(const char* path, const SceneHeader& header, const std::vector<SceneRecord>& records) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    fwrite(SCENE_BINARY_MAGIC, 1, 4, file);
+    fwrite(&SCENE_BINARY_VERSION, sizeof(uint32_t), 1, file);
+    uint32_t meshCount = (uint32_t)header.meshNames.size();
+    fwrite(&meshCount, sizeof(meshCount), 1, file);
+    for (uint32_t i = 0; i < meshCount; i++) {
+        writeSceneString(file, header.meshNames[i]);
+        writeSceneString(file, header.meshPaths[i]);
+    }
+    float light[7] = { header.lightPosition.x, header.lightPosition.y, header.lightPosition.z,
+                       header.lightTarget.x, header.lightTarget.y, header.lightTarget.z, header.lightSize };
+    fwrite(light, sizeof(float), 7, file);
+    uint32_t spotCount = (uint32_t)header.spotLights.size();
+    fwrite(&spotCount, sizeof(spotCount), 1, file);
+    for (const SpotLight& light : header.spotLights) {
+        float spot[6] = { light.color.x, light.color.y, light.color.z, light.range, light.innerAngle, light.outerAngle };
+        fwrite(spot, sizeof(float), 6, file);
+    }
+    writeSceneString(file, header.shadowQuality);
+    writeSceneString(file, header.shadowProjection);
+    uint32_t objectCount = (uint32_t)records.size();
+    fwrite(&objectCount, sizeof(objectCount), 1, file);
+    for (const SceneRecord& record : records) {
+        uint32_t raw[8];
+        raw[0] = record.mesh;
+        float values[6] = { record.position.x, record.position.y, record.position.z, record.scale.x, record.scale.y, record.scale.z };
+        memcpy(&raw[1], values, sizeof(values));
+        raw[7] = record.flags;
+        fwrite(raw, sizeof(raw), 1, file);
+    }
+    bool written = !ferror(file);
+    fclose(file);
+    return written;
+}
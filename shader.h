@@ -44,8 +44,8 @@ public:
             vShaderFile.close();
             fShaderFile.close();
             // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
+            vertexCode = resolveIncludes(vShaderStream.str(), vertexPath);
+            fragmentCode = resolveIncludes(fShaderStream.str(), fragmentPath);
             // if geometry shader path is present, also load a geometry shader
             if(geometryPath != nullptr)
             {
@@ -53,7 +53,7 @@ public:
                 std::stringstream gShaderStream;
                 gShaderStream << gShaderFile.rdbuf();
                 gShaderFile.close();
-                geometryCode = gShaderStream.str();
+                geometryCode = resolveIncludes(gShaderStream.str(), geometryPath);
             }
         }
         catch (std::ifstream::failure& e)
@@ -99,6 +99,36 @@ public:
             glDeleteShader(geometry);
 
     }
+    // constructor for a compute-only program
+    // ------------------------------------------------------------------------
+    Shader(const char* computePath)
+    {
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        try 
+        {
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = resolveIncludes(cShaderStream.str(), computePath);
+        }
+        catch (std::ifstream::failure& e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        }
+        const char* cShaderCode = computeCode.c_str();
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        checkCompileErrors(compute, "COMPUTE");
+        ID = glCreateProgram();
+        glAttachShader(ID, compute);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        glDeleteShader(compute);
+    }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() 
@@ -130,6 +160,10 @@ public:
     { 
         glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
     }
+    void setIVec2(const std::string &name, const glm::ivec2 &value) const
+    { 
+        glUniform2iv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+    }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     { 
@@ -163,8 +197,55 @@ public:
     {
         glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
     }
+    // looked up once for commands recorded away from the GL thread
+    // ------------------------------------------------------------------------
+    int uniformLocation(const std::string &name) const
+    {
+        return glGetUniformLocation(ID, name.c_str());
+    }
 
 private:
+    // replaces every #include "file" line with that file's contents, relative to the including file
+    // ------------------------------------------------------------------------
+    static std::string resolveIncludes(const std::string& code, const std::string& path, int depth = 0)
+    {
+        std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+        std::istringstream lines(code);
+        std::stringstream result;
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(lines, line))
+        {
+            lineNumber++;
+            size_t directive = line.find_first_not_of(" \t");
+            if (directive == std::string::npos || line.compare(directive, 8, "#include") != 0)
+            {
+                result << line << '\n';
+                continue;
+            }
+            size_t open = line.find('"', directive);
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            std::ifstream includeFile;
+            std::string includePath;
+            if (close != std::string::npos && depth < 8)
+            {
+                includePath = directory + line.substr(open + 1, close - open - 1);
+                includeFile.open(includePath);
+            }
+            if (!includeFile.is_open())
+            {
+                std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND " << path << ":" << lineNumber << std::endl;
+                continue;
+            }
+            std::stringstream includeStream;
+            includeStream << includeFile.rdbuf();
+            result << resolveIncludes(includeStream.str(), includePath, depth + 1) << '\n';
+            // keep compile errors pointing at the right line of the including file
+            result << "#line " << lineNumber + 1 << '\n';
+        }
+        return result.str();
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -2,28 +2,45 @@
 
 layout (location = 0) in vec3 vertexPositionWorldSpace;
 layout (location = 1) in vec3 vertexNormalWorldSpace;
-layout (location = 2) in vec4 fragPosLightSpace;
+layout (location = 2) in vec3 lightmapCoordinates;
 
 layout (location = 0) out vec4 FragColor;
 
-uniform sampler2D shadowMap;
+#include "shadow.glsl"
 
-uniform vec3 lightPos;
+uniform bool spotLightsEnabled;
 uniform vec3 eyePos;
+// the main light's shadow from the screen-space mask instead of shadowCalculation()
+uniform bool shadowMaskEnabled;
+uniform sampler2D shadowMask;
+// the main light's shadows baked for static receivers
+uniform bool lightmapsEnabled;
+uniform sampler2D lightmap;
+// whether the shadow maps hold casters the lightmap doesn't, static receivers only look them up then
+uniform bool dynamicCasters;
 
-float shadowCalculation() {
-    // perspective divide
-    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-    projCoords = projCoords * 0.5 + 0.5;
-    float closestDepth = texture(shadowMap, projCoords.xy).r;
-    float currentDepth = projCoords.z;
-    vec3 lightVector = normalize(lightPos - vertexPositionWorldSpace);
-    float bias = max(0.05 * (1.0 - dot(vertexNormalWorldSpace, lightVector)), 0.005);
-    float shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
-    if (projCoords.z > 1.0) {
-        shadow = 0.0;
+vec3 spotLighting(vec3 baseColor) {
+    vec3 result = vec3(0.0);
+    for (int i = 0; i < atlasLightCount.x; i++) {
+        vec3 toLight = atlasPositions[i].xyz - vertexPositionWorldSpace;
+        float dist = length(toLight);
+        float range = atlasPositions[i].w;
+        if (dist > range) {
+            continue;
+        }
+        vec3 lightVector = toLight / dist;
+        float cosAngle = dot(-lightVector, atlasDirections[i].xyz);
+        float cone = smoothstep(atlasDirections[i].w, atlasColors[i].w, cosAngle);
+        float diffuseWeight = max(dot(lightVector, vertexNormalWorldSpace), 0.0);
+        if (cone <= 0.0 || diffuseWeight <= 0.0) {
+            continue;
+        }
+        float attenuation = 1.0 - smoothstep(0.75 * range, range, dist);
+        float bias = max(0.0005 * (1.0 - diffuseWeight), 0.0001);
+        float shadow = atlasShadow(i, bias);
+        result += (1.0 - shadow) * cone * attenuation * diffuseWeight * atlasColors[i].rgb * baseColor;
     }
-    return shadow;
+    return result;
 }
 
 void main() {
@@ -49,7 +66,21 @@ void main() {
     specular *= specularWeight;
 
     // calculate shadow
-    float shadow = shadowCalculation();
+    shadowPosition = vertexPositionWorldSpace;
+    shadowNormal = vertexNormalWorldSpace;
+    float shadow;
+    if (lightmapsEnabled && lightmapCoordinates.z > 0.5) {
+        shadow = texture(lightmap, lightmapCoordinates.xy).r;
+        if (dynamicCasters) {
+            shadow = max(shadow, shadowMaskEnabled ? texelFetch(shadowMask, ivec2(gl_FragCoord.xy), 0).r : shadowCalculation());
+        }
+    } else {
+        shadow = shadowMaskEnabled ? texelFetch(shadowMask, ivec2(gl_FragCoord.xy), 0).r : shadowCalculation();
+    }
  
-    FragColor = vec4((ambient + (1.0 - shadow) * diffuse + (1.0 - shadow) * specular), 1.0);
+    vec3 color = ambient + (1.0 - shadow) * diffuse + (1.0 - shadow) * specular;
+    if (spotLightsEnabled) {
+        color += spotLighting(vec3(0.2, 0.5, 0.8));
+    }
+    FragColor = vec4(color, 1.0);
 }
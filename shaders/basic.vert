@@ -3,19 +3,54 @@
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 1) in vec3 vertexNormal;
 layout (location = 2) in vec2 texCoord;
+layout (location = 3) in vec2 lightmapTexCoord;
 
 layout (location = 0) out vec3 positionWorldSpace;
 layout (location = 1) out vec3 vertexNormalWorldSpace;
-layout (location = 2) out vec4 fragPosLightSpace;
+// xy in the lightmap atlas, z is 1 when the object has baked shadows
+layout (location = 2) out vec3 lightmapCoordinates;
 
 uniform mat4 model;
+// from the CPU, only correct up to scale
+uniform mat3 normalMatrix;
+// where the object's lightmap texcoords land in the atlas, zero without a lightmap
+uniform vec4 lightmapRect;
 uniform mat4 view;
 uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+
+// GPU culled draws take their model matrix from the instance the visible list points at
+uniform bool instanced;
+struct Instance {
+    mat4 model;
+    vec4 normalMatrix[3];   // columns, w unused
+    vec4 boundsMin;
+    vec4 boundsMax;
+    vec4 lightmapRect;
+    uint group;
+    uint padding[3];
+};
+layout (std430, binding = 2) readonly buffer Instances {
+    Instance instances[];
+};
+layout (std430, binding = 3) readonly buffer VisibleInstances {
+    uint visibleInstances[];
+};
+
+// the depth prepass computes gl_Position the same way, so GL_EQUAL / GL_LEQUAL tests match
+invariant gl_Position;
 
 void main() {
-	positionWorldSpace = vec3(model * vec4(vertexPosition, 1.0));
-	vertexNormalWorldSpace = normalize(transpose(inverse(mat3(model))) * vertexPosition);
-	fragPosLightSpace = lightSpaceMatrix * vec4(positionWorldSpace, 1.0);
+	mat4 modelMatrix = model;
+	mat3 normalTransform = normalMatrix;
+	vec4 rect = lightmapRect;
+	if (instanced) {
+		Instance instance = instances[visibleInstances[gl_BaseInstance + gl_InstanceID]];
+		modelMatrix = instance.model;
+		normalTransform = mat3(instance.normalMatrix[0].xyz, instance.normalMatrix[1].xyz, instance.normalMatrix[2].xyz);
+		rect = instance.lightmapRect;
+	}
+	lightmapCoordinates = vec3(rect.zw + lightmapTexCoord * rect.xy, rect.x > 0.0 ? 1.0 : 0.0);
+	positionWorldSpace = vec3(modelMatrix * vec4(vertexPosition, 1.0));
+	vertexNormalWorldSpace = normalize(normalTransform * vertexNormal);
 	gl_Position = projection * view * vec4(positionWorldSpace, 1.0f);
 }
\ No newline at end of file
@@ -0,0 +1,12 @@
+#version 460 core
+
+// Stretches the unit cube over a world-space box, for occlusion queries on object bounds.
+layout (location = 0) in vec3 position;
+
+uniform vec3 boundsMin;
+uniform vec3 boundsMax;
+uniform mat4 viewProjection;
+
+void main() {
+    gl_Position = viewProjection * vec4(mix(boundsMin, boundsMax, position), 1.0);
+}
@@ -0,0 +1,34 @@
+#version 460 core
+
+// Depth-only version of basic.vert, the position math must stay identical to it.
+layout (location = 0) in vec3 vertexPosition;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// GPU culled draws take their model matrix from the instance the visible list points at
+uniform bool instanced;
+struct Instance {
+    mat4 model;
+    vec4 normalMatrix[3];   // columns, w unused
+    vec4 boundsMin;
+    vec4 boundsMax;
+    vec4 lightmapRect;
+    uint group;
+    uint padding[3];
+};
+layout (std430, binding = 2) readonly buffer Instances {
+    Instance instances[];
+};
+layout (std430, binding = 3) readonly buffer VisibleInstances {
+    uint visibleInstances[];
+};
+
+invariant gl_Position;
+
+void main() {
+	mat4 modelMatrix = instanced ? instances[visibleInstances[gl_BaseInstance + gl_InstanceID]].model : model;
+	vec3 positionWorldSpace = vec3(modelMatrix * vec4(vertexPosition, 1.0));
+	gl_Position = projection * view * vec4(positionWorldSpace, 1.0f);
+}
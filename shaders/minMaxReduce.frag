@@ -0,0 +1,46 @@
+#version 460 core
+
+// One level of the min/max depth pyramid. Each output texel stores (min, max) of
+// the 2x2 source texels it covers. On odd sized sources the last row/column also
+// folds in the texel that would otherwise be dropped, so the bounds stay conservative.
+
+layout (location = 0) out vec2 minMax;
+
+uniform sampler2D source;
+uniform bool sourceIsDepth;
+
+vec2 fetchMinMax(ivec2 coord, ivec2 sourceSize) {
+    vec4 texel = texelFetch(source, min(coord, sourceSize - 1), 0);
+    return sourceIsDepth ? texel.rr : texel.rg;
+}
+
+void main() {
+    ivec2 sourceSize = textureSize(source, 0);
+    ivec2 coord = ivec2(gl_FragCoord.xy) * 2;
+
+    vec2 a = fetchMinMax(coord, sourceSize);
+    vec2 b = fetchMinMax(coord + ivec2(1, 0), sourceSize);
+    vec2 c = fetchMinMax(coord + ivec2(0, 1), sourceSize);
+    vec2 d = fetchMinMax(coord + ivec2(1, 1), sourceSize);
+    vec2 result = vec2(min(min(a.x, b.x), min(c.x, d.x)), max(max(a.y, b.y), max(c.y, d.y)));
+
+    ivec2 outputSize = max(sourceSize / 2, ivec2(1));
+    bool lastColumn = (sourceSize.x & 1) == 1 && int(gl_FragCoord.x) == outputSize.x - 1;
+    bool lastRow = (sourceSize.y & 1) == 1 && int(gl_FragCoord.y) == outputSize.y - 1;
+    if (lastColumn) {
+        vec2 e = fetchMinMax(coord + ivec2(2, 0), sourceSize);
+        vec2 f = fetchMinMax(coord + ivec2(2, 1), sourceSize);
+        result = vec2(min(result.x, min(e.x, f.x)), max(result.y, max(e.y, f.y)));
+    }
+    if (lastRow) {
+        vec2 e = fetchMinMax(coord + ivec2(0, 2), sourceSize);
+        vec2 f = fetchMinMax(coord + ivec2(1, 2), sourceSize);
+        result = vec2(min(result.x, min(e.x, f.x)), max(result.y, max(e.y, f.y)));
+    }
+    if (lastColumn && lastRow) {
+        vec2 g = fetchMinMax(coord + ivec2(2, 2), sourceSize);
+        result = vec2(min(result.x, g.x), max(result.y, g.y));
+    }
+
+    minMax = result;
+}
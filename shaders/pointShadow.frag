@@ -0,0 +1,11 @@
+#version 460 core
+
+layout (location = 0) in vec3 fragPosWorldSpace;
+
+uniform vec3 lightPos;
+uniform float farPlane;
+
+void main() {
+    // store linear distance to the light so both projections compare the same quantity
+    gl_FragDepth = length(fragPosWorldSpace - lightPos) / farPlane;
+}
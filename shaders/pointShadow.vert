@@ -0,0 +1,10 @@
+#version 460 core
+
+layout (location = 0) in vec3 position;
+
+uniform mat4 model;
+
+void main() {
+    // projection to the individual faces happens in the geometry shader
+    gl_Position = model * vec4(position, 1.0);
+}
@@ -0,0 +1,28 @@
+#version 460 core
+
+// Marks the shadow map's stencil outside the (dilated) receiver tiles, so casters drawn
+// afterwards are rejected there by the early stencil test. Writes no depth.
+
+layout (std430, binding = 0) readonly buffer ReceiverTiles {
+    uint tiles[];
+};
+
+uniform int tilesPerSide;
+uniform int shadowSize;
+// tiles around a receiver tile that stay open for filter kernels and camera motion
+uniform int dilation;
+
+void main() {
+    ivec2 tile = ivec2(gl_FragCoord.xy) * tilesPerSide / shadowSize;
+    for (int y = -dilation; y <= dilation; y++) {
+        for (int x = -dilation; x <= dilation; x++) {
+            ivec2 neighbour = tile + ivec2(x, y);
+            if (any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, ivec2(tilesPerSide)))) {
+                continue;
+            }
+            if (tiles[neighbour.y * tilesPerSide + neighbour.x] != 0u) {
+                discard;
+            }
+        }
+    }
+}
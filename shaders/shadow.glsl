@@ -0,0 +1,423 @@
+// Shadow lookups for the main light and the spot light atlas, shared by the lit pass and the
+// screen-space shadow mask. Set shadowPosition and shadowNormal before calling shadowCalculation().
+
+// world-space position and normal of the surface being shadowed
+vec3 shadowPosition;
+vec3 shadowNormal;
+
+uniform sampler2D shadowMap;
+// min/max pyramid of shadowMap, only valid for the PCSS tier
+uniform sampler2D depthPyramid;
+// point light shadows, both store distance to the light divided by pointFarPlane
+uniform samplerCube pointShadowCube;
+uniform sampler2DArray pointShadowParaboloid;
+// shared depth atlas of the spot lights
+uniform sampler2D shadowAtlas;
+
+const int MAX_ATLAS_LIGHTS = 64;
+layout (std140) uniform AtlasLights {
+    mat4 atlasMatrices[MAX_ATLAS_LIGHTS];
+    vec4 atlasRects[MAX_ATLAS_LIGHTS];      // xy offset, zw scale in atlas UV, zero scale without a tile
+    vec4 atlasPositions[MAX_ATLAS_LIGHTS];  // xyz position, w range
+    vec4 atlasDirections[MAX_ATLAS_LIGHTS]; // xyz direction, w cos(outer angle)
+    vec4 atlasColors[MAX_ATLAS_LIGHTS];     // rgb color, w cos(inner angle)
+    ivec4 atlasLightCount;
+};
+// virtual shadow map: page table (physical page + 1, 0 when not resident) and physical page pool
+uniform bool virtualShadowsEnabled;
+uniform usampler2D vsmPageTable;
+uniform sampler2D vsmPhysical;
+uniform mat4 vsmLightSpaceMatrix;
+uniform int vsmPhysicalPagesPerSide;
+// cascaded shadow map: cascade i covers view depths up to cascadeSplits[i]
+const int NUM_CASCADES = 4;
+uniform bool cascadesEnabled;
+uniform sampler2DArray cascadeShadowMap;
+uniform mat4 cascadeMatrices[NUM_CASCADES];
+uniform vec4 cascadeSplits;
+// depth bias of one texel in each cascade's depth units
+uniform vec4 cascadeBiasScales;
+
+uniform mat4 view;
+
+uniform vec3 lightPos;
+
+uniform mat4 lightSpaceMatrix;
+// shadowMap's format: fixed point bits (0 for float) and whether it stores reversed depth,
+// in which case lightSpaceMatrix is the reversed [0, 1] projection it was rendered with
+uniform int shadowDepthBits;
+uniform bool shadowReversedZ;
+// light-space size of one shadowMap texel in depth units
+uniform float shadowTexelDepth;
+
+// 0 = hard, 1 = PCF, 2 = PCSS, 3 = stochastic, 4 = distance field
+uniform int shadowQuality;
+// penumbra width in shadow map UV per unit of light-space depth between blocker and receiver
+uniform float pcssLightSize;
+
+// the stochastic tier rotates its taps with blue noise, shifted and animated every frame
+uniform sampler2D blueNoise;
+uniform int frameIndex;
+uniform ivec2 blueNoiseOffset;
+
+// signed distance to the static casters over the world-space box [distanceFieldMin, distanceFieldMax],
+// not enabled until the field is built
+uniform bool distanceFieldEnabled;
+uniform sampler3D distanceField;
+uniform vec3 distanceFieldMin;
+uniform vec3 distanceFieldMax;
+uniform float distanceFieldVoxelSize;
+// radius of the main light, sets how fast the penumbra widens behind a caster
+uniform float distanceFieldLightSize;
+
+// 0 = orthographic map, 1 = cube map, 2 = dual paraboloid
+uniform int shadowProjection;
+uniform float pointFarPlane;
+uniform mat4 paraboloidViews[2];
+
+const int SHADOW_HARD = 0;
+const int SHADOW_PCF = 1;
+const int SHADOW_PCSS = 2;
+const int SHADOW_STOCHASTIC = 3;
+const int SHADOW_DISTANCE_FIELD = 4;
+
+const int SHADOW_PROJECTION_ORTHO = 0;
+const int SHADOW_PROJECTION_CUBE = 1;
+const int SHADOW_PROJECTION_DUAL_PARABOLOID = 2;
+
+const vec2 poissonDisk[16] = vec2[](
+    vec2(-0.94201624, -0.39906216), vec2(0.94558609, -0.76890725),
+    vec2(-0.09418410, -0.92938870), vec2(0.34495938, 0.29387760),
+    vec2(-0.91588581, 0.45771432), vec2(-0.81544232, -0.87912464),
+    vec2(-0.38277543, 0.27676845), vec2(0.97484398, 0.75648379),
+    vec2(0.44323325, -0.97511554), vec2(0.53742981, -0.47373420),
+    vec2(-0.26496911, -0.41893023), vec2(0.79197514, 0.19090188),
+    vec2(-0.24188840, 0.99706507), vec2(-0.81409955, 0.91437590),
+    vec2(0.19984126, 0.78641367), vec2(0.14383161, -0.14100790)
+);
+
+// shadowMap depth tests stay in stored depth so reversed-Z keeps its precision,
+// only the PCSS estimates work in forward depth
+float depthTest(float receiver, float closestDepth, float bias) {
+    if (shadowReversedZ) {
+        return receiver + bias < closestDepth ? 1.0 : 0.0;
+    }
+    return receiver - bias > closestDepth ? 1.0 : 0.0;
+}
+
+float forwardDepth(float stored) {
+    return shadowReversedZ ? 1.0 - stored : stored;
+}
+
+// smallest depth difference shadowMap can store around a stored depth
+float depthStep(float stored) {
+    if (shadowDepthBits > 0) {
+        return 1.0 / (exp2(float(shadowDepthBits)) - 1.0);
+    }
+    // one float ulp, far receivers are stored near 0 with reversed-Z and get much finer steps
+    return max(stored * exp2(-23.0), 1e-30);
+}
+
+float hardShadow(vec3 projCoords, float bias) {
+    float closestDepth = texture(shadowMap, projCoords.xy).r;
+    return depthTest(projCoords.z, closestDepth, bias);
+}
+
+float pcfShadow(vec3 projCoords, float bias) {
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0));
+    float shadow = 0.0;
+    for (int x = -1; x <= 1; x++) {
+        for (int y = -1; y <= 1; y++) {
+            float closestDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
+            shadow += depthTest(projCoords.z, closestDepth, bias);
+        }
+    }
+    return shadow / 9.0;
+}
+
+float pcssShadow(vec3 projCoords, float bias) {
+    float receiver = forwardDepth(projCoords.z) - bias;
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0));
+
+    // blocker search: anything between the light and the receiver within this
+    // footprint can cover part of the light
+    float searchWidth = max(receiver * pcssLightSize, texelSize.x);
+
+    // pick the coarsest useful level: a 2x2 block of its texels covers the whole footprint
+    int levels = textureQueryLevels(depthPyramid);
+    vec2 level0Size = vec2(textureSize(depthPyramid, 0));
+    int level = clamp(int(ceil(log2(searchWidth * level0Size.x))), 0, levels - 1);
+    ivec2 levelSize = textureSize(depthPyramid, level);
+    ivec2 base = ivec2(floor((projCoords.xy - 0.5 * searchWidth) * vec2(levelSize)));
+    vec2 bounds = vec2(1.0, 0.0);
+    for (int i = 0; i < 4; i++) {
+        ivec2 coord = clamp(base + ivec2(i & 1, i >> 1), ivec2(0), levelSize - 1);
+        vec2 minMax = texelFetch(depthPyramid, coord, level).rg;
+        // reversed depth swaps which end is closest to the light
+        minMax = shadowReversedZ ? 1.0 - minMax.yx : minMax;
+        bounds = vec2(min(bounds.x, minMax.x), max(bounds.y, minMax.y));
+    }
+    // nothing in front of the receiver: fully lit
+    if (receiver <= bounds.x) {
+        return 0.0;
+    }
+    // everything in front of the receiver: fully shadowed
+    if (receiver > bounds.y) {
+        return 1.0;
+    }
+
+    // estimate the average blocker depth one level finer, where the footprint spans at most 3x3 texels
+    int fineLevel = max(level - 1, 0);
+    ivec2 fineSize = textureSize(depthPyramid, fineLevel);
+    ivec2 fineBase = ivec2(floor((projCoords.xy - 0.5 * searchWidth) * vec2(fineSize)));
+    float blockerSum = 0.0;
+    float blockerCount = 0.0;
+    for (int i = 0; i < 9; i++) {
+        ivec2 coord = clamp(fineBase + ivec2(i % 3, i / 3), ivec2(0), fineSize - 1);
+        float minDepth = shadowReversedZ ? 1.0 - texelFetch(depthPyramid, coord, fineLevel).g : texelFetch(depthPyramid, coord, fineLevel).r;
+        if (minDepth < receiver) {
+            blockerSum += minDepth;
+            blockerCount += 1.0;
+        }
+    }
+    float blocker = blockerCount > 0.0 ? blockerSum / blockerCount : bounds.x;
+
+    // filter with a kernel as wide as the penumbra
+    float penumbra = (receiver - blocker) * pcssLightSize;
+    float radius = max(0.5 * penumbra, texelSize.x);
+    float shadow = 0.0;
+    for (int i = 0; i < 16; i++) {
+        float closestDepth = texture(shadowMap, projCoords.xy + poissonDisk[i] * radius).r;
+        shadow += depthTest(projCoords.z, closestDepth, bias);
+    }
+    return shadow / 16.0;
+}
+
+// a few taps of a wide kernel, rotated by blue noise and cycling through the disk over frames.
+// Noisy on its own, the shadow mask's temporal pass accumulates it into a smooth large kernel
+float stochasticShadow(vec3 projCoords, float bias) {
+    const float RADIUS_TEXELS = 4.0;
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0));
+    ivec2 noiseSize = textureSize(blueNoise, 0);
+    ivec2 noiseCoord = (ivec2(gl_FragCoord.xy) + blueNoiseOffset) % noiseSize;
+    // golden ratio steps keep every pixel's sequence well spread over time
+    float noise = fract(texelFetch(blueNoise, noiseCoord, 0).r + float(frameIndex) * 0.61803399);
+    float angle = noise * 6.28318531;
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+    float shadow = 0.0;
+    for (int i = 0; i < 4; i++) {
+        vec2 offset = rotation * poissonDisk[(4 * i + frameIndex) % 16] * RADIUS_TEXELS * texelSize;
+        shadow += depthTest(projCoords.z, texture(shadowMap, projCoords.xy + offset).r, bias);
+    }
+    return shadow * 0.25;
+}
+
+float pointShadowDepth(vec3 lightToFrag) {
+    if (shadowProjection == SHADOW_PROJECTION_CUBE) {
+        return texture(pointShadowCube, lightToFrag).r * pointFarPlane;
+    }
+    // hemisphere 0 looks down, hemisphere 1 up
+    int hemisphere = lightToFrag.y <= 0.0 ? 0 : 1;
+    vec3 dir = mat3(paraboloidViews[hemisphere]) * normalize(lightToFrag);
+    vec2 uv = dir.xy / (1.0 - dir.z) * 0.5 + 0.5;
+    return texture(pointShadowParaboloid, vec3(uv, hemisphere)).r * pointFarPlane;
+}
+
+float pointShadow(vec3 normal, vec3 lightVector) {
+    vec3 lightToFrag = shadowPosition - lightPos;
+    float currentDepth = length(lightToFrag);
+    if (currentDepth > pointFarPlane) {
+        return 0.0;
+    }
+    // world-space bias, the distance is stored linearly
+    float bias = max(0.15 * (1.0 - dot(normal, lightVector)), 0.03);
+    if (shadowQuality == SHADOW_HARD) {
+        return currentDepth - bias > pointShadowDepth(lightToFrag) ? 1.0 : 0.0;
+    }
+    // PCF (PCSS falls back to it): offsets perpendicular to the lookup direction
+    vec3 dir = lightToFrag / currentDepth;
+    vec3 tangent = normalize(cross(dir, abs(dir.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+    vec3 bitangent = cross(dir, tangent);
+    float radius = 0.01 * currentDepth;
+    float shadow = 0.0;
+    for (int i = 0; i < 16; i++) {
+        vec3 offset = (tangent * poissonDisk[i].x + bitangent * poissonDisk[i].y) * radius;
+        shadow += currentDepth - bias > pointShadowDepth(lightToFrag + offset) ? 1.0 : 0.0;
+    }
+    return shadow / 16.0;
+}
+
+float atlasShadow(int light, float bias) {
+    vec4 rect = atlasRects[light];
+    if (rect.z == 0.0) {
+        return 0.0;
+    }
+    vec4 lightSpace = atlasMatrices[light] * vec4(shadowPosition, 1.0);
+    vec3 projCoords = lightSpace.xyz / lightSpace.w * 0.5 + 0.5;
+    if (projCoords.z > 1.0) {
+        return 0.0;
+    }
+    // 2x2 PCF, kept half a texel inside the tile so neighbouring tiles never bleed in
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowAtlas, 0));
+    vec2 lo = rect.xy + texelSize * 0.5;
+    vec2 hi = rect.xy + rect.zw - texelSize * 0.5;
+    vec2 uv = rect.xy + projCoords.xy * rect.zw;
+    float shadow = 0.0;
+    for (int i = 0; i < 4; i++) {
+        vec2 offset = (vec2(i & 1, i >> 1) - 0.5) * texelSize;
+        float closestDepth = texture(shadowAtlas, clamp(uv + offset, lo, hi)).r;
+        shadow += projCoords.z - bias > closestDepth ? 1.0 : 0.0;
+    }
+    return shadow * 0.25;
+}
+
+// shadow from the virtual shadow map, -1 when the page is not resident yet
+float virtualShadow(float bias) {
+    vec4 lightSpace = vsmLightSpaceMatrix * vec4(shadowPosition, 1.0);
+    vec3 projCoords = lightSpace.xyz / lightSpace.w * 0.5 + 0.5;
+    if (any(lessThan(projCoords.xy, vec2(0.0))) || any(greaterThanEqual(projCoords.xy, vec2(1.0))) || projCoords.z > 1.0) {
+        return -1.0;
+    }
+    vec2 pageCoord = projCoords.xy * vec2(textureSize(vsmPageTable, 0));
+    uint entry = texelFetch(vsmPageTable, ivec2(pageCoord), 0).r;
+    if (entry == 0u) {
+        return -1.0;
+    }
+    int physical = int(entry) - 1;
+    float pageScale = 1.0 / float(vsmPhysicalPagesPerSide);
+    vec2 pageOrigin = vec2(physical % vsmPhysicalPagesPerSide, physical / vsmPhysicalPagesPerSide) * pageScale;
+    vec2 uv = pageOrigin + fract(pageCoord) * pageScale;
+
+    // 2x2 PCF, kept inside the page
+    vec2 texelSize = 1.0 / vec2(textureSize(vsmPhysical, 0));
+    vec2 lo = pageOrigin + texelSize * 0.5;
+    vec2 hi = pageOrigin + pageScale - texelSize * 0.5;
+    float shadow = 0.0;
+    for (int i = 0; i < 4; i++) {
+        vec2 offset = (vec2(i & 1, i >> 1) - 0.5) * texelSize;
+        float closestDepth = texture(vsmPhysical, clamp(uv + offset, lo, hi)).r;
+        shadow += projCoords.z - bias > closestDepth ? 1.0 : 0.0;
+    }
+    return shadow * 0.25;
+}
+
+// shadow from the cascade covering this fragment, -1 beyond the last cascade
+float cascadeShadow(float NdotL) {
+    float viewDepth = -(view * vec4(shadowPosition, 1.0)).z;
+    int cascade = 0;
+    while (cascade < NUM_CASCADES && viewDepth > cascadeSplits[cascade]) {
+        cascade++;
+    }
+    if (cascade == NUM_CASCADES) {
+        return -1.0;
+    }
+    vec4 lightSpace = cascadeMatrices[cascade] * vec4(shadowPosition, 1.0);
+    vec3 projCoords = lightSpace.xyz / lightSpace.w * 0.5 + 0.5;
+    if (projCoords.z > 1.0) {
+        return 0.0;
+    }
+    float bias = cascadeBiasScales[cascade] * (1.0 + 2.0 * (1.0 - NdotL));
+    if (shadowQuality == SHADOW_HARD) {
+        float closestDepth = texture(cascadeShadowMap, vec3(projCoords.xy, cascade)).r;
+        return projCoords.z - bias > closestDepth ? 1.0 : 0.0;
+    }
+    // 3x3 PCF, PCSS falls back to it
+    vec2 texelSize = 1.0 / vec2(textureSize(cascadeShadowMap, 0).xy);
+    float shadow = 0.0;
+    for (int x = -1; x <= 1; x++) {
+        for (int y = -1; y <= 1; y++) {
+            float closestDepth = texture(cascadeShadowMap, vec3(projCoords.xy + vec2(x, y) * texelSize, cascade)).r;
+            shadow += projCoords.z - bias > closestDepth ? 1.0 : 0.0;
+        }
+    }
+    return shadow / 9.0;
+}
+
+float sampleDistanceField(vec3 p) {
+    // outside the box the field is at least as far as the box itself
+    vec3 uvw = (p - distanceFieldMin) / (distanceFieldMax - distanceFieldMin);
+    float outside = length(max(max(distanceFieldMin - p, p - distanceFieldMax), 0.0));
+    float inside = texture(distanceField, clamp(uvw, 0.0, 1.0)).r;
+    return outside > 0.0 ? max(inside, outside) : inside;
+}
+
+// Sphere traces toward the light and keeps the smallest ratio of free distance to the light
+// cone's radius at that point, -1 is fully inside a caster and 1 is clear of the whole cone
+float distanceFieldShadow() {
+    vec3 toLight = lightPos - shadowPosition;
+    float lightDistance = length(toLight);
+    vec3 direction = toLight / lightDistance;
+    // start a voxel and a half off the surface so the receiver doesn't shadow itself
+    vec3 normal = dot(shadowNormal, direction) < 0.0 ? -shadowNormal : shadowNormal;
+    vec3 origin = shadowPosition + normal * (1.5 * distanceFieldVoxelSize);
+    float coneSlope = distanceFieldLightSize / lightDistance;
+
+    float visibility = 1.0;
+    float t = distanceFieldVoxelSize;
+    for (int i = 0; i < 64 && t < lightDistance; i++) {
+        float d = sampleDistanceField(origin + direction * t);
+        visibility = min(visibility, d / (t * coneSlope));
+        if (visibility <= -1.0) {
+            break;
+        }
+        // a minimum step so grazing rays don't stall, a maximum one so the penumbra isn't skipped
+        t += clamp(abs(d), 0.5 * distanceFieldVoxelSize, 4.0 * distanceFieldVoxelSize + 0.25 * t);
+    }
+    return 1.0 - smoothstep(-1.0, 1.0, visibility);
+}
+
+// the main light's orthographic, virtual and cascaded maps
+float shadowMapShadow() {
+    // perspective divide, a reversed projection already has its depth in [0, 1]
+    vec4 fragPosLightSpace = lightSpaceMatrix * vec4(shadowPosition, 1.0);
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    projCoords.xy = projCoords.xy * 0.5 + 0.5;
+    projCoords.z = shadowReversedZ ? projCoords.z : projCoords.z * 0.5 + 0.5;
+    if (forwardDepth(projCoords.z) > 1.0) {
+        return 0.0;
+    }
+    vec3 lightVector = normalize(lightPos - shadowPosition);
+    // slope-scaled by how far the surface recedes across a texel, plus the format's precision
+    float NdotL = max(dot(shadowNormal, lightVector), 0.0);
+    float tanTheta = min(sqrt(1.0 - NdotL * NdotL) / max(NdotL, 1e-3), 8.0);
+    float bias = shadowTexelDepth * (1.0 + tanTheta) + 2.0 * depthStep(projCoords.z);
+
+    // the regular map covers pages that are not resident yet
+    if (virtualShadowsEnabled) {
+        // the virtual map has its own forward depth range
+        float shadow = virtualShadow(max(0.05 * (1.0 - NdotL), 0.005));
+        if (shadow >= 0.0) {
+            return shadow;
+        }
+    }
+
+    if (cascadesEnabled) {
+        float shadow = cascadeShadow(NdotL);
+        if (shadow >= 0.0) {
+            return shadow;
+        }
+    }
+
+    if (shadowQuality == SHADOW_STOCHASTIC) {
+        return stochasticShadow(projCoords, bias);
+    }
+    if (shadowQuality == SHADOW_PCSS) {
+        return pcssShadow(projCoords, bias);
+    }
+    if (shadowQuality == SHADOW_PCF || shadowQuality == SHADOW_DISTANCE_FIELD) {
+        return pcfShadow(projCoords, bias);
+    }
+    return hardShadow(projCoords, bias);
+}
+
+float shadowCalculation() {
+    if (shadowProjection != SHADOW_PROJECTION_ORTHO) {
+        return pointShadow(shadowNormal, normalize(lightPos - shadowPosition));
+    }
+    // in the distance field tier the maps only hold the dynamic casters
+    float shadow = shadowMapShadow();
+    if (shadowQuality == SHADOW_DISTANCE_FIELD && distanceFieldEnabled) {
+        shadow = max(shadow, distanceFieldShadow());
+    }
+    return shadow;
+}
@@ -0,0 +1,58 @@
+#version 460 core
+
+// The main light's shadow at reduced resolution. Every texel rebuilds the surface under the
+// centre of its footprint from the view depth and runs the regular shadow lookup. The linear
+// view depth goes along in G for the bilateral upsample, negative for background.
+
+layout (location = 0) in vec2 TexCoord;
+
+layout (location = 0) out vec2 ShadowAndDepth;
+
+#include "shadow.glsl"
+
+uniform sampler2D viewDepth;
+uniform mat4 inverseViewProjection;
+// the view was rendered with a reversed [0, 1] depth range
+uniform bool reversedZ;
+// full resolution pixels per mask texel along each axis
+uniform int scale;
+uniform vec3 eyePos;
+
+bool isBackground(float depth) {
+    return reversedZ ? depth <= 0.0 : depth >= 1.0;
+}
+
+vec3 worldPosition(ivec2 pixel) {
+    ivec2 size = textureSize(viewDepth, 0);
+    pixel = clamp(pixel, ivec2(0), size - 1);
+    float depth = texelFetch(viewDepth, pixel, 0).r;
+    vec4 ndc = vec4((vec2(pixel) + 0.5) / vec2(size) * 2.0 - 1.0, reversedZ ? depth : depth * 2.0 - 1.0, 1.0);
+    vec4 world = inverseViewProjection * ndc;
+    return world.xyz / world.w;
+}
+
+void main() {
+    ivec2 size = textureSize(viewDepth, 0);
+    ivec2 pixel = min(ivec2(gl_FragCoord.xy) * scale + scale / 2, size - 1);
+    if (isBackground(texelFetch(viewDepth, pixel, 0).r)) {
+        ShadowAndDepth = vec2(0.0, -1.0);
+        return;
+    }
+    vec3 position = worldPosition(pixel);
+
+    // normal from the neighbours, on each axis the closer one so depth edges don't bend it
+    vec3 right = worldPosition(pixel + ivec2(1, 0)) - position;
+    vec3 left = position - worldPosition(pixel - ivec2(1, 0));
+    vec3 up = worldPosition(pixel + ivec2(0, 1)) - position;
+    vec3 down = position - worldPosition(pixel - ivec2(0, 1));
+    vec3 dx = dot(right, right) < dot(left, left) ? right : left;
+    vec3 dy = dot(up, up) < dot(down, down) ? up : down;
+    vec3 normal = normalize(cross(dx, dy));
+    if (dot(normal, eyePos - position) < 0.0) {
+        normal = -normal;
+    }
+
+    shadowPosition = position;
+    shadowNormal = normal;
+    ShadowAndDepth = vec2(shadowCalculation(), -(view * vec4(position, 1.0)).z);
+}
@@ -0,0 +1,49 @@
+#version 460 core
+
+// Accumulates the upsampled shadow mask over frames. Every pixel is reprojected into the previous
+// frame with its view-projection, and the history is only trusted where the linear depth stored
+// there matches the depth the surface had in that frame; elsewhere it starts over.
+
+layout (location = 0) in vec2 TexCoord;
+
+// R accumulated shadow, G linear view depth (negative for background)
+layout (location = 0) out vec2 History;
+
+uniform sampler2D currentShadow;
+uniform sampler2D history;
+uniform bool historyValid;
+uniform sampler2D viewDepth;
+uniform mat4 inverseViewProjection;
+uniform mat4 previousViewProjection;
+uniform mat4 view;
+uniform bool reversedZ;
+// weight of the current frame
+uniform float blend;
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(viewDepth, 0);
+    float depth = texelFetch(viewDepth, pixel, 0).r;
+    if (reversedZ ? depth <= 0.0 : depth >= 1.0) {
+        History = vec2(0.0, -1.0);
+        return;
+    }
+    vec4 ndc = vec4((vec2(pixel) + 0.5) / vec2(size) * 2.0 - 1.0, reversedZ ? depth : depth * 2.0 - 1.0, 1.0);
+    vec4 world = inverseViewProjection * ndc;
+    world /= world.w;
+    float linearDepth = -(view * world).z;
+    float current = texelFetch(currentShadow, pixel, 0).r;
+
+    // w of a perspective clip position is the view depth in that frame
+    vec4 previousClip = previousViewProjection * world;
+    vec2 previousUV = previousClip.xy / previousClip.w * 0.5 + 0.5;
+    bool onScreen = all(greaterThanEqual(previousUV, vec2(0.0))) && all(lessThan(previousUV, vec2(1.0)));
+    if (historyValid && onScreen && previousClip.w > 0.0) {
+        vec2 previous = texture(history, previousUV).rg;
+        if (previous.g > 0.0 && abs(previous.g - previousClip.w) < 0.02 * previousClip.w) {
+            History = vec2(mix(previous.r, current, blend), linearDepth);
+            return;
+        }
+    }
+    History = vec2(current, linearDepth);
+}
@@ -0,0 +1,58 @@
+#version 460 core
+
+// Joint bilateral upsample of the reduced resolution shadow mask: the four mask texels around a
+// pixel are blended bilinearly, weighted down by how far their depth is from the pixel's, so
+// shadows don't bleed across depth edges.
+
+layout (location = 0) in vec2 TexCoord;
+
+layout (location = 0) out float Shadow;
+
+// R shadow, G linear view depth (negative for background)
+uniform sampler2D shadowMaskLow;
+uniform sampler2D viewDepth;
+uniform mat4 inverseProjection;
+uniform bool reversedZ;
+uniform int scale;
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(viewDepth, 0);
+    float depth = texelFetch(viewDepth, pixel, 0).r;
+    if (reversedZ ? depth <= 0.0 : depth >= 1.0) {
+        Shadow = 0.0;
+        return;
+    }
+    vec4 ndc = vec4((vec2(pixel) + 0.5) / vec2(size) * 2.0 - 1.0, reversedZ ? depth : depth * 2.0 - 1.0, 1.0);
+    vec4 viewPos = inverseProjection * ndc;
+    float linearDepth = -viewPos.z / viewPos.w;
+
+    // mask texel centres sit at (i + 0.5) * scale full resolution pixels
+    ivec2 lowSize = textureSize(shadowMaskLow, 0);
+    vec2 lowCoord = (vec2(pixel) + 0.5) / float(scale) - 0.5;
+    ivec2 base = ivec2(floor(lowCoord));
+    vec2 f = fract(lowCoord);
+
+    float shadow = 0.0;
+    float weightSum = 0.0;
+    float closestShadow = 0.0;
+    float closestDifference = 1.0 / 0.0;
+    for (int i = 0; i < 4; i++) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        vec2 sampleValue = texelFetch(shadowMaskLow, clamp(base + offset, ivec2(0), lowSize - 1), 0).rg;
+        if (sampleValue.g < 0.0) {
+            continue;
+        }
+        float difference = abs(sampleValue.g - linearDepth) / linearDepth;
+        if (difference < closestDifference) {
+            closestDifference = difference;
+            closestShadow = sampleValue.r;
+        }
+        float bilinear = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+        float weight = bilinear / (1e-3 + 100.0 * difference);
+        shadow += weight * sampleValue.r;
+        weightSum += weight;
+    }
+    // every neighbour is across an edge: take the closest one in depth
+    Shadow = weightSum > 1e-2 ? shadow / weightSum : closestShadow;
+}
@@ -0,0 +1,383 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "light.h"
+
+// A square region of the atlas. node is -1 when nothing is allocated.
+struct AtlasTile {
+    int x = 0;
+    int y = 0;
+    int size = 0;
+    int node = -1;
+
+    bool valid() const { return node >= 0; }
+};
+
+// Quadtree allocator for power-of-two tiles. A node is either a free leaf, a used leaf
+// or split into four children; freed siblings are merged back into their parent.
+class QuadtreeAllocator {
+public:
+    QuadtreeAllocator(int size, int minSize);
+
+    AtlasTile allocate(int size);
+    void release(const AtlasTile& tile);
+    // area of the used tiles in the quadrant that holds the tile, excluding the tile itself
+    int neighbourUsage(const AtlasTile& tile) const;
+
+private:
+    struct Node {
+        int x, y, size;
+        int parent;
+        int firstChild; // -1 for leaves, children are stored consecutively
+        bool used;
+        int freeArea;
+    };
+
+    int allocate(int node, int size);
+    void split(int node);
+    void updateFreeArea(int node, int delta);
+
+    int _minSize;
+    std::vector<Node> _nodes;
+    std::vector<int> _freeBlocks;
+};
+
+QuadtreeAllocator::QuadtreeAllocator(int size, int minSize) : _minSize(minSize) {
+    _nodes.push_back({ 0, 0, size, -1, -1, false, size * size });
+}
+
+AtlasTile QuadtreeAllocator::allocate(int size) {
+    AtlasTile tile;
+    int node = allocate(0, size);
+    if (node >= 0) {
+        tile.x = _nodes[node].x;
+        tile.y = _nodes[node].y;
+        tile.size = size;
+        tile.node = node;
+    }
+    return tile;
+}
+
+int QuadtreeAllocator::allocate(int node, int size) {
+    if (_nodes[node].size < size || _nodes[node].freeArea < size * size || _nodes[node].used) {
+        return -1;
+    }
+    if (_nodes[node].firstChild < 0) {
+        if (_nodes[node].size == size) {
+            _nodes[node].used = true;
+            updateFreeArea(node, -size * size);
+            return node;
+        }
+        if (_nodes[node].size / 2 < _minSize) {
+            return -1;
+        }
+        split(node);
+    }
+    // best fit: the fullest child that can still take the tile, so large regions stay free
+    int best = -1;
+    for (int i = 0; i < 4; i++) {
+        int child = _nodes[node].firstChild + i;
+        const Node& c = _nodes[child];
+        if (c.used || c.size < size || c.freeArea < size * size) {
+            continue;
+        }
+        if (best < 0 || c.freeArea < _nodes[best].freeArea) {
+            best = child;
+        }
+    }
+    if (best >= 0) {
+        int result = allocate(best, size);
+        if (result >= 0) {
+            return result;
+        }
+    }
+    // free area may be fragmented below the best child, fall back to the others
+    for (int i = 0; i < 4; i++) {
+        int child = _nodes[node].firstChild + i;
+        if (child == best) {
+            continue;
+        }
+        int result = allocate(child, size);
+        if (result >= 0) {
+            return result;
+        }
+    }
+    return -1;
+}
+
+void QuadtreeAllocator::split(int node) {
+    int first;
+    if (!_freeBlocks.empty()) {
+        first = _freeBlocks.back();
+        _freeBlocks.pop_back();
+    } else {
+        first = (int)_nodes.size();
+        _nodes.resize(_nodes.size() + 4);
+    }
+    int half = _nodes[node].size / 2;
+    for (int i = 0; i < 4; i++) {
+        int x = _nodes[node].x + (i & 1) * half;
+        int y = _nodes[node].y + (i >> 1) * half;
+        _nodes[first + i] = { x, y, half, node, -1, false, half * half };
+    }
+    _nodes[node].firstChild = first;
+}
+
+void QuadtreeAllocator::updateFreeArea(int node, int delta) {
+    for (; node >= 0; node = _nodes[node].parent) {
+        _nodes[node].freeArea += delta;
+    }
+}
+
+void QuadtreeAllocator::release(const AtlasTile& tile) {
+    if (!tile.valid()) {
+        return;
+    }
+    int node = tile.node;
+    _nodes[node].used = false;
+    updateFreeArea(node, tile.size * tile.size);
+
+    // merge parents whose children are all free leaves again
+    for (int parent = _nodes[node].parent; parent >= 0; parent = _nodes[parent].parent) {
+        Node& p = _nodes[parent];
+        if (p.freeArea != p.size * p.size) {
+            break;
+        }
+        _freeBlocks.push_back(p.firstChild);
+        p.firstChild = -1;
+    }
+}
+
+int QuadtreeAllocator::neighbourUsage(const AtlasTile& tile) const {
+    int parent = _nodes[tile.node].parent;
+    if (parent < 0) {
+        return 0;
+    }
+    const Node& p = _nodes[parent];
+    return p.size * p.size - p.freeArea - tile.size * tile.size;
+}
+
+
+// One large depth texture shared by every shadowed spot light. Each light gets a power-of-two
+// tile sized by its importance on screen; all tiles are rendered into the same framebuffer by
+// moving the viewport, so many shadowed lights cost no framebuffer or texture switches.
+class ShadowAtlas {
+public:
+    static const int MAX_LIGHTS = 64;
+
+    ShadowAtlas(int size, int minTileSize, int maxTileSize);
+
+    // (re)assigns tiles from the per-light importance (see screenCoverage) and moves at
+    // most one tile per call to defragment the atlas
+    void allocate(const std::vector<float>& importance);
+    const AtlasTile& tile(int light) const { return _tiles[light]; }
+    // true when the light's tile was (re)assigned by the last allocate() and has no valid content yet
+    bool tileChanged(int light) const { return _changed[light]; }
+    void markRendered(int light) { _changed[light] = false; }
+
+    // binds the atlas framebuffer once for all lights
+    void begin();
+    // restricts rendering to the light's tile and clears it, false when the light has no tile.
+    // The matrix is kept with the tile, so tiles that are not re-rendered keep matching their content
+    bool beginTile(int light, const glm::mat4& lightSpaceMatrix);
+    void end();
+
+    // fills the uniform block read by basic.frag, shading uses the current light parameters
+    void uploadLights(const std::vector<SpotLight>& lights);
+    GLuint texture() const { return _texture; }
+    GLuint uniformBuffer() const { return _ubo; }
+    int size() const { return _size; }
+    int relocations() const { return _relocations; }
+    void deleteGLResources();
+
+private:
+    // std140 layout of the AtlasLights block in basic.frag
+    struct LightBlock {
+        glm::mat4 matrices[MAX_LIGHTS];
+        glm::vec4 rects[MAX_LIGHTS];      // xy offset, zw scale in atlas UV, zero scale without a tile
+        glm::vec4 positions[MAX_LIGHTS];  // xyz position, w range
+        glm::vec4 directions[MAX_LIGHTS]; // xyz direction, w cos(outer angle)
+        glm::vec4 colors[MAX_LIGHTS];     // rgb color, w cos(inner angle)
+        glm::ivec4 count;
+    };
+
+    int tileSizeFor(float importance) const;
+    void defragment();
+
+    int _size;
+    int _minTileSize;
+    int _maxTileSize;
+    QuadtreeAllocator _allocator;
+    std::vector<AtlasTile> _tiles;
+    std::vector<bool> _changed;
+    std::vector<glm::mat4> _matrices;
+    int _relocations = 0;
+    LightBlock _block;
+
+    GLuint _texture;
+    GLuint _fbo;
+    GLuint _ubo;
+};
+
+ShadowAtlas::ShadowAtlas(int size, int minTileSize, int maxTileSize)
+    : _size(size), _minTileSize(minTileSize), _maxTileSize(maxTileSize), _allocator(size, minTileSize) {
+    glGenTextures(1, &_texture);
+    glBindTexture(GL_TEXTURE_2D, _texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenFramebuffers(1, &_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _texture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(1, &_ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, _ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+int ShadowAtlas::tileSizeFor(float importance) const {
+    if (importance <= 0.0f) {
+        return 0;
+    }
+    // a light filling the screen gets the largest tile, every halving of coverage halves the tile
+    int size = _maxTileSize;
+    while (size > _minTileSize && importance * _maxTileSize <= size / 2) {
+        size /= 2;
+    }
+    return size;
+}
+
+void ShadowAtlas::allocate(const std::vector<float>& importance) {
+    int count = std::min((int)importance.size(), MAX_LIGHTS);
+    for (int i = count; i < (int)_tiles.size(); i++) {
+        _allocator.release(_tiles[i]);
+    }
+    _tiles.resize(count);
+    _changed.resize(count, false);
+    _matrices.resize(count, glm::mat4(1.0f));
+
+    // release shrinking tiles first so growing ones can reuse the space
+    std::vector<int> wanted(count);
+    for (int i = 0; i < count; i++) {
+        wanted[i] = tileSizeFor(importance[i]);
+        int current = _tiles[i].valid() ? _tiles[i].size : 0;
+        // only shrink once the light is well below the threshold, so tiles don't flicker between sizes
+        if (wanted[i] < current && tileSizeFor(importance[i] * 1.5f) >= current) {
+            wanted[i] = current;
+        }
+        if (wanted[i] < current) {
+            _allocator.release(_tiles[i]);
+            _tiles[i] = AtlasTile();
+        }
+    }
+
+    // grow the most important lights first
+    std::vector<int> order(count);
+    for (int i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return importance[a] > importance[b]; });
+    for (int i : order) {
+        if (wanted[i] == 0) {
+            _allocator.release(_tiles[i]);
+            _tiles[i] = AtlasTile();
+            continue;
+        }
+        if (_tiles[i].valid() && _tiles[i].size == wanted[i]) {
+            continue;
+        }
+        AtlasTile previous = _tiles[i];
+        _allocator.release(previous);
+        // settle for a smaller tile when the atlas is full
+        AtlasTile tile;
+        for (int size = wanted[i]; size >= _minTileSize && !tile.valid(); size /= 2) {
+            tile = _allocator.allocate(size);
+        }
+        _tiles[i] = tile;
+        _changed[i] = _changed[i] || tile.node != previous.node || tile.size != previous.size;
+    }
+
+    defragment();
+}
+
+void ShadowAtlas::defragment() {
+    // move one tile from a sparse quadrant into a fuller one, which over time empties whole
+    // quadrants and keeps room for large tiles
+    for (int i = 0; i < (int)_tiles.size(); i++) {
+        if (!_tiles[i].valid()) {
+            continue;
+        }
+        AtlasTile candidate = _allocator.allocate(_tiles[i].size);
+        if (!candidate.valid()) {
+            continue;
+        }
+        if (_allocator.neighbourUsage(candidate) > _allocator.neighbourUsage(_tiles[i])) {
+            _allocator.release(_tiles[i]);
+            _tiles[i] = candidate;
+            _changed[i] = true;
+            _relocations++;
+            return;
+        }
+        _allocator.release(candidate);
+    }
+}
+
+void ShadowAtlas::begin() {
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glEnable(GL_SCISSOR_TEST);
+}
+
+bool ShadowAtlas::beginTile(int light, const glm::mat4& lightSpaceMatrix) {
+    const AtlasTile& tile = _tiles[light];
+    if (!tile.valid()) {
+        return false;
+    }
+    _matrices[light] = lightSpaceMatrix;
+    glViewport(tile.x, tile.y, tile.size, tile.size);
+    glScissor(tile.x, tile.y, tile.size, tile.size);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    return true;
+}
+
+void ShadowAtlas::end() {
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowAtlas::uploadLights(const std::vector<SpotLight>& lights) {
+    LightBlock& block = _block;
+    int count = std::min((int)lights.size(), std::min((int)_tiles.size(), MAX_LIGHTS));
+    for (int i = 0; i < count; i++) {
+        const SpotLight& light = lights[i];
+        const AtlasTile& tile = _tiles[i];
+        block.matrices[i] = _matrices[i];
+        block.rects[i] = tile.valid() ? glm::vec4(tile.x, tile.y, tile.size, tile.size) / (float)_size : glm::vec4(0.0f);
+        block.positions[i] = glm::vec4(light.position, light.range);
+        block.directions[i] = glm::vec4(glm::normalize(light.direction), std::cos(glm::radians(light.outerAngle)));
+        block.colors[i] = glm::vec4(light.color, std::cos(glm::radians(light.innerAngle)));
+    }
+    block.count = glm::ivec4(count, 0, 0, 0);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, _ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightBlock), &block);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void ShadowAtlas::deleteGLResources() {
+    glDeleteTextures(1, &_texture);
+    glDeleteFramebuffers(1, &_fbo);
+    glDeleteBuffers(1, &_ubo);
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+#include "shader.h"
+
+// Deferred shadow mask for the main light. After a depth prepass the shadow lookup runs once per
+// texel of a half or quarter resolution target instead of once per lit fragment, then a depth-aware
+// bilateral filter brings it back to full resolution where the lit pass reads a single texel.
+// The cost of the PCF/PCSS filtering scales with the mask instead of the overdraw. With temporal
+// accumulation the mask is also blended into a reprojected history, which turns the few noisy
+// taps per frame of the stochastic tier into a smooth wide kernel.
+class ShadowMask {
+public:
+    ShadowMask(unsigned int width, unsigned int height, int scale);
+
+    // 2 for half, 4 for quarter resolution
+    void setScale(int scale);
+    int scale() const { return _scale; }
+    // takes the same shadow uniforms and textures as the lit pass
+    Shader* maskShader() const { return _maskShader; }
+    // renders the mask from the prepass depth and upsamples it, then optionally accumulates it
+    // with last frame's history; leaves the default framebuffer bound
+    void render(GLuint viewDepth, const glm::mat4& projection, const glm::mat4& view, bool reversedZ,
+                bool temporal, const glm::mat4& previousViewProjection);
+    // full resolution mask, shadow in R
+    GLuint texture() const { return _temporal ? _historyTextures[_history] : _texture; }
+    void deleteGLResources();
+
+private:
+    void allocateLowResolution();
+
+    unsigned int _width;
+    unsigned int _height;
+    int _scale;
+    GLuint _lowTexture;
+    GLuint _lowFbo;
+    GLuint _texture;
+    GLuint _fbo;
+    // ping-ponged accumulation targets, _history is the one written last
+    GLuint _historyTextures[2];
+    GLuint _historyFbos[2];
+    int _history = 0;
+    bool _temporal = false;
+    bool _historyValid = false;
+    GLuint _emptyVAO;
+    Shader* _maskShader;
+    Shader* _upsampleShader;
+    Shader* _temporalShader;
+};
+
+ShadowMask::ShadowMask(unsigned int width, unsigned int height, int scale) : _width(width), _height(height), _scale(scale) {
+    glGenTextures(1, &_lowTexture);
+    glGenFramebuffers(1, &_lowFbo);
+    allocateLowResolution();
+
+    glGenTextures(1, &_texture);
+    glBindTexture(GL_TEXTURE_2D, _texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glGenFramebuffers(1, &_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ERROR::FRAMEBUFFER:: Shadow mask framebuffer is not complete!" << std::endl;
+    }
+
+    // shadow in R, linear view depth in G for the reprojection test
+    glGenTextures(2, _historyTextures);
+    glGenFramebuffers(2, _historyFbos);
+    for (int i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D, _historyTextures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width, height, 0, GL_RG, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindFramebuffer(GL_FRAMEBUFFER, _historyFbos[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _historyTextures[i], 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "ERROR::FRAMEBUFFER:: Shadow history framebuffer is not complete!" << std::endl;
+        }
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // core profile refuses to draw without a VAO bound, even for attribute-less draws
+    glGenVertexArrays(1, &_emptyVAO);
+    _maskShader = new Shader("shaders/fullscreen.vert", "shaders/shadowMask.frag");
+    _upsampleShader = new Shader("shaders/fullscreen.vert", "shaders/shadowUpsample.frag");
+    _temporalShader = new Shader("shaders/fullscreen.vert", "shaders/shadowTemporal.frag");
+}
+
+void ShadowMask::allocateLowResolution() {
+    // shadow in R, linear view depth in G
+    glBindTexture(GL_TEXTURE_2D, _lowTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, (_width + _scale - 1) / _scale, (_height + _scale - 1) / _scale, 0, GL_RG, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindFramebuffer(GL_FRAMEBUFFER, _lowFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _lowTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ERROR::FRAMEBUFFER:: Low resolution shadow mask framebuffer is not complete!" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowMask::setScale(int scale) {
+    if (scale == _scale) {
+        return;
+    }
+    _scale = scale;
+    allocateLowResolution();
+}
+
+void ShadowMask::render(GLuint viewDepth, const glm::mat4& projection, const glm::mat4& view, bool reversedZ,
+                        bool temporal, const glm::mat4& previousViewProjection) {
+    glBindVertexArray(_emptyVAO);
+    glDisable(GL_DEPTH_TEST);
+
+    // the shadow textures occupy units 0-7
+    glBindFramebuffer(GL_FRAMEBUFFER, _lowFbo);
+    glViewport(0, 0, (_width + _scale - 1) / _scale, (_height + _scale - 1) / _scale);
+    _maskShader->use();
+    _maskShader->setInt("viewDepth", 8);
+    _maskShader->setMat4("inverseViewProjection", glm::inverse(projection * view));
+    _maskShader->setBool("reversedZ", reversedZ);
+    _maskShader->setInt("scale", _scale);
+    _maskShader->setVec3("eyePos", glm::vec3(glm::inverse(view)[3]));
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, viewDepth);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glViewport(0, 0, _width, _height);
+    _upsampleShader->use();
+    _upsampleShader->setInt("shadowMaskLow", 0);
+    _upsampleShader->setInt("viewDepth", 1);
+    _upsampleShader->setMat4("inverseProjection", glm::inverse(projection));
+    _upsampleShader->setBool("reversedZ", reversedZ);
+    _upsampleShader->setInt("scale", _scale);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _lowTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, viewDepth);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // a frame without accumulation leaves the history stale
+    _temporal = temporal;
+    if (!temporal) {
+        _historyValid = false;
+    } else {
+        int previous = _history;
+        _history = 1 - _history;
+        glBindFramebuffer(GL_FRAMEBUFFER, _historyFbos[_history]);
+        _temporalShader->use();
+        _temporalShader->setInt("currentShadow", 0);
+        _temporalShader->setInt("history", 1);
+        _temporalShader->setInt("viewDepth", 2);
+        _temporalShader->setBool("historyValid", _historyValid);
+        _temporalShader->setMat4("inverseViewProjection", glm::inverse(projection * view));
+        _temporalShader->setMat4("previousViewProjection", previousViewProjection);
+        _temporalShader->setMat4("view", view);
+        _temporalShader->setBool("reversedZ", reversedZ);
+        _temporalShader->setFloat("blend", 0.1f);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, _texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, _historyTextures[previous]);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, viewDepth);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        _historyValid = true;
+    }
+
+    glEnable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindVertexArray(0);
+}
+
+void ShadowMask::deleteGLResources() {
+    glDeleteTextures(1, &_lowTexture);
+    glDeleteFramebuffers(1, &_lowFbo);
+    glDeleteTextures(1, &_texture);
+    glDeleteFramebuffers(1, &_fbo);
+    glDeleteTextures(2, _historyTextures);
+    glDeleteFramebuffers(2, _historyFbos);
+    glDeleteVertexArrays(1, &_emptyVAO);
+    delete _maskShader;
+    delete _upsampleShader;
+    delete _temporalShader;
+}
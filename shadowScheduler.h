@@ -0,0 +1,141 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+// What the scheduler needs to know about a shadowed light this frame.
+struct ShadowRequest {
+    glm::vec3 position;
+    glm::vec3 direction;
+    // fraction of the screen covered by the light's range (see screenCoverage)
+    float coverage;
+    // distance from the camera to the light
+    float distance;
+    // casters the light would draw if it were updated
+    int casters;
+    // the light has no valid shadow map (e.g. its atlas tile was just reassigned)
+    bool mustUpdate;
+};
+
+// Decides which shadow maps are re-rendered each frame. Lights are scored by screen coverage,
+// distance, movement and time since their last update, and the highest scoring ones are updated
+// until the per-frame budget (casters drawn or estimated GPU microseconds) is spent. The rest keep
+// the shadow map they rendered earlier.
+class ShadowScheduler {
+public:
+    enum BudgetType {
+        BUDGET_CASTERS,
+        BUDGET_GPU_MICROSECONDS
+    };
+
+    ShadowScheduler(BudgetType type, float budget) : _type(type), _budget(budget) {}
+
+    void setBudget(BudgetType type, float budget) { _type = type; _budget = budget; }
+    BudgetType budgetType() const { return _type; }
+    float budget() const { return _budget; }
+
+    // returns the lights to update this frame, highest priority first
+    const std::vector<int>& schedule(const std::vector<ShadowRequest>& requests);
+    // feeds back the measured cost of the last scheduled updates
+    void reportCost(int castersDrawn, float gpuMilliseconds);
+
+    int lightCount() const { return (int)_lights.size(); }
+    // smoothed fraction of frames in which the light was updated
+    float updateFrequency(int light) const { return light < (int)_lights.size() ? _lights[light].frequency : 0.0f; }
+    // frames whose mandatory updates did not fit into the budget
+    int overruns() const { return _overruns; }
+    // budget spent by the last schedule() in the budget's unit
+    float spent() const { return _spent; }
+
+private:
+    struct LightState {
+        glm::vec3 position{0.0f};
+        glm::vec3 direction{0.0f};
+        long lastUpdate = -1;
+        float frequency = 0.0f;
+    };
+
+    float cost(const ShadowRequest& request) const;
+
+    BudgetType _type;
+    float _budget;
+    long _frame = 0;
+    int _overruns = 0;
+    float _spent = 0.0f;
+    // running estimate of the GPU time per drawn caster
+    float _microsecondsPerCaster = 20.0f;
+    std::vector<LightState> _lights;
+    std::vector<int> _selected;
+};
+
+float ShadowScheduler::cost(const ShadowRequest& request) const {
+    if (_type == BUDGET_CASTERS) {
+        return (float)request.casters;
+    }
+    return request.casters * _microsecondsPerCaster;
+}
+
+const std::vector<int>& ShadowScheduler::schedule(const std::vector<ShadowRequest>& requests) {
+    _frame++;
+    _lights.resize(requests.size());
+    _selected.clear();
+
+    std::vector<float> score(requests.size(), 0.0f);
+    std::vector<int> candidates;
+    for (int i = 0; i < (int)requests.size(); i++) {
+        const ShadowRequest& request = requests[i];
+        const LightState& state = _lights[i];
+        if (request.coverage <= 0.0f && !request.mustUpdate) {
+            continue;
+        }
+        bool moved = state.lastUpdate < 0 ||
+                     glm::length(request.position - state.position) > 1e-4f ||
+                     glm::length(request.direction - state.direction) > 1e-4f;
+        float framesSinceUpdate = state.lastUpdate < 0 ? 1000.0f : (float)(_frame - state.lastUpdate);
+        // static lights still get refreshed now and then, in case their casters moved
+        score[i] = request.coverage / (1.0f + 0.1f * request.distance) *
+                   (moved ? 1.0f : 0.1f) * (1.0f + 0.5f * framesSinceUpdate);
+        candidates.push_back(i);
+    }
+    std::sort(candidates.begin(), candidates.end(), [&](int a, int b) {
+        if (requests[a].mustUpdate != requests[b].mustUpdate) {
+            return requests[a].mustUpdate;
+        }
+        return score[a] > score[b];
+    });
+
+    _spent = 0.0f;
+    for (int i : candidates) {
+        float c = cost(requests[i]);
+        // mandatory updates always run, the highest priority light always gets a turn
+        if (requests[i].mustUpdate || _selected.empty() || _spent + c <= _budget) {
+            _selected.push_back(i);
+            _spent += c;
+        }
+    }
+    if (_spent > _budget) {
+        _overruns++;
+    }
+
+    std::vector<bool> updated(requests.size(), false);
+    for (int i : _selected) {
+        updated[i] = true;
+        _lights[i].position = requests[i].position;
+        _lights[i].direction = requests[i].direction;
+        _lights[i].lastUpdate = _frame;
+    }
+    for (int i = 0; i < (int)_lights.size(); i++) {
+        _lights[i].frequency = 0.95f * _lights[i].frequency + (updated[i] ? 0.05f : 0.0f);
+    }
+    return _selected;
+}
+
+void ShadowScheduler::reportCost(int castersDrawn, float gpuMilliseconds) {
+    if (castersDrawn <= 0 || gpuMilliseconds <= 0.0f) {
+        return;
+    }
+    float microseconds = gpuMilliseconds * 1000.0f / castersDrawn;
+    _microsecondsPerCaster = 0.9f * _microsecondsPerCaster + 0.1f * microseconds;
+}
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Job system on a fixed set of worker threads. Every thread owns a deque of tasks: it pushes and
+// pops at the back, and a thread that runs out steals from the front of another thread's deque,
+// so uneven pieces (tiles full of geometry next to empty sky) don't leave threads idle.
+// parallelFor() splits its indices into a few chunks per thread and blocks until every index has
+// run. A frame's work is a job graph: addJob() jobs with the jobs they depend on, then runJobs()
+// runs each one as soon as its dependency counter reaches zero. A thread waiting on a loop or on
+// the graph runs tasks instead of sleeping, so jobs can use parallelFor() themselves, and a pool
+// with no workers runs everything on the calling thread.
+class ThreadPool {
+public:
+    // 0 picks one worker per hardware thread beyond the calling one
+    ThreadPool(int workers = 0);
+    ~ThreadPool();
+
+    void parallelFor(int count, const std::function<void(int)>& body);
+    // the indices below count that keep() accepts, in increasing order
+    std::vector<int> parallelFilter(int count, const std::function<bool(int)>& keep);
+    int threadCount() const { return (int)_workers.size() + 1; }
+
+    // dependencies are indices addJob() returned since the last runJobs()
+    int addJob(std::function<void()> work, const std::vector<int>& dependencies = {});
+    // runs every added job, each after its dependencies, and forgets them
+    void runJobs();
+
+private:
+    typedef std::function<void()> Task;
+
+    struct Deque {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct Job {
+        std::function<void()> work;
+        // dependencies that haven't finished yet
+        std::atomic<int> waitingOn{0};
+        std::vector<int> dependents;
+    };
+
+    // which pool and deque the current thread works on, threads outside the pool use deque 0
+    struct ThreadSlot {
+        const ThreadPool* pool = nullptr;
+        int index = 0;
+    };
+    static ThreadSlot& threadSlot();
+    int currentDeque() const;
+
+    void push(int self, std::vector<Task>& tasks);
+    bool pop(int self, Task& task);
+    bool steal(int self, Task& task);
+    // runs one task from its own deque or a stolen one, false when there was nothing to run
+    bool runOne(int self);
+    void runJob(int index);
+    void workerLoop(int self);
+
+    // indices per thread in a parallelFor(), more chunks balance better but cost more pushes
+    static const int CHUNKS_PER_THREAD = 8;
+    // indices per parallelFilter() block, each block collects into its own list
+    static const int FILTER_BLOCK = 1024;
+
+    std::vector<std::thread> _workers;
+    // one per thread, the calling thread is 0
+    std::vector<std::unique_ptr<Deque>> _deques;
+    // tasks pushed and not taken yet, sleeping workers wait for it to become positive
+    std::atomic<int> _queued{0};
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stopping = false;
+    std::vector<std::unique_ptr<Job>> _jobs;
+    std::atomic<int> _jobsLeft{0};
+};
+
+ThreadPool::ThreadPool(int workers) {
+    if (workers <= 0) {
+        workers = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+    }
+    for (int i = 0; i <= workers; i++) {
+        _deques.emplace_back(new Deque());
+    }
+    for (int i = 0; i < workers; i++) {
+        _workers.emplace_back(&ThreadPool::workerLoop, this, i + 1);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+    for (std::thread& worker : _workers) {
+        worker.join();
+    }
+}
+
+ThreadPool::ThreadSlot& ThreadPool::threadSlot() {
+    static thread_local ThreadSlot slot;
+    return slot;
+}
+
+int ThreadPool::currentDeque() const {
+    const ThreadSlot& slot = threadSlot();
+    return slot.pool == this ? slot.index : 0;
+}
+
+void ThreadPool::push(int self, std::vector<Task>& tasks) {
+    {
+        std::lock_guard<std::mutex> lock(_deques[self]->mutex);
+        for (Task& task : tasks) {
+            _deques[self]->tasks.push_back(std::move(task));
+        }
+    }
+    {
+        // counted under _mutex so a worker about to sleep can't miss it
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queued += (int)tasks.size();
+    }
+    if (tasks.size() == 1) {
+        _wake.notify_one();
+    } else {
+        _wake.notify_all();
+    }
+}
+
+bool ThreadPool::pop(int self, Task& task) {
+    Deque& own = *_deques[self];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (own.tasks.empty()) {
+        return false;
+    }
+    task = std::move(own.tasks.back());
+    own.tasks.pop_back();
+    _queued--;
+    return true;
+}
+
+bool ThreadPool::steal(int self, Task& task) {
+    int threads = (int)_deques.size();
+    for (int i = 1; i < threads; i++) {
+        Deque& victim = *_deques[(self + i) % threads];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty()) {
+            continue;
+        }
+        // the oldest task, usually the biggest piece left and the one its owner needs last
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        _queued--;
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::runOne(int self) {
+    Task task;
+    if (!pop(self, task) && !steal(self, task)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(int self) {
+    threadSlot().pool = this;
+    threadSlot().index = self;
+    while (true) {
+        if (runOne(self)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wake.wait(lock, [&] { return _stopping || _queued > 0; });
+        if (_stopping) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& body) {
+    if (count <= 0) {
+        return;
+    }
+    int chunks = std::min(count, threadCount() * CHUNKS_PER_THREAD);
+    if (_workers.empty() || chunks == 1) {
+        for (int i = 0; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    std::atomic<int> remaining{chunks};
+    std::vector<Task> tasks;
+    tasks.reserve(chunks);
+    for (int chunk = 0; chunk < chunks; chunk++) {
+        int first = (int)((long long)count * chunk / chunks);
+        int end = (int)((long long)count * (chunk + 1) / chunks);
+        tasks.push_back([&body, &remaining, first, end] {
+            for (int i = first; i < end; i++) {
+                body(i);
+            }
+            remaining.fetch_sub(1, std::memory_order_release);
+        });
+    }
+    int self = currentDeque();
+    push(self, tasks);
+    // help until every chunk is done, with whatever tasks are around
+    while (remaining.load(std::memory_order_acquire) > 0) {
+        if (!runOne(self)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+std::vector<int> ThreadPool::parallelFilter(int count, const std::function<bool(int)>& keep) {
+    std::vector<int> kept;
+    if (count <= FILTER_BLOCK || _workers.empty()) {
+        for (int i = 0; i < count; i++) {
+            if (keep(i)) {
+                kept.push_back(i);
+            }
+        }
+        return kept;
+    }
+    int blocks = (count + FILTER_BLOCK - 1) / FILTER_BLOCK;
+    std::vector<std::vector<int>> blockKept(blocks);
+    parallelFor(blocks, [&](int block) {
+        int end = std::min((block + 1) * FILTER_BLOCK, count);
+        for (int i = block * FILTER_BLOCK; i < end; i++) {
+            if (keep(i)) {
+                blockKept[block].push_back(i);
+            }
+        }
+    });
+    for (const std::vector<int>& indices : blockKept) {
+        kept.insert(kept.end(), indices.begin(), indices.end());
+    }
+    return kept;
+}
+
+int ThreadPool::addJob(std::function<void()> work, const std::vector<int>& dependencies) {
+    int index = (int)_jobs.size();
+    _jobs.emplace_back(new Job());
+    _jobs[index]->work = std::move(work);
+    _jobs[index]->waitingOn = (int)dependencies.size();
+    for (int dependency : dependencies) {
+        _jobs[dependency]->dependents.push_back(index);
+    }
+    return index;
+}
+
+void ThreadPool::runJob(int index) {
+    Job& job = *_jobs[index];
+    job.work();
+    // the last dependency to finish makes the job ready, it goes on this thread's deque
+    std::vector<Task> ready;
+    for (int dependent : job.dependents) {
+        if (_jobs[dependent]->waitingOn.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            ready.push_back([this, dependent] { runJob(dependent); });
+        }
+    }
+    if (!ready.empty()) {
+        push(currentDeque(), ready);
+    }
+    _jobsLeft.fetch_sub(1, std::memory_order_release);
+}
+
+void ThreadPool::runJobs() {
+    if (_jobs.empty()) {
+        return;
+    }
+    _jobsLeft = (int)_jobs.size();
+    std::vector<Task> ready;
+    for (int i = 0; i < (int)_jobs.size(); i++) {
+        if (_jobs[i]->waitingOn == 0) {
+            ready.push_back([this, i] { runJob(i); });
+        }
+    }
+    int self = currentDeque();
+    push(self, ready);
+    while (_jobsLeft.load(std::memory_order_acquire) > 0) {
+        if (!runOne(self)) {
+            std::this_thread::yield();
+        }
+    }
+    _jobs.clear();
+}
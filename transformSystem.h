@@ -0,0 +1,194 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "threadPool.h"
+
+// Position, rotation and scale of everything placed in the scene, kept in parallel arrays next to
+// the matrices derived from them. The setters only mark a transform dirty; update() recomputes
+// the dirty world matrices in batches spread over the thread pool, one level of the hierarchy at
+// a time so parents are done before their children, and the normal matrices and light-space MVPs
+// along with them. A parent has to exist before its children, so its index is always lower.
+class TransformSystem {
+public:
+    static const int NO_PARENT = -1;
+
+    // the matrices are valid right away, relative to the parent's current world matrix
+    int create(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale, int parent = NO_PARENT);
+    int size() const { return (int)_positions.size(); }
+
+    void setPosition(int index, const glm::vec3& position);
+    void setRotation(int index, const glm::quat& rotation);
+    void setScale(int index, const glm::vec3& scale);
+    const glm::vec3& position(int index) const { return _positions[index]; }
+    const glm::quat& rotation(int index) const { return _rotations[index]; }
+    const glm::vec3& scale(int index) const { return _scales[index]; }
+    int parent(int index) const { return _parents[index]; }
+
+    // recomputes everything below a changed transform, and every light-space MVP when the light's matrix changed
+    void update(const glm::mat4& lightSpaceMatrix, ThreadPool* pool);
+    const glm::mat4& world(int index) const { return _worlds[index]; }
+    // inverse transpose of the world matrix's upper 3x3 up to a positive factor, normalize what it
+    // transforms. With uniform scale all the way up the hierarchy it is the upper 3x3 itself
+    const glm::mat3& normalMatrix(int index) const { return _normalMatrices[index]; }
+    // the light-space matrix of the last update() times the world matrix
+    const glm::mat4& lightSpaceMvp(int index) const { return _lightSpaceMvps[index]; }
+    // indices of the world matrices the last update() recomputed, parents before their children
+    const std::vector<int>& updated() const { return _updated; }
+    int updatedCount() const { return (int)_updated.size(); }
+
+private:
+    glm::mat4 local(int index) const;
+    void computeMatrices(int index);
+
+    // transforms per update() task
+    static const int BATCH_SIZE = 4096;
+
+    std::vector<glm::vec3> _positions;
+    std::vector<glm::quat> _rotations;
+    std::vector<glm::vec3> _scales;
+    std::vector<int> _parents;
+    std::vector<uint8_t> _dirty;
+    // the transform and all its parents scale uniformly and positively
+    std::vector<uint8_t> _uniformScale;
+    std::vector<glm::mat4> _worlds;
+    std::vector<glm::mat3> _normalMatrices;
+    std::vector<glm::mat4> _lightSpaceMvps;
+    // indices of every level of the hierarchy below the roots, the roots are everything else
+    std::vector<std::vector<int>> _childLevels;
+    std::vector<int> _levelOf;
+    glm::mat4 _lightSpaceMatrix{1.0f};
+    std::vector<int> _updated;
+    // what each batch of a level recomputed, kept so the lists don't reallocate every frame
+    std::vector<std::vector<int>> _batchUpdated;
+};
+
+int TransformSystem::create(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale, int parent) {
+    int index = size();
+    _positions.push_back(position);
+    _rotations.push_back(rotation);
+    _scales.push_back(scale);
+    _parents.push_back(parent);
+    _dirty.push_back(0);
+    _uniformScale.push_back(0);
+    _worlds.emplace_back(1.0f);
+    _normalMatrices.emplace_back(1.0f);
+    _lightSpaceMvps.emplace_back(1.0f);
+    int level = parent == NO_PARENT ? 0 : _levelOf[parent] + 1;
+    _levelOf.push_back(level);
+    if (level > 0) {
+        if ((int)_childLevels.size() < level) {
+            _childLevels.resize(level);
+        }
+        _childLevels[level - 1].push_back(index);
+    }
+    computeMatrices(index);
+    return index;
+}
+
+void TransformSystem::setPosition(int index, const glm::vec3& position) {
+    _positions[index] = position;
+    _dirty[index] = 1;
+}
+
+void TransformSystem::setRotation(int index, const glm::quat& rotation) {
+    _rotations[index] = rotation;
+    _dirty[index] = 1;
+}
+
+void TransformSystem::setScale(int index, const glm::vec3& scale) {
+    _scales[index] = scale;
+    _dirty[index] = 1;
+}
+
+glm::mat4 TransformSystem::local(int index) const {
+    // translate * rotate * scale without the full matrix products
+    const glm::quat& q = _rotations[index];
+    const glm::vec3& s = _scales[index];
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+    glm::mat4 m;
+    m[0] = glm::vec4((1.0f - 2.0f * (yy + zz)) * s.x, 2.0f * (xy + wz) * s.x, 2.0f * (xz - wy) * s.x, 0.0f);
+    m[1] = glm::vec4(2.0f * (xy - wz) * s.y, (1.0f - 2.0f * (xx + zz)) * s.y, 2.0f * (yz + wx) * s.y, 0.0f);
+    m[2] = glm::vec4(2.0f * (xz + wy) * s.z, 2.0f * (yz - wx) * s.z, (1.0f - 2.0f * (xx + yy)) * s.z, 0.0f);
+    m[3] = glm::vec4(_positions[index], 1.0f);
+    return m;
+}
+
+void TransformSystem::computeMatrices(int index) {
+    int parent = _parents[index];
+    _worlds[index] = parent == NO_PARENT ? local(index) : _worlds[parent] * local(index);
+    const glm::vec3& s = _scales[index];
+    _uniformScale[index] = s.x > 0.0f && s.x == s.y && s.y == s.z && (parent == NO_PARENT || _uniformScale[parent]);
+    glm::vec3 a(_worlds[index][0]), b(_worlds[index][1]), c(_worlds[index][2]);
+    if (_uniformScale[index]) {
+        // rotation times a positive scale, its inverse transpose is the same rotation
+        _normalMatrices[index] = glm::mat3(a, b, c);
+    } else {
+        // the inverse transpose of [a b c] is [b x c, c x a, a x b] / det, the sign of det keeps mirrored normals pointing out
+        glm::vec3 bc = glm::cross(b, c);
+        float determinant = glm::dot(a, bc);
+        float sign = determinant < 0.0f ? -1.0f : 1.0f;
+        _normalMatrices[index] = glm::mat3(bc * sign, glm::cross(c, a) * sign, glm::cross(a, b) * sign);
+    }
+    _lightSpaceMvps[index] = _lightSpaceMatrix * _worlds[index];
+}
+
+void TransformSystem::update(const glm::mat4& lightSpaceMatrix, ThreadPool* pool) {
+    bool lightChanged = lightSpaceMatrix != _lightSpaceMatrix;
+    _lightSpaceMatrix = lightSpaceMatrix;
+
+    // a moved parent moves its children, parents come first so one pass reaches every descendant
+    if (!_childLevels.empty()) {
+        for (int i = 0; i < size(); i++) {
+            if (_parents[i] != NO_PARENT && _dirty[_parents[i]]) {
+                _dirty[i] = 1;
+            }
+        }
+    }
+
+    _updated.clear();
+    // level 0 is every root, found by scanning all indices, the deeper levels have index lists
+    for (int level = 0; level <= (int)_childLevels.size(); level++) {
+        const std::vector<int>* indices = level == 0 ? nullptr : &_childLevels[level - 1];
+        int count = level == 0 ? size() : (int)indices->size();
+        int batches = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+        if ((int)_batchUpdated.size() < batches) {
+            _batchUpdated.resize(batches);
+        }
+        auto runBatch = [&](int batch) {
+            int end = std::min((batch + 1) * BATCH_SIZE, count);
+            std::vector<int>& recomputed = _batchUpdated[batch];
+            recomputed.clear();
+            for (int i = batch * BATCH_SIZE; i < end; i++) {
+                int index = indices ? (*indices)[i] : i;
+                if (_levelOf[index] != level) {
+                    continue;
+                }
+                if (_dirty[index]) {
+                    computeMatrices(index);
+                    _dirty[index] = 0;
+                    recomputed.push_back(index);
+                } else if (lightChanged) {
+                    _lightSpaceMvps[index] = _lightSpaceMatrix * _worlds[index];
+                }
+            }
+        };
+        if (pool) {
+            pool->parallelFor(batches, runBatch);
+        } else {
+            for (int batch = 0; batch < batches; batch++) {
+                runBatch(batch);
+            }
+        }
+        for (int batch = 0; batch < batches; batch++) {
+            _updated.insert(_updated.end(), _batchUpdated[batch].begin(), _batchUpdated[batch].end());
+        }
+    }
+}
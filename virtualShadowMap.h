@@ -0,0 +1,339 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "shader.h"
+#include "scene.h"
+
+// Sparse, page based shadow map. A 16k^2 virtual map is split into 128^2 pages and only the
+// pages sampled by visible pixels (marked by a compute pass over the view depth buffer) get
+// a slot in a fixed physical page pool and are rendered. Rendered pages stay cached across
+// frames until the light changes or they are invalidated, so memory stays bounded while the
+// texel density near the camera is very high.
+class VirtualShadowMap {
+public:
+    static const int VIRTUAL_SIZE = 16384;
+    static const int PAGE_SIZE = 128;
+    static const int PAGES_PER_SIDE = VIRTUAL_SIZE / PAGE_SIZE;
+
+    VirtualShadowMap(int physicalSize, int maxPagesPerFrame);
+
+    // compute shaders need GL 4.3, without them the virtual map stays empty
+    bool supported() const { return _supported; }
+    // a new light matrix invalidates every cached page
+    void setLight(const glm::mat4& lightSpaceMatrix);
+    // drops the cached pages covering a world-space box, e.g. around a caster that moved
+    void invalidate(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+    // marks the pages sampled by the given depth buffer. The requests are read back a frame
+    // later once their fence has signaled, so this never stalls
+    void markPages(GLuint viewDepth, const glm::mat4& inverseViewProjection, bool reversedZ);
+    // assigns physical pages to the newest requests, evicting the least recently used pages
+    void update();
+
+    // renders the pages assigned by update()
+    void begin();
+    int pendingPages() const { return (int)_pending.size(); }
+    // viewport, scissor and clear for pending page i, returns the matrix to render it with
+    glm::mat4 beginPage(int i);
+    // true when a light-space NDC rectangle touches pending page i
+    bool pageOverlaps(int i, const glm::vec2& ndcMin, const glm::vec2& ndcMax) const;
+    void end();
+
+    // light-space NDC rectangle of a world-space box, for culling casters against pages
+    void lightSpaceRect(const glm::vec3& boundsMin, const glm::vec3& boundsMax, glm::vec2& ndcMin, glm::vec2& ndcMax) const;
+
+    const glm::mat4& lightSpaceMatrix() const { return _lightSpaceMatrix; }
+    GLuint pageTable() const { return _pageTableTexture; }
+    GLuint physicalTexture() const { return _physicalTexture; }
+    int physicalPagesPerSide() const { return _physicalPagesPerSide; }
+    int residentPages() const { return _resident; }
+    int requestedPages() const { return _requested; }
+    void deleteGLResources();
+
+private:
+    void releaseAll();
+    int allocatePhysical();
+
+    bool _supported;
+    int _physicalSize;
+    int _physicalPagesPerSide;
+    int _maxPagesPerFrame;
+    glm::mat4 _lightSpaceMatrix{1.0f};
+    long _frame = 0;
+
+    std::vector<int> _pageTable;        // virtual page -> physical page, -1 when not resident
+    std::vector<int> _physicalOwner;    // physical page -> virtual page, -1 when free
+    std::vector<long> _physicalLastUsed;
+    std::vector<uint32_t> _requests;
+    std::vector<int> _pending;          // virtual pages to render this frame
+    std::vector<int> _pendingPhysical;
+    bool _pageTableDirty = true;
+    int _resident = 0;
+    int _requested = 0;
+
+    GLuint _physicalTexture;
+    GLuint _fbo;
+    GLuint _pageTableTexture;
+    GLuint _requestBuffers[2];
+    GLsync _fences[2] = { 0, 0 };
+    int _requestIndex = 0;
+    Shader* _markShader = nullptr;
+};
+
+VirtualShadowMap::VirtualShadowMap(int physicalSize, int maxPagesPerFrame)
+    : _physicalSize(physicalSize), _maxPagesPerFrame(maxPagesPerFrame) {
+    _supported = GLAD_GL_VERSION_4_3;
+    _physicalPagesPerSide = physicalSize / PAGE_SIZE;
+    int physicalPages = _physicalPagesPerSide * _physicalPagesPerSide;
+    _pageTable.assign(PAGES_PER_SIDE * PAGES_PER_SIDE, -1);
+    _physicalOwner.assign(physicalPages, -1);
+    _physicalLastUsed.assign(physicalPages, -1);
+    _requests.assign(PAGES_PER_SIDE * PAGES_PER_SIDE, 0);
+
+    glGenTextures(1, &_physicalTexture);
+    glBindTexture(GL_TEXTURE_2D, _physicalTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, physicalSize, physicalSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenFramebuffers(1, &_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _physicalTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // physical page + 1 per virtual page, 0 when not resident
+    glGenTextures(1, &_pageTableTexture);
+    glBindTexture(GL_TEXTURE_2D, _pageTableTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, PAGES_PER_SIDE, PAGES_PER_SIDE, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenBuffers(2, _requestBuffers);
+    if (!_supported) {
+        std::cout << "Virtual shadow maps need OpenGL 4.3 compute shaders, disabled" << std::endl;
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, _requestBuffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, _requests.size() * sizeof(uint32_t), NULL, GL_DYNAMIC_READ);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    _markShader = new Shader("shaders/vsmMarkPages.comp");
+}
+
+void VirtualShadowMap::releaseAll() {
+    std::fill(_pageTable.begin(), _pageTable.end(), -1);
+    std::fill(_physicalOwner.begin(), _physicalOwner.end(), -1);
+    _pending.clear();
+    _pendingPhysical.clear();
+    _pageTableDirty = true;
+    _resident = 0;
+}
+
+void VirtualShadowMap::setLight(const glm::mat4& lightSpaceMatrix) {
+    if (lightSpaceMatrix != _lightSpaceMatrix) {
+        _lightSpaceMatrix = lightSpaceMatrix;
+        releaseAll();
+    }
+}
+
+void VirtualShadowMap::lightSpaceRect(const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                                      glm::vec2& ndcMin, glm::vec2& ndcMax) const {
+    glm::vec3 lo, hi;
+    transformBounds(_lightSpaceMatrix, boundsMin, boundsMax, lo, hi);
+    ndcMin = glm::vec2(lo);
+    ndcMax = glm::vec2(hi);
+}
+
+void VirtualShadowMap::invalidate(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+    glm::vec2 ndcMin, ndcMax;
+    lightSpaceRect(boundsMin, boundsMax, ndcMin, ndcMax);
+    glm::ivec2 lo = glm::clamp(glm::ivec2(glm::floor((ndcMin * 0.5f + 0.5f) * (float)PAGES_PER_SIDE)), 0, PAGES_PER_SIDE - 1);
+    glm::ivec2 hi = glm::clamp(glm::ivec2(glm::floor((ndcMax * 0.5f + 0.5f) * (float)PAGES_PER_SIDE)), 0, PAGES_PER_SIDE - 1);
+    for (int y = lo.y; y <= hi.y; y++) {
+        for (int x = lo.x; x <= hi.x; x++) {
+            int page = y * PAGES_PER_SIDE + x;
+            if (_pageTable[page] >= 0) {
+                _physicalOwner[_pageTable[page]] = -1;
+                _pageTable[page] = -1;
+                _resident--;
+                _pageTableDirty = true;
+            }
+        }
+    }
+}
+
+void VirtualShadowMap::markPages(GLuint viewDepth, const glm::mat4& inverseViewProjection, bool reversedZ) {
+    if (!_supported) {
+        return;
+    }
+    // pick up the requests of earlier frames the GPU is done with, oldest first so the newest wins
+    for (int i = 0; i < 2; i++) {
+        int slot = (_requestIndex + i) % 2;
+        if (_fences[slot] != 0 && glClientWaitSync(_fences[slot], 0, 0) != GL_TIMEOUT_EXPIRED) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, _requestBuffers[slot]);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, _requests.size() * sizeof(uint32_t), _requests.data());
+            glDeleteSync(_fences[slot]);
+            _fences[slot] = 0;
+        }
+    }
+    // the slot is still in flight, skip marking this frame rather than wait
+    if (_fences[_requestIndex] != 0) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        return;
+    }
+
+    GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _requestBuffers[_requestIndex]);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _requestBuffers[_requestIndex]);
+
+    _markShader->use();
+    _markShader->setMat4("inverseViewProjection", inverseViewProjection);
+    _markShader->setBool("reversedZ", reversedZ);
+    _markShader->setMat4("lightSpaceMatrix", _lightSpaceMatrix);
+    _markShader->setInt("pagesPerSide", PAGES_PER_SIDE);
+    _markShader->setInt("viewDepth", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, viewDepth);
+    GLint size[2];
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &size[0]);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &size[1]);
+    glDispatchCompute((size[0] + 7) / 8, (size[1] + 7) / 8, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    _fences[_requestIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _requestIndex = 1 - _requestIndex;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+int VirtualShadowMap::allocatePhysical() {
+    int best = -1;
+    for (int i = 0; i < (int)_physicalOwner.size(); i++) {
+        if (_physicalOwner[i] < 0) {
+            return i;
+        }
+        // never evict a page that is in use this frame
+        if (_physicalLastUsed[i] < _frame && (best < 0 || _physicalLastUsed[i] < _physicalLastUsed[best])) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        _pageTable[_physicalOwner[best]] = -1;
+        _physicalOwner[best] = -1;
+        _resident--;
+        _pageTableDirty = true;
+    }
+    return best;
+}
+
+void VirtualShadowMap::update() {
+    _frame++;
+    _pending.clear();
+    _pendingPhysical.clear();
+    _requested = 0;
+
+    std::vector<int> missing;
+    for (int page = 0; page < (int)_requests.size(); page++) {
+        if (!_requests[page]) {
+            continue;
+        }
+        _requested++;
+        if (_pageTable[page] >= 0) {
+            _physicalLastUsed[_pageTable[page]] = _frame;
+        } else {
+            missing.push_back(page);
+        }
+    }
+
+    // spread the rendering of newly visible pages over several frames
+    for (int page : missing) {
+        if ((int)_pending.size() >= _maxPagesPerFrame) {
+            break;
+        }
+        int physical = allocatePhysical();
+        if (physical < 0) {
+            break;
+        }
+        _physicalOwner[physical] = page;
+        _physicalLastUsed[physical] = _frame;
+        _pending.push_back(page);
+        _pendingPhysical.push_back(physical);
+    }
+}
+
+void VirtualShadowMap::begin() {
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glEnable(GL_SCISSOR_TEST);
+}
+
+glm::mat4 VirtualShadowMap::beginPage(int i) {
+    int physical = _pendingPhysical[i];
+    int x = (physical % _physicalPagesPerSide) * PAGE_SIZE;
+    int y = (physical / _physicalPagesPerSide) * PAGE_SIZE;
+    glViewport(x, y, PAGE_SIZE, PAGE_SIZE);
+    glScissor(x, y, PAGE_SIZE, PAGE_SIZE);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    // the page's part of light NDC is stretched over the whole viewport
+    int page = _pending[i];
+    glm::vec2 center = (glm::vec2(page % PAGES_PER_SIDE, page / PAGES_PER_SIDE) + 0.5f) * (2.0f / PAGES_PER_SIDE) - 1.0f;
+    glm::mat4 pageMatrix = glm::scale(glm::mat4(1.0f), glm::vec3((float)PAGES_PER_SIDE, (float)PAGES_PER_SIDE, 1.0f)) *
+                           glm::translate(glm::mat4(1.0f), glm::vec3(-center, 0.0f));
+    return pageMatrix * _lightSpaceMatrix;
+}
+
+bool VirtualShadowMap::pageOverlaps(int i, const glm::vec2& ndcMin, const glm::vec2& ndcMax) const {
+    int page = _pending[i];
+    glm::vec2 lo = glm::vec2(page % PAGES_PER_SIDE, page / PAGES_PER_SIDE) * (2.0f / PAGES_PER_SIDE) - 1.0f;
+    glm::vec2 hi = lo + 2.0f / PAGES_PER_SIDE;
+    return ndcMax.x >= lo.x && ndcMin.x <= hi.x && ndcMax.y >= lo.y && ndcMin.y <= hi.y;
+}
+
+void VirtualShadowMap::end() {
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // pages become visible to the lit pass once they hold valid depth
+    for (int i = 0; i < (int)_pending.size(); i++) {
+        _pageTable[_pending[i]] = _pendingPhysical[i];
+        _resident++;
+        _pageTableDirty = true;
+    }
+    _pending.clear();
+    _pendingPhysical.clear();
+
+    if (_pageTableDirty) {
+        std::vector<uint32_t> table(_pageTable.size());
+        for (int i = 0; i < (int)_pageTable.size(); i++) {
+            table[i] = (uint32_t)(_pageTable[i] + 1);
+        }
+        glBindTexture(GL_TEXTURE_2D, _pageTableTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, PAGES_PER_SIDE, PAGES_PER_SIDE, GL_RED_INTEGER, GL_UNSIGNED_INT, table.data());
+        _pageTableDirty = false;
+    }
+}
+
+void VirtualShadowMap::deleteGLResources() {
+    for (int i = 0; i < 2; i++) {
+        if (_fences[i] != 0) {
+            glDeleteSync(_fences[i]);
+        }
+    }
+    glDeleteBuffers(2, _requestBuffers);
+    glDeleteTextures(1, &_physicalTexture);
+    glDeleteTextures(1, &_pageTableTexture);
+    glDeleteFramebuffers(1, &_fbo);
+    delete _markShader;
+}